@@ -27,7 +27,8 @@
 typedef NS_OPTIONS(NSUInteger, VSRegularExpressionOptions) {
   VSRegularExpressionCaseInsensitive = 1 << 0,
   VSRegularExpressionAnchorsMatchLines = 1 << 1,
-  VSRegularExpressionMatchGlobally = 1 << 2
+  VSRegularExpressionMatchGlobally = 1 << 2,
+  VSRegularExpressionLeftmostFirst = 1 << 3
 };
 
 @interface VSRegularExpression : NSObject <NSCopying, NSCoding>
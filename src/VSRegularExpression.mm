@@ -130,11 +130,13 @@ NSString *const kErrorDomain = @"VSRegularExpressionErrorDomain";
   bool global = options & VSRegularExpressionMatchGlobally;
   bool multiline = options & VSRegularExpressionAnchorsMatchLines;
   bool ignoreCase = options & VSRegularExpressionCaseInsensitive;
+  bool leftmostFirst = options & VSRegularExpressionLeftmostFirst;
   jscre::regexp::RegExpPtr re = std::make_shared<jscre::regexp::RegExp>(patternRaw,
                                                                         patternRawLength,
                                                                         global,
                                                                         multiline,
-                                                                        ignoreCase);
+                                                                        ignoreCase,
+                                                                        leftmostFirst);
 
   free(patternRaw);
 
@@ -179,6 +181,9 @@ NSString *const kErrorDomain = @"VSRegularExpressionErrorDomain";
   if (_options & VSRegularExpressionMatchGlobally) {
     [array addObject:@"MatchGlobally"];
   }
+  if (_options & VSRegularExpressionLeftmostFirst) {
+    [array addObject:@"LeftmostFirst"];
+  }
 
   if ([array count] == 0) {
     return @"None";
@@ -0,0 +1,601 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "analyzer.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace jscre {
+namespace analyzer {
+
+namespace {
+
+struct FirstCharacters {
+  ast::CharacterRangeVector ranges;
+  bool nullable;
+  bool unbounded;
+
+  FirstCharacters()
+    : nullable(false),
+      unbounded(false) {}
+};
+
+void add_range(ast::CharacterRangeVector &ranges, uint16_t first, uint16_t last, bool ignoreCase)
+{
+  if (ignoreCase && first <= 'Z' && last >= 'A') {
+    // The input is lower-cased, so 'A'-'Z' never occurs in it.
+    uint16_t upperFirst = std::max<uint16_t>(first, 'A');
+    uint16_t upperLast = std::min<uint16_t>(last, 'Z');
+    ranges.push_back(std::make_pair(upperFirst - 'A' + 'a', upperLast - 'A' + 'a'));
+
+    if (first < 'A') {
+      ranges.push_back(std::make_pair(first, 'A' - 1));
+    }
+    if (last > 'Z') {
+      ranges.push_back(std::make_pair('Z' + 1, last));
+    }
+  }
+  else {
+    ranges.push_back(std::make_pair(first, last));
+  }
+}
+
+void merge(FirstCharacters &result, const FirstCharacters &other)
+{
+  result.unbounded = result.unbounded || other.unbounded;
+  if (!result.unbounded) {
+    result.ranges.insert(result.ranges.end(), other.ranges.begin(), other.ranges.end());
+  }
+}
+
+FirstCharacters collect_first_characters(const ast::ExprPtr &expr, bool ignoreCase)
+{
+  FirstCharacters result;
+
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation:
+    result.nullable = true;
+    for (auto &subExpr: static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+      FirstCharacters sub = collect_first_characters(subExpr, ignoreCase);
+      merge(result, sub);
+      if (result.unbounded || !sub.nullable) {
+        result.nullable = false;
+        break;
+      }
+    }
+    break;
+
+  case ast::ExprType::Disjunction:
+    for (auto &subExpr: static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs()) {
+      FirstCharacters sub = collect_first_characters(subExpr, ignoreCase);
+      merge(result, sub);
+      result.nullable = result.nullable || sub.nullable;
+      if (result.unbounded) {
+        break;
+      }
+    }
+    break;
+
+  case ast::ExprType::Empty:
+  case ast::ExprType::Assertion:
+    // Zero-width; look-ahead assertions could only narrow the set further.
+    result.nullable = true;
+    break;
+
+  case ast::ExprType::CharacterClass: {
+      const ast::CharacterClassExpr *cc = static_cast<const ast::CharacterClassExpr *>(expr.get());
+      if (cc->isInverse()) {
+        result.unbounded = true;
+      }
+      else {
+        for (auto &range: cc->getRanges()) {
+          add_range(result.ranges, range.first, range.second, ignoreCase);
+        }
+      }
+    }
+    break;
+
+  case ast::ExprType::Literal: {
+      uint16_t ch = static_cast<const ast::LiteralExpr *>(expr.get())->getText().front();
+      add_range(result.ranges, ch, ch, ignoreCase);
+    }
+    break;
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      if (quantification->getMaximum() == 0) {
+        result.nullable = true;
+      }
+      else {
+        result = collect_first_characters(quantification->getSubExpr(), ignoreCase);
+        result.nullable = result.nullable || quantification->getMinimum() == 0;
+      }
+    }
+    break;
+
+  case ast::ExprType::Group:
+    result = collect_first_characters(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr(), ignoreCase);
+    break;
+
+  case ast::ExprType::Backreference:
+    result.unbounded = true;
+    break;
+  }
+
+  if (result.unbounded) {
+    result.ranges.clear();
+  }
+
+  return std::move(result);
+}
+
+bool is_zero_width(const ast::ExprPtr &expr)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Empty:
+  case ast::ExprType::Assertion:
+    return true;
+
+  case ast::ExprType::Concatenation:
+    for (auto &subExpr: static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+      if (!is_zero_width(subExpr)) {
+        return false;
+      }
+    }
+    return true;
+
+  case ast::ExprType::Disjunction:
+    for (auto &subExpr: static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs()) {
+      if (!is_zero_width(subExpr)) {
+        return false;
+      }
+    }
+    return true;
+
+  case ast::ExprType::Quantification:
+    return is_zero_width(static_cast<const ast::QuantificationExpr *>(expr.get())->getSubExpr());
+
+  case ast::ExprType::Group:
+    return is_zero_width(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr());
+
+  default:
+    return false;
+  }
+}
+
+bool is_anchored(const ast::ExprPtr &expr, ast::AssertionType type)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Assertion:
+    return static_cast<const ast::AssertionExpr *>(expr.get())->getAssertionType() == type;
+
+  case ast::ExprType::Concatenation: {
+      // Zero-width terms may be skipped over on the way to the anchor.
+      const ast::ExprVector &subExprs = static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs();
+      if (type == ast::AssertionType::BeginOfLine) {
+        for (auto it = subExprs.begin(); it != subExprs.end(); ++it) {
+          if (is_anchored(*it, type)) {
+            return true;
+          }
+          else if (!is_zero_width(*it)) {
+            return false;
+          }
+        }
+      }
+      else {
+        for (auto it = subExprs.rbegin(); it != subExprs.rend(); ++it) {
+          if (is_anchored(*it, type)) {
+            return true;
+          }
+          else if (!is_zero_width(*it)) {
+            return false;
+          }
+        }
+      }
+      return false;
+    }
+
+  case ast::ExprType::Disjunction: {
+      const ast::ExprVector &subExprs = static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs();
+      for (auto &subExpr: subExprs) {
+        if (!is_anchored(subExpr, type)) {
+          return false;
+        }
+      }
+      return !subExprs.empty();
+    }
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      return quantification->getMinimum() > 0 && is_anchored(quantification->getSubExpr(), type);
+    }
+
+  case ast::ExprType::Group:
+    return is_anchored(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr(), type);
+
+  default:
+    return false;
+  }
+}
+
+size_t add_lengths(size_t lhs, size_t rhs)
+{
+  if (lhs == Lengths::Infinite || rhs == Lengths::Infinite || lhs > Lengths::Infinite - rhs) {
+    return Lengths::Infinite;
+  }
+  return lhs + rhs;
+}
+
+size_t multiply_lengths(size_t lhs, size_t rhs)
+{
+  if (lhs == 0 || rhs == 0) {
+    return 0;
+  }
+  else if (lhs == Lengths::Infinite || rhs == Lengths::Infinite || lhs > Lengths::Infinite / rhs) {
+    return Lengths::Infinite;
+  }
+  return lhs * rhs;
+}
+
+Lengths compute_lengths(const ast::ExprPtr &expr)
+{
+  Lengths result;
+  result.minimum = 0;
+  result.maximum = 0;
+
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation:
+    for (auto &subExpr: static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+      Lengths sub = compute_lengths(subExpr);
+      result.minimum = add_lengths(result.minimum, sub.minimum);
+      result.maximum = add_lengths(result.maximum, sub.maximum);
+    }
+    break;
+
+  case ast::ExprType::Disjunction: {
+      bool first = true;
+      for (auto &subExpr: static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs()) {
+        Lengths sub = compute_lengths(subExpr);
+        result.minimum = first ? sub.minimum : std::min(result.minimum, sub.minimum);
+        result.maximum = first ? sub.maximum : std::max(result.maximum, sub.maximum);
+        first = false;
+      }
+    }
+    break;
+
+  case ast::ExprType::Empty:
+  case ast::ExprType::Assertion:
+    break;
+
+  case ast::ExprType::CharacterClass:
+    result.minimum = 1;
+    result.maximum = 1;
+    break;
+
+  case ast::ExprType::Literal:
+    result.minimum = static_cast<const ast::LiteralExpr *>(expr.get())->getText().size();
+    result.maximum = result.minimum;
+    break;
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      Lengths sub = compute_lengths(quantification->getSubExpr());
+      result.minimum = multiply_lengths(sub.minimum, quantification->getMinimum());
+      result.maximum = multiply_lengths(sub.maximum, quantification->getMaximum());
+    }
+    break;
+
+  case ast::ExprType::Group:
+    result = compute_lengths(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr());
+    break;
+
+  case ast::ExprType::Backreference:
+    result.maximum = Lengths::Infinite;
+    break;
+  }
+
+  return result;
+}
+
+bool overlaps(const FirstCharacters &lhs, const FirstCharacters &rhs)
+{
+  if (!lhs.unbounded && lhs.ranges.empty()) {
+    return false;
+  }
+  if (!rhs.unbounded && rhs.ranges.empty()) {
+    return false;
+  }
+  if (lhs.unbounded || rhs.unbounded) {
+    return true;
+  }
+
+  for (auto &left: lhs.ranges) {
+    for (auto &right: rhs.ranges) {
+      if (left.first <= right.second && right.first <= left.second) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * Collects the unbounded quantifiers that can end a match of expr, i.e. the
+ * ones followed only by terms that can match empty.
+ */
+void collect_trailing_quantifiers(const ast::ExprPtr &expr,
+                                  std::vector<const ast::QuantificationExpr *> &quantifications)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation: {
+      const ast::ExprVector &subExprs = static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs();
+      for (auto it = subExprs.rbegin(); it != subExprs.rend(); ++it) {
+        collect_trailing_quantifiers(*it, quantifications);
+        if (compute_lengths(*it).minimum > 0) {
+          break;
+        }
+      }
+    }
+    break;
+
+  case ast::ExprType::Disjunction:
+    for (auto &subExpr: static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs()) {
+      collect_trailing_quantifiers(subExpr, quantifications);
+    }
+    break;
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      if (quantification->getMaximum() > 1) {
+        quantifications.push_back(quantification);
+      }
+      else if (quantification->getMaximum() > 0) {
+        collect_trailing_quantifiers(quantification->getSubExpr(), quantifications);
+      }
+    }
+    break;
+
+  case ast::ExprType::Group:
+    collect_trailing_quantifiers(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr(), quantifications);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Copies are counted the way the NFA constructor counts them: an unbounded
+// quantifier takes one more than its minimum.
+size_t count_copies(const ast::QuantificationExpr *quantification)
+{
+  if (quantification->getMaximum() == ast::QuantificationExpr::Infinite) {
+    return quantification->getMinimum() + 1;
+  }
+  return quantification->getMaximum();
+}
+
+bool is_counted(const ast::QuantificationExpr *quantification, size_t copyNodeCount, size_t unrollLimit)
+{
+  size_t copies = count_copies(quantification);
+  return copies > 1 && copyNodeCount * copies > unrollLimit;
+}
+
+/*
+ * About as many nodes as the NFA constructor makes for expr, with the same
+ * choice between unrolling a repetition and giving it a counter.
+ */
+size_t count_nodes(const ast::ExprPtr &expr, size_t unrollLimit)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation: {
+      size_t count = 0;
+      for (auto &subExpr: static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+        count += count_nodes(subExpr, unrollLimit);
+      }
+      return count;
+    }
+
+  case ast::ExprType::Disjunction: {
+      size_t count = 2;
+      for (auto &subExpr: static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs()) {
+        count += count_nodes(subExpr, unrollLimit);
+      }
+      return count;
+    }
+
+  case ast::ExprType::Assertion:
+    if (static_cast<const ast::AssertionExpr *>(expr.get())->getAssertionType() == ast::AssertionType::LookAhead) {
+      return 2 + count_nodes(static_cast<const ast::LookAheadAssertionExpr *>(expr.get())->getSubExpr(),
+                             unrollLimit);
+    }
+    return 2;
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      if (quantification->getMaximum() == 0) {
+        return 2;
+      }
+
+      size_t count = count_nodes(quantification->getSubExpr(), unrollLimit);
+      size_t extra = quantification->isGreedy() ? 0 : 2;
+      if (is_counted(quantification, count, unrollLimit)) {
+        return count + 3 + extra;
+      }
+
+      bool unbounded = quantification->getMaximum() == ast::QuantificationExpr::Infinite;
+      return count * count_copies(quantification) + (unbounded ? 2 : 0) + extra;
+    }
+
+  case ast::ExprType::Group: {
+      const ast::GroupExpr *group = static_cast<const ast::GroupExpr *>(expr.get());
+      return count_nodes(group->getSubExpr(), unrollLimit) + (group->shouldCapture() ? 2 : 0);
+    }
+
+  default:
+    return 2;
+  }
+}
+
+void add_hazard(HazardVector &hazards, HazardKind kind, const ast::Expr *expr)
+{
+  hazards.push_back(Hazard {kind, expr->getPosition(), expr->getLength()});
+}
+
+void collect_hazards(const ast::ExprPtr &expr,
+                     bool ignoreCase,
+                     size_t unrollLimit,
+                     bool repeated,
+                     HazardVector &hazards)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation:
+    for (auto &subExpr: static_cast<const ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+      collect_hazards(subExpr, ignoreCase, unrollLimit, repeated, hazards);
+    }
+    break;
+
+  case ast::ExprType::Disjunction: {
+      const ast::ExprVector &subExprs = static_cast<const ast::DisjunctionExpr *>(expr.get())->getSubExprs();
+      if (repeated) {
+        std::vector<FirstCharacters> firsts;
+        bool overlapping = false;
+        for (auto &subExpr: subExprs) {
+          FirstCharacters first = collect_first_characters(subExpr, ignoreCase);
+          for (auto &other: firsts) {
+            overlapping = overlapping || overlaps(first, other);
+          }
+          firsts.push_back(std::move(first));
+        }
+        if (overlapping) {
+          add_hazard(hazards, HazardKind::OverlappingAlternation, expr.get());
+        }
+      }
+
+      for (auto &subExpr: subExprs) {
+        collect_hazards(subExpr, ignoreCase, unrollLimit, repeated, hazards);
+      }
+    }
+    break;
+
+  case ast::ExprType::Assertion:
+    if (static_cast<const ast::AssertionExpr *>(expr.get())->getAssertionType() == ast::AssertionType::LookAhead) {
+      collect_hazards(static_cast<const ast::LookAheadAssertionExpr *>(expr.get())->getSubExpr(),
+                      ignoreCase, unrollLimit, repeated, hazards);
+    }
+    break;
+
+  case ast::ExprType::Quantification: {
+      const ast::QuantificationExpr *quantification = static_cast<const ast::QuantificationExpr *>(expr.get());
+      const ast::ExprPtr &subExpr = quantification->getSubExpr();
+      bool repeats = quantification->getMaximum() > 1;
+
+      if (quantification->getMaximum() > 0 &&
+          is_counted(quantification, count_nodes(subExpr, unrollLimit), unrollLimit)) {
+        add_hazard(hazards, HazardKind::LargeRepetition, expr.get());
+      }
+
+      if (repeats) {
+        std::vector<const ast::QuantificationExpr *> trailing;
+        collect_trailing_quantifiers(subExpr, trailing);
+        if (!trailing.empty()) {
+          FirstCharacters first = collect_first_characters(subExpr, ignoreCase);
+          for (auto &inner: trailing) {
+            if (overlaps(first, collect_first_characters(inner->getSubExpr(), ignoreCase))) {
+              add_hazard(hazards, HazardKind::NestedQuantifier, expr.get());
+              break;
+            }
+          }
+        }
+      }
+
+      collect_hazards(subExpr, ignoreCase, unrollLimit, repeated || repeats, hazards);
+    }
+    break;
+
+  case ast::ExprType::Group:
+    collect_hazards(static_cast<const ast::GroupExpr *>(expr.get())->getSubExpr(),
+                    ignoreCase, unrollLimit, repeated, hazards);
+    break;
+
+  default:
+    break;
+  }
+}
+
+} // end namespace
+
+bool analyze_first_characters(const ast::ExprPtr &expr,
+                              bool ignoreCase,
+                              ast::CharacterRangeVector &ranges)
+{
+  assert(expr != nullptr);
+
+  FirstCharacters result = collect_first_characters(expr, ignoreCase);
+  ranges.clear();
+  if (result.unbounded || result.nullable || result.ranges.empty()) {
+    return false;
+  }
+
+  std::sort(result.ranges.begin(), result.ranges.end());
+  for (auto &range: result.ranges) {
+    if (!ranges.empty() && static_cast<uint32_t>(ranges.back().second) + 1 >= range.first) {
+      ranges.back().second = std::max(ranges.back().second, range.second);
+    }
+    else {
+      ranges.push_back(range);
+    }
+  }
+
+  return true;
+}
+
+Anchors analyze_anchors(const ast::ExprPtr &expr)
+{
+  assert(expr != nullptr);
+
+  Anchors anchors;
+  anchors.begin = is_anchored(expr, ast::AssertionType::BeginOfLine);
+  anchors.end = is_anchored(expr, ast::AssertionType::EndOfLine);
+  return anchors;
+}
+
+Lengths analyze_lengths(const ast::ExprPtr &expr)
+{
+  assert(expr != nullptr);
+  return compute_lengths(expr);
+}
+
+HazardVector analyze_hazards(const ast::ExprPtr &expr,
+                             bool ignoreCase,
+                             size_t unrollLimit)
+{
+  assert(expr != nullptr);
+
+  HazardVector hazards;
+  collect_hazards(expr, ignoreCase, unrollLimit, false, hazards);
+  return hazards;
+}
+
+} // end namespace analyzer
+} // end namespace jscre
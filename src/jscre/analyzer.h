@@ -0,0 +1,109 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_analyzer_h__
+#define __jscre_analyzer_h__
+
+#include "ast.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace jscre {
+namespace analyzer {
+
+/*
+ * Computes the set of code units that can begin a match of expr, as sorted
+ * and disjoint ranges.  With ignoreCase the set is expressed in terms of the
+ * lower-cased input the executor sees.
+ *
+ * Returns false if no useful set exists, i.e. expr can match the empty
+ * string or its first code unit is unconstrained.
+ */
+bool analyze_first_characters(const ast::ExprPtr &expr,
+                              bool ignoreCase,
+                              ast::CharacterRangeVector &ranges);
+
+/*
+ * Whether every match of an expression has to begin where ^ holds, and
+ * whether it has to end where $ holds.
+ */
+struct Anchors {
+  bool begin;
+  bool end;
+};
+
+Anchors analyze_anchors(const ast::ExprPtr &expr);
+
+/*
+ * The shortest and longest possible match of an expression, in code units.
+ * maximum is Infinite if the length is unbounded.
+ */
+struct Lengths {
+  size_t minimum;
+  size_t maximum;
+
+  static constexpr size_t Infinite = SIZE_MAX;
+};
+
+Lengths analyze_lengths(const ast::ExprPtr &expr);
+
+/*
+ * Constructs that make a pattern expensive to match:
+ *
+ * - NestedQuantifier: a quantifier that repeats its body, bounded or not,
+ *   whose body can end in another repeating quantifier over some of the
+ *   same characters, as in (a+)+ or (a+){2,5}, so that a run of input can
+ *   be split between the iterations in many ways.
+ * - OverlappingAlternation: alternatives under a repeating quantifier that
+ *   can begin with the same character, as in (a|ab)* or (a|ab){8}.
+ * - LargeRepetition: a counted repetition that would unroll into more than
+ *   unrollLimit NFA nodes, which is compiled into a counter that only the
+ *   backtracker and the exhaustive search can run.
+ *
+ * position and length locate the construct in the pattern; they are only
+ * meaningful on expressions straight from the parser.
+ */
+enum class HazardKind {
+  NestedQuantifier,
+  OverlappingAlternation,
+  LargeRepetition
+};
+
+struct Hazard {
+  HazardKind kind;
+  size_t position;
+  size_t length;
+};
+
+typedef std::vector<Hazard> HazardVector;
+
+HazardVector analyze_hazards(const ast::ExprPtr &expr,
+                             bool ignoreCase,
+                             size_t unrollLimit);
+
+} // end namespace analyzer
+} // end namespace jscre
+
+#endif /* __jscre_analyzer_h__ */
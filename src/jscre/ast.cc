@@ -30,6 +30,19 @@
 namespace jscre {
 namespace ast {
 
+LiteralExpr::LiteralExpr(const ExprVector &characters)
+  : _characters(characters)
+{
+  _text.reserve(_characters.size());
+
+  for (auto &character: _characters) {
+    assert(character->getType() == ExprType::CharacterClass);
+    const CharacterRangeVector &ranges = static_cast<CharacterClassExpr *>(character.get())->getRanges();
+    assert(ranges.size() == 1 && ranges.front().first == ranges.front().second);
+    _text.push_back(ranges.front().first);
+  }
+}
+
 void RecursiveExprVisitor::traverseExpr(const ExprPtr &expr)
 {
   assert(expr != nullptr);
@@ -82,6 +95,10 @@ void RecursiveExprVisitor::traverseExpr(const ExprPtr &expr)
     visitBackreferenceExpr(static_cast<BackreferenceExpr *>(expr.get()));
     break;
 
+  case ExprType::Literal:
+    visitLiteralExpr(static_cast<LiteralExpr *>(expr.get()));
+    break;
+
   default:
     assert(false);
     break;
@@ -117,6 +134,13 @@ void RecursiveExprVisitor::traverseGroupExpr(GroupExpr *expr)
   traverseExpr(expr->getSubExpr());
 }
 
+void RecursiveExprVisitor::traverseLiteralExpr(LiteralExpr *expr)
+{
+  for (auto &character: expr->getCharacters()) {
+    traverseExpr(character);
+  }
+}
+
 namespace {
 
 class ToStringRecursiveExprVisitor : public RecursiveExprVisitor {
@@ -140,6 +164,7 @@ public:
   virtual void visitQuantificationExpr(QuantificationExpr *expr);
   virtual void visitGroupExpr(GroupExpr *expr);
   virtual void visitBackreferenceExpr(BackreferenceExpr *expr);
+  virtual void visitLiteralExpr(LiteralExpr *expr);
 
 private:
   size_t _indentLevel;
@@ -250,6 +275,16 @@ void ToStringRecursiveExprVisitor::visitBackreferenceExpr(BackreferenceExpr *exp
   os() << "Backreference #" << expr->getIndex() << "\n";
 }
 
+void ToStringRecursiveExprVisitor::visitLiteralExpr(LiteralExpr *expr)
+{
+  std::ostringstream o;
+  for (auto ch: expr->getText()) {
+    o << "\\u" << std::setw(4) << std::setfill('0') << std::hex << ch;
+  }
+
+  os() << "Literal \"" << o.str() << "\"\n";
+}
+
 } // end namespace
 
 std::string to_string(const ExprPtr &expr)
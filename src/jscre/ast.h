@@ -41,18 +41,35 @@ enum class ExprType {
   Assertion,
   Quantification,
   Group,
-  Backreference
+  Backreference,
+  Literal
 };
 
 class Expr {
 public:
-  Expr() {}
+  static constexpr size_t NoPosition = SIZE_MAX;
+
+  Expr() : _position(NoPosition), _length(0) {}
   virtual ~Expr() {}
 
   Expr(const Expr &) = delete;
   Expr &operator=(const Expr &) = delete;
 
   virtual ExprType getType() const = 0;
+
+  // The span of the pattern this node was parsed from, in code units.
+  // Nodes built by the optimizer carry no span.
+  size_t getPosition() const { return _position; }
+  size_t getLength() const { return _length; }
+  void setSpan(size_t position, size_t length)
+  {
+    _position = position;
+    _length = length;
+  }
+
+private:
+  size_t _position;
+  size_t _length;
 };
 
 typedef std::shared_ptr<Expr> ExprPtr;
@@ -232,6 +249,20 @@ private:
   size_t _index;
 };
 
+class LiteralExpr : public Expr {
+public:
+  explicit LiteralExpr(const ExprVector &characters);
+
+  const ExprVector &getCharacters() const { return _characters; }
+  const std::vector<uint16_t> &getText() const { return _text; }
+
+  virtual ExprType getType() const { return ExprType::Literal; }
+
+private:
+  ExprVector _characters;
+  std::vector<uint16_t> _text;
+};
+
 class RecursiveExprVisitor {
 public:
   void traverseExpr(const ExprPtr &expr);
@@ -241,6 +272,7 @@ public:
   void traverseLookAheadAssertionExpr(LookAheadAssertionExpr *expr);
   void traverseQuantificationExpr(QuantificationExpr *expr);
   void traverseGroupExpr(GroupExpr *expr);
+  void traverseLiteralExpr(LiteralExpr *expr);
 
   virtual void visitConcatenationExpr(ConcatenationExpr *expr) {}
   virtual void visitDisjunctionExpr(DisjunctionExpr *expr) {}
@@ -251,6 +283,7 @@ public:
   virtual void visitQuantificationExpr(QuantificationExpr *expr) {}
   virtual void visitGroupExpr(GroupExpr *expr) {}
   virtual void visitBackreferenceExpr(BackreferenceExpr *expr) {}
+  virtual void visitLiteralExpr(LiteralExpr *expr) {}
 };
 
 std::string to_string(const ExprPtr &expr);
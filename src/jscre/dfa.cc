@@ -0,0 +1,1200 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dfa.h"
+#include "exec.h"
+#include "utf16_string.h"
+#include <assert.h>
+#include <algorithm>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+
+namespace jscre {
+namespace dfa {
+
+CharType get_char_type(uint16_t ch)
+{
+  if (exec::is_word_char(ch)) {
+    return CharType::Word;
+  }
+  else if (exec::is_line_terminator(ch)) {
+    return CharType::LineTerminator;
+  }
+  else {
+    return CharType::Other;
+  }
+}
+
+namespace {
+
+enum class RawEdgeType {
+  Epsilon,
+  Assertion,
+  CharacterSet,
+  Character,
+  Range
+};
+
+/*
+ * An edge of the NFA on its way into a program.  A Range edge takes the
+ * code units from character to last; UTF-8 programs have them in place of
+ * the other consuming edges, one per byte of each sequence.
+ */
+struct RawEdge {
+  RawEdgeType type;
+  uint32_t from;
+  uint32_t to;
+  const ast::CharacterClassExpr *expr;
+  ast::AssertionType assertionType;
+  uint16_t character;
+  uint16_t last;
+  uint32_t tag;
+};
+
+/*
+ * Collects the edges of nfa, numbering its nodes from base on.  nodeCount
+ * receives the number of nodes up to and including those of nfa.
+ */
+bool collect_edges(const nfa::NFAPtr &nfa,
+                   uint32_t base,
+                   std::vector<RawEdge> &edges,
+                   std::vector<std::pair<uint32_t, uint32_t>> &loops,
+                   size_t &nodeCount)
+{
+  std::vector<bool> visited(nfa->nodeCount, false);
+  std::vector<nfa::Node *> stack;
+
+  assert(nfa->start->index < nfa->nodeCount);
+  visited[nfa->start->index] = true;
+  stack.push_back(nfa->start.get());
+
+  nodeCount = base + nfa->nodeCount;
+
+  while (!stack.empty()) {
+    nfa::Node *node = stack.back();
+    stack.pop_back();
+
+    if (node->loopHead != nullptr) {
+      loops.push_back(std::make_pair(base + static_cast<uint32_t>(node->index),
+                                     base + static_cast<uint32_t>(node->loopHead->index)));
+    }
+
+    for (auto &edge: node->edges) {
+      RawEdge raw;
+      raw.type = RawEdgeType::Epsilon;
+      raw.from = base + static_cast<uint32_t>(node->index);
+      raw.to = base + static_cast<uint32_t>(edge->node->index);
+      raw.expr = nullptr;
+      raw.assertionType = ast::AssertionType::BeginOfLine;
+      raw.character = 0;
+      raw.last = 0;
+      raw.tag = Program::NoTag;
+
+      switch (edge->type) {
+      case nfa::EdgeType::BeginCapture:
+        raw.tag = static_cast<uint32_t>(2 * edge->storageIndex);
+        edges.push_back(raw);
+        break;
+
+      case nfa::EdgeType::EndCapture:
+        raw.tag = static_cast<uint32_t>(2 * edge->storageIndex + 1);
+        edges.push_back(raw);
+        break;
+
+      case nfa::EdgeType::Epsilon:
+      case nfa::EdgeType::BeginNonGreedy:
+      case nfa::EdgeType::EndNonGreedy:
+        edges.push_back(raw);
+        break;
+
+      case nfa::EdgeType::CharacterSet:
+        raw.type = RawEdgeType::CharacterSet;
+        raw.expr = edge->expr;
+        edges.push_back(raw);
+        break;
+
+      case nfa::EdgeType::String: {
+          const std::vector<uint16_t> &text = edge->literal->getText();
+          assert(!text.empty());
+          raw.type = RawEdgeType::Character;
+          for (size_t i = 0; i < text.size(); ++i) {
+            raw.to = (i + 1 == text.size()) ? base + static_cast<uint32_t>(edge->node->index)
+                                            : static_cast<uint32_t>(nodeCount++);
+            raw.character = text[i];
+            edges.push_back(raw);
+            raw.from = raw.to;
+          }
+        }
+        break;
+
+      case nfa::EdgeType::Assertion:
+        if (edge->assertion->getAssertionType() == ast::AssertionType::LookAhead) {
+          return false;
+        }
+        raw.type = RawEdgeType::Assertion;
+        raw.assertionType = edge->assertion->getAssertionType();
+        edges.push_back(raw);
+        break;
+
+      default:
+        return false;
+      }
+
+      assert(edge->node->index < nfa->nodeCount);
+      if (!visited[edge->node->index]) {
+        visited[edge->node->index] = true;
+        stack.push_back(edge->node.get());
+      }
+    }
+  }
+
+  return true;
+}
+
+void add_class_boundary(std::set<uint32_t> &starts, uint32_t first, uint32_t last, uint32_t maximum)
+{
+  if (first > maximum) {
+    return;
+  }
+
+  starts.insert(first);
+  if (last < maximum) {
+    starts.insert(last + 1);
+  }
+}
+
+/*
+ * Equivalence classes: '\0' never matches, assertions need word
+ * characters and line terminators apart, and every range and literal code
+ * unit starts (and ends) a class of its own.
+ */
+std::vector<uint16_t> collect_class_starts(const std::vector<RawEdge> &edges,
+                                           bool ignoreCase,
+                                           uint32_t maximum)
+{
+  std::set<uint32_t> starts;
+  add_class_boundary(starts, 0, 0, maximum);
+  add_class_boundary(starts, '0', '9', maximum);
+  add_class_boundary(starts, 'A', 'Z', maximum);
+  add_class_boundary(starts, '_', '_', maximum);
+  add_class_boundary(starts, 'a', 'z', maximum);
+  add_class_boundary(starts, '\n', '\n', maximum);
+  add_class_boundary(starts, '\r', '\r', maximum);
+  add_class_boundary(starts, 0x2028, 0x2029, maximum);
+
+  if (ignoreCase) {
+    for (uint32_t ch = 'A'; ch <= 'Z'; ++ch) {
+      add_class_boundary(starts, ch, ch, maximum);
+      add_class_boundary(starts, ch - 'A' + 'a', ch - 'A' + 'a', maximum);
+    }
+  }
+
+  for (auto &edge: edges) {
+    switch (edge.type) {
+    case RawEdgeType::CharacterSet:
+      for (auto &range: edge.expr->getRanges()) {
+        add_class_boundary(starts, range.first, range.second, maximum);
+      }
+      break;
+
+    case RawEdgeType::Character:
+      add_class_boundary(starts, edge.character, edge.character, maximum);
+      break;
+
+    case RawEdgeType::Range:
+      add_class_boundary(starts, edge.character, edge.last, maximum);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return std::vector<uint16_t>(starts.begin(), starts.end());
+}
+
+bool test_edge(const RawEdge &edge, uint16_t ch, bool ignoreCase)
+{
+  switch (edge.type) {
+  case RawEdgeType::CharacterSet:
+    return exec::test_character_set(edge.expr, ch, ignoreCase);
+
+  case RawEdgeType::Character:
+    return ignoreCase ? utf16::equal_ignoring_case(&ch, &edge.character, 1)
+                      : ch == edge.character;
+
+  case RawEdgeType::Range:
+    return edge.character <= ch && ch <= edge.last;
+
+  default:
+    assert(false);
+    return false;
+  }
+}
+
+/*
+ * The UTF-8 encodings of a range of characters, as byte ranges that
+ * combine freely, e.g. [E1-EC][80-BF][80-BF].
+ */
+struct ByteSequence {
+  size_t length;
+  uint8_t first[3];
+  uint8_t last[3];
+};
+
+size_t encode_utf8(uint32_t ch, uint8_t *bytes)
+{
+  if (ch < 0x80) {
+    bytes[0] = static_cast<uint8_t>(ch);
+    return 1;
+  }
+  else if (ch < 0x800) {
+    bytes[0] = static_cast<uint8_t>(0xc0 | (ch >> 6));
+    bytes[1] = static_cast<uint8_t>(0x80 | (ch & 0x3f));
+    return 2;
+  }
+  else {
+    bytes[0] = static_cast<uint8_t>(0xe0 | (ch >> 12));
+    bytes[1] = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3f));
+    bytes[2] = static_cast<uint8_t>(0x80 | (ch & 0x3f));
+    return 3;
+  }
+}
+
+void add_byte_sequences(uint32_t first, uint32_t last, std::vector<ByteSequence> &sequences)
+{
+  assert(first <= last && last <= 0xffff);
+
+  // Both ends need encodings of the same length...
+  static const uint32_t lengthLimits[] = {0x7f, 0x7ff};
+  for (auto limit: lengthLimits) {
+    if (first <= limit && last > limit) {
+      add_byte_sequences(first, limit, sequences);
+      add_byte_sequences(limit + 1, last, sequences);
+      return;
+    }
+  }
+
+  // ...and every continuation byte after the first one that differs has
+  // to run over all of 80-BF.
+  size_t length = last < 0x80 ? 1 : (last < 0x800 ? 2 : 3);
+  for (size_t i = 1; i < length; ++i) {
+    uint32_t mask = (1u << (6 * i)) - 1;
+    if ((first & ~mask) != (last & ~mask)) {
+      if ((first & mask) != 0) {
+        add_byte_sequences(first, first | mask, sequences);
+        add_byte_sequences((first | mask) + 1, last, sequences);
+        return;
+      }
+      if ((last & mask) != mask) {
+        add_byte_sequences(first, (last & ~mask) - 1, sequences);
+        add_byte_sequences(last & ~mask, last, sequences);
+        return;
+      }
+    }
+  }
+
+  ByteSequence sequence;
+  sequence.length = encode_utf8(first, sequence.first);
+  encode_utf8(last, sequence.last);
+  sequences.push_back(sequence);
+}
+
+/*
+ * Turns the consuming edges into chains of Range edges over bytes, one
+ * chain per sequence that encodes some of the code units an edge takes.
+ * Surrogates are left out; they do not occur in well-formed UTF-8 on their
+ * own.
+ */
+bool encode_edges(std::vector<RawEdge> &edges, size_t &nodeCount, bool multiline, bool ignoreCase)
+{
+  for (auto &edge: edges) {
+    if (multiline && edge.type == RawEdgeType::Assertion &&
+        (edge.assertionType == ast::AssertionType::BeginOfLine ||
+         edge.assertionType == ast::AssertionType::EndOfLine)) {
+      return false;
+    }
+  }
+
+  std::vector<uint16_t> starts = collect_class_starts(edges, ignoreCase, 0xffff);
+  std::vector<RawEdge> encoded;
+  std::vector<ByteSequence> sequences;
+
+  for (auto &edge: edges) {
+    if (edge.type != RawEdgeType::CharacterSet && edge.type != RawEdgeType::Character) {
+      encoded.push_back(edge);
+      continue;
+    }
+
+    sequences.clear();
+    for (size_t i = 0; i < starts.size(); ++i) {
+      if (!test_edge(edge, starts[i], ignoreCase)) {
+        continue;
+      }
+
+      uint32_t first = starts[i];
+      uint32_t last = (i + 1 < starts.size()) ? starts[i + 1] - 1u : 0xffffu;
+      if (first < 0xd800) {
+        add_byte_sequences(first, std::min<uint32_t>(last, 0xd7ff), sequences);
+      }
+      if (last > 0xdfff) {
+        add_byte_sequences(std::max<uint32_t>(first, 0xe000), last, sequences);
+      }
+    }
+
+    for (auto &sequence: sequences) {
+      RawEdge raw = edge;
+      raw.type = RawEdgeType::Range;
+      for (size_t i = 0; i < sequence.length; ++i) {
+        raw.to = (i + 1 == sequence.length) ? edge.to : static_cast<uint32_t>(nodeCount++);
+        raw.character = sequence.first[i];
+        raw.last = sequence.last[i];
+        encoded.push_back(raw);
+        raw.from = raw.to;
+      }
+    }
+  }
+
+  edges.swap(encoded);
+  return true;
+}
+
+} // end namespace
+
+constexpr uint32_t Program::NoTag;
+constexpr uint32_t Program::NoNode;
+
+ProgramPtr Program::compile(const nfa::NFAPtr &nfa,
+                            bool multiline,
+                            bool ignoreCase,
+                            Direction direction,
+                            Encoding encoding)
+{
+  assert(nfa != nullptr);
+  return _compile(std::vector<nfa::NFAPtr>(1, nfa), false, multiline, ignoreCase, direction, encoding);
+}
+
+ProgramPtr Program::compile(const std::vector<nfa::NFAPtr> &nfas,
+                            bool multiline,
+                            bool ignoreCase)
+{
+  return _compile(nfas, true, multiline, ignoreCase, Direction::Forward, Encoding::UTF16);
+}
+
+ProgramPtr Program::_compile(const std::vector<nfa::NFAPtr> &nfas,
+                             bool combined,
+                             bool multiline,
+                             bool ignoreCase,
+                             Direction direction,
+                             Encoding encoding)
+{
+  assert(!nfas.empty());
+
+  std::vector<RawEdge> edges;
+  std::vector<std::pair<uint32_t, uint32_t>> loops;
+  std::vector<uint32_t> patternAccepts;
+  uint32_t startNode;
+  uint32_t acceptNode;
+  size_t nodeCount;
+
+  if (!combined) {
+    assert(nfas.size() == 1);
+    if (!collect_edges(nfas[0], 0, edges, loops, nodeCount)) {
+      return nullptr;
+    }
+    startNode = static_cast<uint32_t>(nfas[0]->start->index);
+    acceptNode = static_cast<uint32_t>(nfas[0]->end->index);
+  }
+  else {
+    // Node 0 leads to each NFA in turn, and the last node accepts whatever
+    // any of them does.  Nothing leads back to node 0, so a DFA can tell
+    // the threads it starts apart.  Capture tags would clash between the
+    // NFAs, and are dropped.
+    RawEdge raw;
+    raw.type = RawEdgeType::Epsilon;
+    raw.expr = nullptr;
+    raw.assertionType = ast::AssertionType::BeginOfLine;
+    raw.character = 0;
+    raw.last = 0;
+    raw.tag = NoTag;
+
+    startNode = 0;
+    nodeCount = 1;
+    for (auto &nfa: nfas) {
+      uint32_t base = static_cast<uint32_t>(nodeCount);
+      size_t begin = edges.size();
+      if (!collect_edges(nfa, base, edges, loops, nodeCount)) {
+        return nullptr;
+      }
+      for (size_t i = begin; i < edges.size(); ++i) {
+        edges[i].tag = NoTag;
+      }
+
+      raw.from = startNode;
+      raw.to = base + static_cast<uint32_t>(nfa->start->index);
+      edges.push_back(raw);
+      patternAccepts.push_back(base + static_cast<uint32_t>(nfa->end->index));
+    }
+
+    acceptNode = static_cast<uint32_t>(nodeCount++);
+    for (auto &patternAccept: patternAccepts) {
+      raw.from = patternAccept;
+      raw.to = acceptNode;
+      edges.push_back(raw);
+    }
+  }
+
+  if (encoding == Encoding::UTF8 && !encode_edges(edges, nodeCount, multiline, ignoreCase)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<Program> program(new Program());
+  program->_direction = direction;
+  program->_encoding = encoding;
+  program->_multiline = multiline;
+
+  program->_classStarts = collect_class_starts(edges, ignoreCase,
+                                               encoding == Encoding::UTF16 ? 0xffff : 0xff);
+  for (auto &start: program->_classStarts) {
+    program->_classTypes.push_back(get_char_type(start));
+  }
+
+  for (size_t ch = 0; ch < sizeof(program->_classTable) / sizeof(program->_classTable[0]); ++ch) {
+    program->_classTable[ch] = static_cast<uint16_t>(program->_findClass(static_cast<uint16_t>(ch)));
+  }
+
+  // Edges that take the same classes share a class set.  Edges from equal
+  // character sets, or for the same code units, are bound to take the same
+  // classes, and find their set without testing them again.
+  std::unordered_map<std::vector<bool>, size_t> classSets;
+  std::map<std::pair<ast::CharacterRangeVector, bool>, uint32_t> setsByClass;
+  std::map<std::tuple<RawEdgeType, uint16_t, uint16_t>, uint32_t> setsByUnits;
+
+  program->_nodes.resize(nodeCount, Node {std::vector<Edge>(), false, NoNode});
+  program->_tagCount = 0;
+  for (auto &edge: edges) {
+    uint32_t from = edge.from;
+    uint32_t to = edge.to;
+    if (direction == Direction::Reverse) {
+      std::swap(from, to);
+    }
+
+    Node &node = program->_nodes[from];
+    switch (edge.type) {
+    case RawEdgeType::Epsilon:
+      node.edges.push_back(Edge {EdgeType::Epsilon, to, edge.tag});
+      if (edge.tag != NoTag) {
+        program->_tagCount = std::max<size_t>(program->_tagCount, (edge.tag | 1) + 1);
+      }
+      break;
+
+    case RawEdgeType::Assertion:
+      node.edges.push_back(Edge {EdgeType::Assertion, to, static_cast<uint32_t>(edge.assertionType)});
+      break;
+
+    case RawEdgeType::CharacterSet:
+    case RawEdgeType::Character:
+    case RawEdgeType::Range: {
+        uint32_t *interned;
+        if (edge.type == RawEdgeType::CharacterSet) {
+          auto key = std::make_pair(edge.expr->getRanges(), edge.expr->isInverse());
+          interned = &setsByClass.insert(std::make_pair(std::move(key), UINT32_MAX)).first->second;
+        }
+        else {
+          auto key = std::make_tuple(edge.type, edge.character, edge.last);
+          interned = &setsByUnits.insert(std::make_pair(key, UINT32_MAX)).first->second;
+        }
+
+        if (*interned == UINT32_MAX) {
+          std::vector<bool> classSet(program->getClassCount());
+          for (size_t i = 0; i < classSet.size(); ++i) {
+            classSet[i] = test_edge(edge, program->_classStarts[i], ignoreCase);
+          }
+
+          auto it = classSets.find(classSet);
+          if (it == classSets.end()) {
+            it = classSets.insert(std::make_pair(classSet, program->_classSets.size())).first;
+            program->_classSets.push_back(std::move(classSet));
+          }
+          *interned = static_cast<uint32_t>(it->second);
+        }
+
+        node.edges.push_back(Edge {EdgeType::Transition, to, *interned});
+        node.consuming = true;
+      }
+      break;
+    }
+  }
+
+  if (direction == Direction::Forward) {
+    for (auto &loop: loops) {
+      program->_nodes[loop.first].loopHead = loop.second;
+    }
+  }
+
+  program->_start = startNode;
+  program->_accept = acceptNode;
+  if (direction == Direction::Reverse) {
+    std::swap(program->_start, program->_accept);
+  }
+
+  if (patternAccepts.empty()) {
+    patternAccepts.push_back(program->_accept);
+  }
+  program->_patternAccepts.swap(patternAccepts);
+
+  return program;
+}
+
+bool Program::testAssertion(ast::AssertionType type, CharType before, CharType after) const
+{
+  switch (type) {
+  case ast::AssertionType::BeginOfLine:
+    return (before == CharType::Edge) ||
+           (_multiline && before == CharType::LineTerminator);
+
+  case ast::AssertionType::EndOfLine:
+    return (after == CharType::Edge) ||
+           (_multiline && after == CharType::LineTerminator);
+
+  case ast::AssertionType::WordBoundary:
+    return (before == CharType::Word) != (after == CharType::Word);
+
+  case ast::AssertionType::NonWordBoundary:
+    return (before == CharType::Word) == (after == CharType::Word);
+
+  default:
+    assert(false);
+    return false;
+  }
+}
+
+size_t Program::_findClass(uint16_t ch) const
+{
+  auto it = std::upper_bound(_classStarts.begin(), _classStarts.end(), ch);
+  assert(it != _classStarts.begin());
+  return static_cast<size_t>(it - _classStarts.begin()) - 1;
+}
+
+constexpr size_t DFA::DefaultLaneCount;
+constexpr size_t DFA::MaxLaneCount;
+constexpr uint32_t DFA::_Unknown;
+constexpr uint32_t DFA::_MatchFlag;
+constexpr uint32_t DFA::_DeadState;
+
+DFA::DFA(const ProgramPtr &program,
+         bool anchored,
+         size_t stateLimit)
+  : _program(program),
+    _anchored(anchored),
+    _stateLimit(std::max<size_t>(stateLimit, 2)),
+    _stride(program->getClassCount()),
+    _failed(false),
+    _charsSinceReset(0),
+    _resetCount(0),
+    _horizon(0),
+    _marks(program->getNodes().size(), 0),
+    _generation(0)
+{
+  assert(_program != nullptr);
+  _reset();
+}
+
+void DFA::_reset()
+{
+  _states.clear();
+  _stateMap.clear();
+  _table.clear();
+  _matches.clear();
+  _acceptedPatterns.clear();
+  std::fill(_startStates, _startStates + CharTypeCount, _Unknown);
+  _charsSinceReset = 0;
+  ++_resetCount;
+
+  // The dead state has no nodes left and never matches.
+  _states.push_back(State {Kernel(), CharType::Edge});
+  _table.resize(_stride, _DeadState);
+  _matches.resize(CharTypeCount, 1);
+}
+
+uint32_t DFA::_intern(Kernel &kernel, CharType type)
+{
+  if (kernel.empty()) {
+    return _DeadState;
+  }
+
+  std::sort(kernel.begin(), kernel.end());
+  kernel.erase(std::unique(kernel.begin(), kernel.end()), kernel.end());
+
+  auto key = std::make_pair(type, kernel);
+  auto it = _stateMap.find(key);
+  if (it != _stateMap.end()) {
+    return it->second;
+  }
+
+  if (_states.size() >= _stateLimit) {
+    return _Unknown;
+  }
+
+  uint32_t state = static_cast<uint32_t>(_states.size());
+  _states.push_back(State {kernel, type});
+  _stateMap.insert(std::make_pair(std::move(key), state));
+  _table.resize(_table.size() + _stride, _Unknown);
+  _matches.resize(_matches.size() + CharTypeCount, 0);
+  return state;
+}
+
+uint32_t DFA::_startState(CharType type)
+{
+  uint32_t &start = _startStates[static_cast<size_t>(type)];
+  if (start == _Unknown) {
+    Kernel kernel(1, _program->getStart());
+    start = _intern(kernel, type);
+    if (start == _Unknown) {
+      _reset();
+      kernel.assign(1, _program->getStart());
+      start = _intern(kernel, type);
+    }
+  }
+  return start;
+}
+
+bool DFA::_closure(const State &state, CharType before, CharType after)
+{
+  const std::vector<Program::Node> &nodes = _program->getNodes();
+  bool accepted = false;
+
+  if (++_generation == 0) {
+    std::fill(_marks.begin(), _marks.end(), 0);
+    _generation = 1;
+  }
+
+  _closureNodes.clear();
+  _stack.assign(state.kernel.rbegin(), state.kernel.rend());
+
+  while (!_stack.empty()) {
+    uint32_t index = _stack.back();
+    _stack.pop_back();
+
+    if (_marks[index] == _generation) {
+      continue;
+    }
+    _marks[index] = _generation;
+
+    if (index == _program->getAccept()) {
+      accepted = true;
+    }
+
+    const Program::Node &node = nodes[index];
+    if (node.consuming) {
+      _closureNodes.push_back(index);
+    }
+
+    for (auto it = node.edges.rbegin(); it != node.edges.rend(); ++it) {
+      switch (it->type) {
+      case Program::EdgeType::Epsilon:
+        _stack.push_back(it->node);
+        break;
+
+      case Program::EdgeType::Assertion:
+        if (_program->testAssertion(static_cast<ast::AssertionType>(it->value), before, after)) {
+          _stack.push_back(it->node);
+        }
+        break;
+
+      case Program::EdgeType::Transition:
+        break;
+      }
+    }
+  }
+
+  return accepted;
+}
+
+uint32_t DFA::_step(uint32_t &state, size_t cls)
+{
+  CharType type = _program->getClassType(cls);
+  bool accepted;
+  if (_program->getDirection() == Direction::Forward) {
+    accepted = _closure(_states[state], _states[state].type, type);
+  }
+  else {
+    accepted = _closure(_states[state], type, _states[state].type);
+  }
+
+  const std::vector<Program::Node> &nodes = _program->getNodes();
+  Kernel kernel;
+  for (auto &index: _closureNodes) {
+    for (auto &edge: nodes[index].edges) {
+      if (edge.type == Program::EdgeType::Transition && _program->testClass(edge.value, cls)) {
+        kernel.push_back(edge.node);
+      }
+    }
+  }
+  if (!_anchored) {
+    kernel.push_back(_program->getStart());
+  }
+
+  uint32_t next = _intern(kernel, type);
+  if (next == _Unknown) {
+    // The cache is full.  Start over with just the current state, unless
+    // the previous cache was hardly used, in which case the DFA is not
+    // paying for itself on this input.
+    if (_charsSinceReset < _MinCharsPerState * _states.size()) {
+      _failed = true;
+      return _Unknown;
+    }
+
+    State current = _states[state];
+    _reset();
+    state = _intern(current.kernel, current.type);
+    next = _intern(kernel, type);
+    assert(state != _Unknown && next != _Unknown);
+  }
+
+  if (accepted) {
+    next |= _MatchFlag;
+  }
+  _table[state * _stride + cls] = next;
+  return next;
+}
+
+size_t DFA::explore(size_t limit)
+{
+  assert(limit + 1 < _stateLimit);
+
+  _reset();
+  _failed = false;
+  for (size_t type = 0; type < CharTypeCount; ++type) {
+    _startState(static_cast<CharType>(type));
+  }
+
+  // Each step adds at most one state, so the loop stops one state past the
+  // limit at most and _intern never runs out of room.
+  for (uint32_t state = 1; state < _states.size() && _states.size() <= limit + 1; ++state) {
+    for (size_t cls = 0; cls < _stride && _states.size() <= limit + 1; ++cls) {
+      if (_table[state * _stride + cls] == _Unknown) {
+        uint32_t current = state;
+        _step(current, cls);
+      }
+    }
+  }
+
+  return _states.size() - 1;
+}
+
+bool DFA::_isMatch(uint32_t state, CharType boundary)
+{
+  int8_t &match = _matches[state * CharTypeCount + static_cast<size_t>(boundary)];
+  if (match == 0) {
+    bool accepted;
+    if (_program->getDirection() == Direction::Forward) {
+      accepted = _closure(_states[state], _states[state].type, boundary);
+    }
+    else {
+      accepted = _closure(_states[state], boundary, _states[state].type);
+    }
+    match = accepted ? 2 : 1;
+  }
+  return match == 2;
+}
+
+/*
+ * Sets the patterns that accept in state before a code unit of type
+ * boundary, and returns how many of them were not set yet.  The patterns
+ * are worked out on the first call and kept with the state.
+ */
+size_t DFA::_addPatterns(uint32_t state, CharType boundary, std::vector<bool> &matched)
+{
+  size_t index = state * CharTypeCount + static_cast<size_t>(boundary);
+  if (_acceptedPatterns.size() <= index) {
+    _acceptedPatterns.resize(_states.size() * CharTypeCount);
+  }
+
+  std::vector<uint32_t> &patterns = _acceptedPatterns[index];
+  if (patterns.empty()) {
+    _closure(_states[state], _states[state].type, boundary);
+    const std::vector<uint32_t> &accepts = _program->getPatternAccepts();
+    for (size_t i = 0; i < accepts.size(); ++i) {
+      if (_marks[accepts[i]] == _generation) {
+        patterns.push_back(static_cast<uint32_t>(i));
+      }
+    }
+    assert(!patterns.empty());
+  }
+
+  size_t added = 0;
+  for (auto &pattern: patterns) {
+    if (!matched[pattern]) {
+      matched[pattern] = true;
+      ++added;
+    }
+  }
+  return added;
+}
+
+namespace {
+
+inline bool is_boundary(Encoding, const uint16_t *, size_t, size_t)
+{
+  return true;
+}
+
+// Scanning from a position inside a character can only ever match empty
+// there, as no sequence starts with a continuation byte.
+inline bool is_boundary(Encoding encoding, const uint8_t *text, size_t length, size_t position)
+{
+  return encoding == Encoding::Latin1 || position == length || (text[position] & 0xc0) != 0x80;
+}
+
+} // end namespace
+
+template <typename CharT>
+DFA::Result DFA::_search(const CharT *text,
+                         size_t length,
+                         size_t from,
+                         size_t to,
+                         bool longest,
+                         size_t &position,
+                         exec::Meter &meter)
+{
+  assert(text != nullptr);
+  assert(from <= to && to <= length);
+
+  _failed = false;
+  bool matched = false;
+
+  if (_program->getDirection() == Direction::Forward) {
+    uint32_t state = _startState(from > 0 ? get_char_type(text[from - 1]) : CharType::Edge);
+
+    for (size_t current = from; current < to; ++current) {
+      if (__builtin_expect(!meter.step(), false)) {
+        _horizon = current;
+        return Result::NoMatch;
+      }
+
+      size_t cls = _program->getClass(text[current]);
+      uint32_t next = _table[state * _stride + cls];
+      if (__builtin_expect(next == _Unknown, false)) {
+        next = _step(state, cls);
+        if (_failed) {
+          _horizon = current;
+          return Result::GaveUp;
+        }
+      }
+      ++_charsSinceReset;
+
+      if ((next & _MatchFlag) && is_boundary(_program->getEncoding(), text, length, current)) {
+        position = current;
+        matched = true;
+        if (!longest) {
+          _horizon = current;
+          return Result::Match;
+        }
+      }
+
+      state = next & ~_MatchFlag;
+      if (state == _DeadState) {
+        _horizon = current;
+        return matched ? Result::Match : Result::NoMatch;
+      }
+    }
+
+    _horizon = to;
+    if (_isMatch(state, to < length ? get_char_type(text[to]) : CharType::Edge)) {
+      position = to;
+      matched = true;
+    }
+  }
+  else {
+    _horizon = to;
+    uint32_t state = _startState(to < length ? get_char_type(text[to]) : CharType::Edge);
+
+    for (size_t current = to; current > from; --current) {
+      if (__builtin_expect(!meter.step(), false)) {
+        return Result::NoMatch;
+      }
+
+      size_t cls = _program->getClass(text[current - 1]);
+      uint32_t next = _table[state * _stride + cls];
+      if (__builtin_expect(next == _Unknown, false)) {
+        next = _step(state, cls);
+        if (_failed) {
+          return Result::GaveUp;
+        }
+      }
+      ++_charsSinceReset;
+
+      if ((next & _MatchFlag) && is_boundary(_program->getEncoding(), text, length, current)) {
+        position = current;
+        matched = true;
+        if (!longest) {
+          return Result::Match;
+        }
+      }
+
+      state = next & ~_MatchFlag;
+      if (state == _DeadState) {
+        return matched ? Result::Match : Result::NoMatch;
+      }
+    }
+
+    if (_isMatch(state, from > 0 ? get_char_type(text[from - 1]) : CharType::Edge)) {
+      position = from;
+      matched = true;
+    }
+  }
+
+  return matched ? Result::Match : Result::NoMatch;
+}
+
+DFA::Result DFA::search(const uint16_t *text,
+                        size_t length,
+                        size_t from,
+                        size_t to,
+                        bool longest,
+                        size_t &position,
+                        exec::Meter &meter)
+{
+  assert(_program->getEncoding() == Encoding::UTF16);
+  return _search(text, length, from, to, longest, position, meter);
+}
+
+DFA::Result DFA::searchPatterns(const uint16_t *text,
+                                size_t length,
+                                std::vector<bool> &matched,
+                                exec::Meter &meter)
+{
+  assert(text != nullptr);
+  assert(_program->getEncoding() == Encoding::UTF16);
+  assert(_program->getDirection() == Direction::Forward);
+  assert(!_anchored);
+
+  size_t patternCount = _program->getPatternAccepts().size();
+  size_t remaining = patternCount;
+  matched.assign(patternCount, false);
+  _failed = false;
+
+  uint32_t state = _startState(CharType::Edge);
+  for (size_t current = 0; current < length; ++current) {
+    if (__builtin_expect(!meter.step(), false)) {
+      _horizon = current;
+      return Result::NoMatch;
+    }
+
+    size_t cls = _program->getClass(text[current]);
+    uint32_t next = _table[state * _stride + cls];
+    if (__builtin_expect(next == _Unknown, false)) {
+      next = _step(state, cls);
+      if (_failed) {
+        _horizon = current;
+        return Result::GaveUp;
+      }
+    }
+    ++_charsSinceReset;
+
+    if (next & _MatchFlag) {
+      remaining -= _addPatterns(state, _program->getClassType(cls), matched);
+      if (remaining == 0) {
+        _horizon = current;
+        return Result::Match;
+      }
+    }
+
+    state = next & ~_MatchFlag;
+  }
+
+  // As in RegExp, no match is looked for at the end of the text, so only
+  // the threads started before it can accept there.
+  _horizon = length;
+  if (length > 0) {
+    State last = _states[state];
+    last.kernel.erase(std::remove(last.kernel.begin(), last.kernel.end(), _program->getStart()),
+                      last.kernel.end());
+    _closure(last, last.type, CharType::Edge);
+
+    const std::vector<uint32_t> &accepts = _program->getPatternAccepts();
+    for (size_t i = 0; i < accepts.size(); ++i) {
+      if (!matched[i] && _marks[accepts[i]] == _generation) {
+        matched[i] = true;
+        --remaining;
+      }
+    }
+  }
+  return (remaining < patternCount) ? Result::Match : Result::NoMatch;
+}
+
+void DFA::searchInterleaved(const uint16_t *const *texts,
+                            const size_t *lengths,
+                            size_t count,
+                            size_t laneCount,
+                            Result *results,
+                            size_t *positions,
+                            exec::Meter &meter)
+{
+  assert(texts != nullptr || count == 0);
+  assert(_program->getEncoding() == Encoding::UTF16);
+  assert(_program->getDirection() == Direction::Forward);
+
+  // A lane scans one text, and keeps the class of the code unit it reads
+  // next, whose table entry was prefetched.
+  struct Lane {
+    size_t index;
+    const uint16_t *text;
+    const uint16_t *current;
+    const uint16_t *end;
+    uint32_t state;
+    size_t cls;
+  };
+
+  Lane lanes[MaxLaneCount];
+  State saved[MaxLaneCount];
+  size_t active = 0;
+  size_t next = 0;
+  laneCount = std::min(std::max<size_t>(laneCount, 1), MaxLaneCount);
+
+  // A new state resets the cache once it is full, and the states of the
+  // lanes other than the one that needs it are lost with it.  save() keeps
+  // them if that can happen, and restore() finds them again if it did;
+  // lanes whose states no longer fit give up.
+  auto save = [&](size_t except) {
+    if (_states.size() >= _stateLimit) {
+      for (size_t k = 0; k < active; ++k) {
+        if (k != except && lanes[k].state != _Unknown) {
+          saved[k] = _states[lanes[k].state];
+        }
+      }
+    }
+    return _resetCount;
+  };
+
+  auto restore = [&](size_t except, size_t resetCount) {
+    if (_resetCount != resetCount) {
+      for (size_t k = 0; k < active; ++k) {
+        if (k != except && lanes[k].state != _Unknown) {
+          lanes[k].state = _intern(saved[k].kernel, saved[k].type);
+        }
+      }
+    }
+  };
+
+  // Sets the outcome of lane k and moves the last lane in its place.
+  auto finish = [&](size_t k, Result result, size_t position) {
+    results[lanes[k].index] = result;
+    positions[lanes[k].index] = position;
+    lanes[k] = lanes[--active];
+  };
+
+  // At the end of its text, a lane matches if its state accepts there.
+  auto finishAtEnd = [&](size_t k) {
+    if (_isMatch(lanes[k].state, CharType::Edge)) {
+      finish(k, Result::Match, static_cast<size_t>(lanes[k].end - lanes[k].text));
+    }
+    else {
+      finish(k, Result::NoMatch, 0);
+    }
+  };
+
+  while (active > 0 || next < count) {
+    while (active < laneCount && next < count) {
+      Lane &lane = lanes[active];
+      lane.index = next;
+      lane.text = texts[next];
+      lane.current = lane.text;
+      lane.end = lane.text + lengths[next];
+      ++next;
+
+      size_t resetCount = save(active);
+      lane.state = _startState(CharType::Edge);
+      restore(active, resetCount);
+
+      if (lane.current == lane.end) {
+        results[lane.index] = _isMatch(lane.state, CharType::Edge) ? Result::Match
+                                                                   : Result::NoMatch;
+        positions[lane.index] = 0;
+        continue;
+      }
+
+      lane.cls = _program->getClass(*lane.current);
+      ++active;
+    }
+
+    for (size_t k = 0; k < active; ) {
+      Lane &lane = lanes[k];
+      if (__builtin_expect(lane.state == _Unknown || !meter.step(), false)) {
+        finish(k, lane.state == _Unknown ? Result::GaveUp : Result::NoMatch, 0);
+        continue;
+      }
+
+      uint32_t state = _table[lane.state * _stride + lane.cls];
+      if (__builtin_expect(state == _Unknown, false)) {
+        size_t resetCount = save(k);
+        state = _step(lane.state, lane.cls);
+        restore(k, resetCount);
+        if (_failed) {
+          _failed = false;
+          finish(k, Result::GaveUp, 0);
+          continue;
+        }
+      }
+      ++_charsSinceReset;
+
+      if (state & _MatchFlag) {
+        finish(k, Result::Match, static_cast<size_t>(lane.current - lane.text));
+        continue;
+      }
+
+      lane.state = state;
+      if (lane.state == _DeadState) {
+        finish(k, Result::NoMatch, 0);
+        continue;
+      }
+
+      if (++lane.current == lane.end) {
+        finishAtEnd(k);
+        continue;
+      }
+
+      lane.cls = _program->getClass(*lane.current);
+      __builtin_prefetch(&_table[lane.state * _stride + lane.cls]);
+      ++k;
+    }
+  }
+}
+
+DFA::Result DFA::search(const uint8_t *text,
+                        size_t length,
+                        size_t from,
+                        size_t to,
+                        bool longest,
+                        size_t &position,
+                        exec::Meter &meter)
+{
+  assert(_program->getEncoding() != Encoding::UTF16);
+  return _search(text, length, from, to, longest, position, meter);
+}
+
+} // end namespace dfa
+} // end namespace jscre
@@ -0,0 +1,364 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_dfa_h__
+#define __jscre_dfa_h__
+
+#include "nfa.h"
+#include "exec.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <map>
+
+namespace jscre {
+namespace dfa {
+
+enum class Direction {
+  Forward,
+  Reverse
+};
+
+/*
+ * The code units a program reads.  A UTF-8 program reads bytes: every
+ * character set and literal code unit is turned into the byte sequences
+ * that encode its members, so its DFAs run on UTF-8 text as it is.  Only
+ * characters of the Basic Multilingual Plane are encoded, each of them
+ * being one UTF-16 code unit; text with other characters, or with bytes
+ * that do not encode a character, has to be transcoded instead.
+ *
+ * Bytes cannot tell U+2028 and U+2029 apart from other characters at a
+ * position, so there is no UTF-8 program for multiline patterns that
+ * contain ^ or $.
+ *
+ * A Latin-1 program reads bytes as the characters U+0000 to U+00FF, which
+ * is also how it reads ASCII text in UTF-8.  Its classes only cover those
+ * 256 characters.
+ */
+enum class Encoding {
+  UTF16,
+  UTF8,
+  Latin1
+};
+
+/*
+ * The kind of code unit on one side of a position, which is all that the
+ * zero-width assertions (^, $, \b and \B) look at.
+ */
+enum class CharType : uint8_t {
+  Edge,
+  Word,
+  LineTerminator,
+  Other
+};
+
+constexpr size_t CharTypeCount = 4;
+
+class Program;
+typedef std::shared_ptr<const Program> ProgramPtr;
+
+/*
+ * An immutable, flattened copy of an NFA that a DFA can be built from.
+ *
+ * Code units are grouped into equivalence classes that no character set,
+ * literal or assertion can tell apart.  Literal (String) edges are split
+ * into one transition per code unit.  A reverse program has every edge
+ * turned around, so it matches the reversed language from the NFA's end.
+ *
+ * Look-ahead assertions, backreferences and counters cannot be expressed
+ * this way; compile() returns nullptr for such NFAs.  Non-greedy
+ * quantifiers only differ from greedy ones in the order of their edges.
+ *
+ * A program can also be compiled from several NFAs at once, for a set of
+ * patterns: it matches wherever one of them does, and tells them apart by
+ * the node each one accepts at.
+ */
+class Program {
+public:
+  static ProgramPtr compile(const nfa::NFAPtr &nfa,
+                            bool multiline,
+                            bool ignoreCase,
+                            Direction direction,
+                            Encoding encoding = Encoding::UTF16);
+
+  // A forward UTF-16 program for the patterns of nfas, without captures.
+  static ProgramPtr compile(const std::vector<nfa::NFAPtr> &nfas,
+                            bool multiline,
+                            bool ignoreCase);
+
+  enum class EdgeType : uint8_t {
+    Epsilon,
+    Assertion,
+    Transition
+  };
+
+  /*
+   * Edges keep the order they have in the NFA, which is the priority order
+   * among paths.  value holds the capture tag of an epsilon edge (NoTag if
+   * it has none), the type of an assertion, or the class set of a
+   * transition.
+   */
+  struct Edge {
+    EdgeType type;
+    uint32_t node;
+    uint32_t value;
+  };
+
+  /*
+   * loopHead is the node an iteration of a loop starts from, set on the
+   * last node of the loop body if the body can match empty (see
+   * nfa::Node), and NoNode elsewhere.  It is only set in forward programs.
+   */
+  struct Node {
+    std::vector<Edge> edges;
+    bool consuming;
+    uint32_t loopHead;
+  };
+
+  static constexpr uint32_t NoTag = UINT32_MAX;
+  static constexpr uint32_t NoNode = UINT32_MAX;
+
+  Direction getDirection() const { return _direction; }
+  Encoding getEncoding() const { return _encoding; }
+  bool isMultiline() const { return _multiline; }
+
+  const std::vector<Node> &getNodes() const { return _nodes; }
+  uint32_t getStart() const { return _start; }
+  uint32_t getAccept() const { return _accept; }
+
+  // By pattern, the node it accepts at.  A program compiled from a single
+  // NFA has one pattern, which accepts at getAccept().
+  const std::vector<uint32_t> &getPatternAccepts() const { return _patternAccepts; }
+
+  // Capture group i is delimited by tags 2 * i and 2 * i + 1.
+  size_t getTagCount() const { return _tagCount; }
+
+  bool testAssertion(ast::AssertionType type, CharType before, CharType after) const;
+
+  size_t getClassCount() const { return _classStarts.size(); }
+  bool testClass(size_t classSet, size_t cls) const { return _classSets[classSet][cls]; }
+  CharType getClassType(size_t cls) const { return _classTypes[cls]; }
+
+  size_t getClass(uint16_t ch) const
+  {
+    if (ch < sizeof(_classTable) / sizeof(_classTable[0])) {
+      return _classTable[ch];
+    }
+    return _findClass(ch);
+  }
+
+private:
+  Program() {}
+
+  static ProgramPtr _compile(const std::vector<nfa::NFAPtr> &nfas,
+                             bool combined,
+                             bool multiline,
+                             bool ignoreCase,
+                             Direction direction,
+                             Encoding encoding);
+
+  size_t _findClass(uint16_t ch) const;
+
+  Direction _direction;
+  Encoding _encoding;
+  bool _multiline;
+
+  std::vector<Node> _nodes;
+  uint32_t _start;
+  uint32_t _accept;
+  std::vector<uint32_t> _patternAccepts;
+  size_t _tagCount;
+
+  std::vector<uint16_t> _classStarts;
+  std::vector<CharType> _classTypes;
+  std::vector<std::vector<bool>> _classSets;
+  uint16_t _classTable[256];
+};
+
+/*
+ * A lazily built DFA over a Program.  States are created on demand while
+ * scanning and kept in a flat transition table; when the table grows past
+ * the state limit it is thrown away and rebuilt from the current state.
+ *
+ * A DFA object is a cache and is not safe to share between threads; any
+ * number of DFAs can share one Program.
+ */
+class DFA {
+public:
+  explicit DFA(const ProgramPtr &program,
+               bool anchored = true,
+               size_t stateLimit = DefaultStateLimit);
+
+  DFA(const DFA &) = delete;
+  DFA &operator=(const DFA &) = delete;
+
+  const ProgramPtr &getProgram() const { return _program; }
+
+  enum class Result {
+    Match,
+    NoMatch,
+    GaveUp
+  };
+
+  /*
+   * Scans text[from, to) in the direction of the program; code units
+   * outside that window only serve as context for assertions.
+   *
+   * A forward scan reports the end of a match, a reverse scan the start of
+   * one.  With longest set, the scan runs until no match can be extended
+   * and reports the farthest position; otherwise it stops at the nearest.
+   * Each code unit scanned is a step on meter, and the scan reports NoMatch
+   * once the meter runs out.
+   */
+  Result search(const uint16_t *text,
+                size_t length,
+                size_t from,
+                size_t to,
+                bool longest,
+                size_t &position,
+                exec::Meter &meter);
+
+  // The same on bytes, for UTF-8 and Latin-1 programs.  In UTF-8 text,
+  // from and to have to be character boundaries, and so is every position
+  // reported.
+  Result search(const uint8_t *text,
+                size_t length,
+                size_t from,
+                size_t to,
+                bool longest,
+                size_t &position,
+                exec::Meter &meter);
+
+  /*
+   * For an unanchored DFA over a program compiled from several NFAs: scans
+   * all of text and sets matched[i] for each pattern i with a match
+   * starting in it, stopping early once every pattern has one.  Reports Match if any
+   * pattern matches.  If the scan gives up, or the meter runs out, matched
+   * keeps the patterns found so far.
+   */
+  Result searchPatterns(const uint16_t *text,
+                        size_t length,
+                        std::vector<bool> &matched,
+                        exec::Meter &meter);
+
+  /*
+   * For a forward UTF-16 program: the nearest match in each of count
+   * texts, as search(texts[i], lengths[i], 0, lengths[i], false, ...)
+   * would find it, into results[i] and positions[i].  Up to laneCount
+   * texts are scanned in lockstep, a code unit of each in turn, so that
+   * their table lookups overlap instead of each waiting on the last, and
+   * the entry each text reads next is prefetched.  A text whose state is
+   * lost when the cache is reset for another gives up.
+   */
+  void searchInterleaved(const uint16_t *const *texts,
+                         const size_t *lengths,
+                         size_t count,
+                         size_t laneCount,
+                         Result *results,
+                         size_t *positions,
+                         exec::Meter &meter);
+
+  /*
+   * The farthest position the last scan looked at, with length standing
+   * for the end of the text: nothing after it could have changed what the
+   * scan found.
+   */
+  size_t getHorizon() const { return _horizon; }
+
+  size_t getStateCount() const { return _states.size(); }
+
+  /*
+   * Builds states ahead of any input, starting over from the start states,
+   * until every reachable state exists or more than limit do.  Returns the
+   * number built besides the dead state.  limit has to leave room below
+   * the state limit, which is never reached by this.
+   */
+  size_t explore(size_t limit);
+
+  static constexpr size_t DefaultStateLimit = 4096;
+  static constexpr size_t DefaultLaneCount = 8;
+  static constexpr size_t MaxLaneCount = 16;
+
+private:
+  typedef std::vector<uint32_t> Kernel;
+
+  struct State {
+    Kernel kernel;
+    CharType type;
+  };
+
+  static constexpr uint32_t _Unknown = UINT32_MAX;
+  static constexpr uint32_t _MatchFlag = 1u << 31;
+  static constexpr uint32_t _DeadState = 0;
+  static constexpr size_t _MinCharsPerState = 10;
+
+  template <typename CharT>
+  Result _search(const CharT *text,
+                 size_t length,
+                 size_t from,
+                 size_t to,
+                 bool longest,
+                 size_t &position,
+                 exec::Meter &meter);
+
+  void _reset();
+  uint32_t _intern(Kernel &kernel, CharType type);
+  uint32_t _startState(CharType type);
+  bool _closure(const State &state, CharType before, CharType after);
+  uint32_t _step(uint32_t &state, size_t cls);
+  bool _isMatch(uint32_t state, CharType boundary);
+  size_t _addPatterns(uint32_t state, CharType boundary, std::vector<bool> &matched);
+
+  ProgramPtr _program;
+  bool _anchored;
+  size_t _stateLimit;
+  size_t _stride;
+
+  std::vector<State> _states;
+  std::map<std::pair<CharType, Kernel>, uint32_t> _stateMap;
+  std::vector<uint32_t> _table;
+  std::vector<int8_t> _matches;
+  std::vector<std::vector<uint32_t>> _acceptedPatterns;
+  uint32_t _startStates[CharTypeCount];
+
+  bool _failed;
+  size_t _charsSinceReset;
+  size_t _resetCount;
+  size_t _horizon;
+
+  std::vector<uint32_t> _stack;
+  std::vector<uint32_t> _marks;
+  uint32_t _generation;
+  Kernel _closureNodes;
+};
+
+typedef std::shared_ptr<DFA> DFAPtr;
+
+CharType get_char_type(uint16_t ch);
+
+} // end namespace dfa
+} // end namespace jscre
+
+#endif /* __jscre_dfa_h__ */
@@ -24,13 +24,93 @@
 
 #include "exec.h"
 #include "utf16_case.h"
+#include "utf16_string.h"
 #include <assert.h>
+#include <algorithm>
 
 namespace jscre {
 namespace exec {
 
+constexpr size_t Package::DefaultBacktrackLimit;
+constexpr size_t Package::VisitedBitsPerCodeUnit;
+constexpr size_t Range::NotFound;
+constexpr size_t Budget::CheckInterval;
+
+Meter::Meter(const Budget &budget)
+  : _budget(budget),
+    _steps(0),
+    _nextCheck(SIZE_MAX),
+    _states(0),
+    _memory(0),
+    _aborted(false)
+{
+  _schedule();
+}
+
+void Meter::_schedule()
+{
+  // Reading the clock is what costs, so nothing is polled without a
+  // deadline or a flag to look at.
+  _nextCheck = SIZE_MAX;
+  if (_budget.cancelled != nullptr ||
+      _budget.deadline != std::chrono::steady_clock::time_point::max()) {
+    _nextCheck = _steps + Budget::CheckInterval;
+  }
+  if (_budget.stepLimit != 0 && _budget.stepLimit < _nextCheck) {
+    _nextCheck = _budget.stepLimit + 1;
+  }
+}
+
+bool Meter::_check()
+{
+  if (_aborted) {
+    return false;
+  }
+
+  if ((_budget.stepLimit != 0 && _steps > _budget.stepLimit) ||
+      (_budget.cancelled != nullptr && _budget.cancelled->load(std::memory_order_relaxed)) ||
+      (_budget.deadline != std::chrono::steady_clock::time_point::max() &&
+       std::chrono::steady_clock::now() >= _budget.deadline)) {
+    return _abort();
+  }
+
+  _schedule();
+  return true;
+}
+
+bool Meter::_abort()
+{
+  _aborted = true;
+  _nextCheck = 0;
+  return false;
+}
+
+bool Meter::addStates(size_t count)
+{
+  _states += count;
+  if (_budget.stateLimit != 0 && _states > _budget.stateLimit) {
+    return _abort();
+  }
+  return !_aborted;
+}
+
+bool Meter::allocate(size_t bytes)
+{
+  _memory += bytes;
+  if (_budget.memoryLimit != 0 && _memory > _budget.memoryLimit) {
+    return _abort();
+  }
+  return !_aborted;
+}
+
+void Meter::release(size_t bytes)
+{
+  _memory -= std::min(bytes, _memory);
+}
+
 Input::Input(const uint16_t *txt, size_t len, bool ignoreCase)
-  : length(len)
+  : length(len),
+    _capacity(len)
 {
   assert(txt != nullptr);
   text = static_cast<uint16_t *>(malloc(sizeof(uint16_t) * (length + 1)));
@@ -42,6 +122,24 @@ Input::Input(const uint16_t *txt, size_t len, bool ignoreCase)
   }
 }
 
+void Input::assign(const uint16_t *txt, size_t len, bool ignoreCase)
+{
+  assert(txt != nullptr && text != nullptr);
+  if (len > _capacity) {
+    free(const_cast<uint16_t *>(text));
+    text = static_cast<uint16_t *>(malloc(sizeof(uint16_t) * (len + 1)));
+    _capacity = len;
+  }
+
+  length = len;
+  memcpy(const_cast<uint16_t *>(text), txt, sizeof(uint16_t) * length);
+  const_cast<uint16_t *>(text)[length] = '\0';
+
+  if (ignoreCase) {
+    utf16::to_lower(const_cast<uint16_t *>(text), length);
+  }
+}
+
 Input::~Input()
 {
   assert(text != nullptr);
@@ -50,30 +148,20 @@ Input::~Input()
 
 namespace {
 
-struct State {
-  nfa::NodePtr node;
-  size_t currentEdge;
-  size_t currentText;
-
-  State(const nfa::NodePtr &n, size_t curText)
-    : node(n),
-      currentEdge(0),
-      currentText(curText) {}
-};
-
-typedef std::vector<State> StateVector;
-
-struct Candidate {
-  StateVector states;
-  size_t length;
-
-  Candidate(const StateVector &sts,
-            size_t len)
-    : states(sts),
-      length(len) {}
-};
+uint16_t swap_case(uint16_t ch)
+{
+  if (ch >= 'A' && ch <= 'Z') {
+    return ch - 'A' + 'a';
+  }
+  else if (ch >= 'a' && ch <= 'z') {
+    return ch - 'a' + 'A';
+  }
+  else {
+    return ch;
+  }
+}
 
-typedef std::vector<Candidate> CandidateVector;
+} // end namespace
 
 bool test_character_set(const ast::CharacterClassExpr *expr, uint16_t ch, bool ignoreCase)
 {
@@ -88,11 +176,9 @@ bool test_character_set(const ast::CharacterClassExpr *expr, uint16_t ch, bool i
       }
 
       if (ignoreCase) {
-        if (ch >= 'A' && ch <= 'Z') {
-          uint16_t ch2 = ch - 'A' + 'a';
-          if (range.first <= ch2 && range.second >= ch2) {
-            return false;
-          }
+        uint16_t ch2 = swap_case(ch);
+        if (ch2 != ch && range.first <= ch2 && range.second >= ch2) {
+          return false;
         }
       }
     }
@@ -106,11 +192,9 @@ bool test_character_set(const ast::CharacterClassExpr *expr, uint16_t ch, bool i
       }
 
       if (ignoreCase) {
-        if (ch >= 'A' && ch <= 'Z') {
-          uint16_t ch2 = ch - 'A' + 'a';
-          if (range.first <= ch2 && range.second >= ch2) {
-            return true;
-          }
+        uint16_t ch2 = swap_case(ch);
+        if (ch2 != ch && range.first <= ch2 && range.second >= ch2) {
+          return true;
         }
       }
     }
@@ -121,24 +205,100 @@ bool test_character_set(const ast::CharacterClassExpr *expr, uint16_t ch, bool i
 
 bool is_word_char(uint16_t ch)
 {
-  if (ch >= 0x1f) {
-    return true;
-  }
-  else if ((ch >= 'A' && ch <= 'Z') ||
-           (ch >= 'a' && ch <= 'z') ||
-           (ch >= '0' && ch <= '9')) {
+  return (ch >= 'A' && ch <= 'Z') ||
+         (ch >= 'a' && ch <= 'z') ||
+         (ch >= '0' && ch <= '9') ||
+         ch == '_';
+}
+
+bool is_line_terminator(uint16_t ch)
+{
+  switch (ch) {
+  case '\r':
+  case '\n':
+  case 0x2028:
+  case 0x2029:
     return true;
+
+  default:
+    return false;
   }
-  else {
+}
+
+namespace {
+
+struct State {
+  nfa::NodePtr node;
+  size_t currentEdge;
+  size_t currentText;
+  size_t savedCounter;
+  size_t savedCounterValue;
+
+  State(const nfa::NodePtr &n, size_t curText)
+    : node(n),
+      currentEdge(0),
+      currentText(curText),
+      savedCounter(NoCounter),
+      savedCounterValue(0) {}
+
+  static constexpr size_t NoCounter = SIZE_MAX;
+};
+
+typedef std::vector<State> StateVector;
+
+struct Candidate {
+  StateVector states;
+  size_t length;
+
+  Candidate()
+    : length(0) {}
+};
+
+// Whether the last step of path ends a loop iteration that must fail
+// because it matched empty: the loop head was last entered at the same
+// position, and the iteration is beyond the loop's minimum.  Works on the
+// State path of find_longest_candidate and the Frame path of backtrack.
+template <typename Path>
+bool ends_empty_iteration(const Path &path,
+                          const nfa::NFAPtr &nfa,
+                          const std::vector<size_t> &counters)
+{
+  const nfa::Node *node = &*path.back().node;
+  size_t currentText = path.back().currentText;
+  assert(node->loopHead != nullptr);
+
+  if (node->loopCounter != nfa::Node::NoCounter &&
+      counters[node->loopCounter] < nfa->counters[node->loopCounter].minimum) {
     return false;
   }
+
+  for (size_t i = path.size() - 1; i-- > 0 && path[i].currentText == currentText; ) {
+    if (&*path[i].node == node->loopHead) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
-void find_all_candidates(const Package &package,
-                         const nfa::NFAPtr &nfa,
-                         const Input &input,
-                         size_t inputStartIndex,
-                         CandidateVector &candidates)
+/*
+ * Explores every path through nfa from inputStartIndex and leaves in
+ * longest the path of the longest match, the first one reached among
+ * those of that length.  Only that path is kept, so the memory taken is
+ * proportional to the length of a path rather than to the number of
+ * matches.  A look-ahead only asks whether there is a match, so firstOnly
+ * stops at the first one.
+ *
+ * Returns whether a match was found.  Stops early, with whatever it has
+ * found, once the meter runs out.
+ */
+bool find_longest_candidate(const Package &package,
+                            const nfa::NFAPtr &nfa,
+                            const Input &input,
+                            size_t inputStartIndex,
+                            bool firstOnly,
+                            Candidate &longest,
+                            Meter &meter)
 {
   assert(inputStartIndex <= input.length);
   const uint16_t *textStart = input.text + inputStartIndex;
@@ -148,18 +308,31 @@ void find_all_candidates(const Package &package,
   assert(nfa->end != nullptr);
   assert(!nfa->start->edges.empty());
 
+  std::vector<size_t> counters(nfa->counters.size(), 0);
+  bool found = false;
+  size_t allocated = 0;
+
   StateVector states;
   states.push_back(State(nfa->start, 0));
 
   while (states.size() > 0) {
     State &currentState = states.back();
     if (currentState.currentEdge >= currentState.node->edges.size()) {
+      if (currentState.savedCounter != State::NoCounter) {
+        counters[currentState.savedCounter] = currentState.savedCounterValue;
+      }
       states.pop_back();
       continue;
     }
 
+    if (!meter.step()) {
+      break;
+    }
+
     nfa::EdgePtr &currentEdge = currentState.node->edges[currentState.currentEdge++];
     size_t currentText = currentState.currentText;
+    size_t savedCounter = State::NoCounter;
+    size_t savedCounterValue = 0;
     bool pass = false;
 
     assert(currentText <= textLength);
@@ -172,11 +345,23 @@ void find_all_candidates(const Package &package,
       }
       break;
 
+    case nfa::EdgeType::String: {
+        const std::vector<uint16_t> &literal = currentEdge->literal->getText();
+        if (literal.size() <= textLength - currentText &&
+            (package.ignoreCase ?
+             utf16::equal_ignoring_case(textStart + currentText, literal.data(), literal.size()) :
+             utf16::equal(textStart + currentText, literal.data(), literal.size()))) {
+          currentText += literal.size();
+          pass = true;
+        }
+      }
+      break;
+
     case nfa::EdgeType::Assertion:
       switch (currentEdge->assertion->getAssertionType()) {
       case ast::AssertionType::BeginOfLine:
         if (package.multiline) {
-          if (currentText == 0) {
+          if (inputStartIndex + currentText == 0) {
             pass = true;
           }
           else {
@@ -195,7 +380,7 @@ void find_all_candidates(const Package &package,
           }
         }
         else {
-          pass = (currentText == 0);
+          pass = (inputStartIndex + currentText == 0);
         }
         break;
 
@@ -226,7 +411,7 @@ void find_all_candidates(const Package &package,
 
       case ast::AssertionType::WordBoundary:
       case ast::AssertionType::NonWordBoundary:
-        pass = (currentText > 0 && is_word_char(textStart[currentText - 1])) ^
+        pass = (inputStartIndex + currentText > 0 && is_word_char(textStart[currentText - 1])) ^
                (currentText <= textLength && is_word_char(textStart[currentText]));
         if (currentEdge->assertion->getAssertionType() ==
             ast::AssertionType::NonWordBoundary) {
@@ -237,9 +422,9 @@ void find_all_candidates(const Package &package,
       case ast::AssertionType::LookAhead: {
           auto it = package.subNFAs.find(static_cast<const ast::LookAheadAssertionExpr *>(currentEdge->assertion));
           assert(it != package.subNFAs.end());
-          CandidateVector subCandidates;
-          find_all_candidates(package, it->second, input, inputStartIndex + currentText, subCandidates);
-          pass = !subCandidates.empty();
+          Candidate subCandidate;
+          pass = find_longest_candidate(package, it->second, input, inputStartIndex + currentText, true,
+                                        subCandidate, meter);
           if (static_cast<const ast::LookAheadAssertionExpr *>(currentEdge->assertion)->isInverse()) {
             pass = !pass;
           }
@@ -255,12 +440,41 @@ void find_all_candidates(const Package &package,
     case nfa::EdgeType::Epsilon:
     case nfa::EdgeType::BeginCapture:
     case nfa::EdgeType::EndCapture:
+    case nfa::EdgeType::BeginNonGreedy:
+    case nfa::EdgeType::EndNonGreedy:
       pass = true;
       break;
 
+    case nfa::EdgeType::ResetCounter:
+      savedCounter = currentEdge->counterIndex;
+      savedCounterValue = counters[savedCounter];
+      counters[savedCounter] = 0;
+      pass = true;
+      break;
+
+    case nfa::EdgeType::RepeatCounter:
+      pass = counters[currentEdge->counterIndex] < nfa->counters[currentEdge->counterIndex].maximum;
+      break;
+
+    case nfa::EdgeType::IncrementCounter: {
+        const nfa::Counter &counter = nfa->counters[currentEdge->counterIndex];
+        savedCounter = currentEdge->counterIndex;
+        savedCounterValue = counters[savedCounter];
+        // Beyond the minimum an unbounded counter only needs to remember that
+        // it has been reached, so it saturates there.
+        if (counter.maximum != ast::QuantificationExpr::Infinite ||
+            savedCounterValue < counter.minimum) {
+          ++counters[savedCounter];
+        }
+        pass = true;
+      }
+      break;
+
+    case nfa::EdgeType::ExitCounter:
+      pass = counters[currentEdge->counterIndex] >= nfa->counters[currentEdge->counterIndex].minimum;
+      break;
+
     case nfa::EdgeType::Backreference:
-    case nfa::EdgeType::BeginNonGreedy:
-    case nfa::EdgeType::EndNonGreedy:
     default:
       assert(false);
       break;
@@ -271,25 +485,39 @@ void find_all_candidates(const Package &package,
     }
 
     states.push_back(State(currentEdge->node, currentText));
+    states.back().savedCounter = savedCounter;
+    states.back().savedCounterValue = savedCounterValue;
 
-    if (currentEdge->node == nfa->end) {
-      candidates.push_back(Candidate(states, currentText));
+    if (currentEdge->node->loopHead != nullptr && ends_empty_iteration(states, nfa, counters)) {
+      if (savedCounter != State::NoCounter) {
+        counters[savedCounter] = savedCounterValue;
+      }
+      states.pop_back();
+      continue;
     }
-  }
-}
 
-Candidate find_longest_candidate(CandidateVector &candidates)
-{
-  assert(!candidates.empty());
-
-  size_t longestIndex = 0;
-  for (size_t i = 1; i < candidates.size(); ++i) {
-    if (candidates[i].length > candidates[longestIndex].length) {
-      longestIndex = i;
+    if (currentEdge->node == nfa->end) {
+      if (!meter.addStates(1)) {
+        break;
+      }
+      if (!found || currentText > longest.length) {
+        found = true;
+        if (firstOnly) {
+          break;
+        }
+        meter.release(allocated);
+        allocated = states.size() * sizeof(State);
+        longest.states = states;
+        longest.length = currentText;
+        if (!meter.allocate(allocated)) {
+          break;
+        }
+      }
     }
   }
 
-  return candidates[longestIndex];
+  meter.release(allocated);
+  return found;
 }
 
 void make_output(const Candidate &candidate, size_t inputStartIndex, Output &output)
@@ -321,19 +549,527 @@ void make_output(const Candidate &candidate, size_t inputStartIndex, Output &out
   }
 }
 
+struct Frame {
+  const nfa::Node *node;
+  size_t currentEdge;
+  size_t currentText;
+  size_t savedStorage;
+  Range savedCapture;
+  Range savedCompleted;
+  size_t savedCounter;
+  size_t savedCounterValue;
+  bool inEmptyLoop;
+
+  Frame(const nfa::Node *n, size_t curText)
+    : node(n),
+      currentEdge(0),
+      currentText(curText),
+      savedStorage(NoStorage),
+      savedCounter(State::NoCounter),
+      savedCounterValue(0),
+      inEmptyLoop(false) {}
+
+  static constexpr size_t NoStorage = SIZE_MAX;
+};
+
+constexpr size_t Frame::NoStorage;
+
+/*
+ * The set of search states the backtracker has entered, where a state is
+ * a fixed number of words.  The states are stored one after the other in
+ * a single open-addressing table, with the first word of a slot offset by
+ * one so that 0 marks it empty, and the table is kept at most half full.
+ */
+class StateSet {
+public:
+  explicit StateSet(size_t width)
+    : _width(width),
+      _count(0),
+      _allocated(0) {}
+
+  ~StateSet() { assert(_allocated == 0); }
+
+  StateSet(const StateSet &) = delete;
+  StateSet &operator=(const StateSet &) = delete;
+
+  // Adds state, which is _width words long, and returns whether it was not
+  // there yet.  Growing the table is charged to the meter; once it runs out
+  // the state is reported as seen, and the search ends at its next step.
+  bool insert(const size_t *state, Meter &meter)
+  {
+    if (2 * (_count + 1) > _slotCount()) {
+      size_t slotCount = std::max<size_t>(2 * _slotCount(), 64);
+      size_t bytes = (slotCount - _slotCount()) * _width * sizeof(size_t);
+      if (!meter.allocate(bytes)) {
+        meter.release(bytes);
+        return false;
+      }
+      _allocated += bytes;
+      _grow(slotCount);
+    }
+
+    size_t *slot = _find(state);
+    if (slot[0] != 0) {
+      return false;
+    }
+    slot[0] = state[0] + 1;
+    std::copy(state + 1, state + _width, slot + 1);
+    ++_count;
+    return true;
+  }
+
+  void release(Meter &meter)
+  {
+    meter.release(_allocated);
+    _allocated = 0;
+  }
+
+private:
+  size_t _slotCount() const { return _slots.size() / _width; }
+
+  // The slot that holds state, or the empty one where it would go.
+  size_t *_find(const size_t *state)
+  {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < _width; ++i) {
+      hash = (hash ^ state[i]) * 0x9e3779b97f4a7c15ull;
+      hash ^= hash >> 32;
+    }
+
+    size_t mask = _slotCount() - 1;
+    for (size_t index = static_cast<size_t>(hash) & mask; ; index = (index + 1) & mask) {
+      size_t *slot = &_slots[index * _width];
+      if (slot[0] == 0 ||
+          (slot[0] == state[0] + 1 && std::equal(state + 1, state + _width, slot + 1))) {
+        return slot;
+      }
+    }
+  }
+
+  void _grow(size_t slotCount)
+  {
+    std::vector<size_t> slots(slotCount * _width, 0);
+    _slots.swap(slots);
+
+    std::vector<size_t> state(_width);
+    for (size_t i = 0; i < slots.size(); i += _width) {
+      if (slots[i] != 0) {
+        state[0] = slots[i] - 1;
+        std::copy(&slots[i + 1], &slots[i] + _width, state.begin() + 1);
+        size_t *slot = _find(state.data());
+        slot[0] = slots[i];
+        std::copy(state.begin() + 1, state.end(), slot + 1);
+      }
+    }
+  }
+
+  size_t _width;
+  size_t _count;
+  size_t _allocated;
+  std::vector<size_t> _slots;
+};
+
+/*
+ * The same depth-first search as find_longest_candidate, except that the
+ * captures are kept along the current path instead of in a copy per
+ * candidate, and that no search state is entered twice.
+ *
+ * A state that is reached again can only lead to the matches it led to
+ * the first time, and those were reached on a path that comes earlier in
+ * edge order, so the longest match and the captures make_output would
+ * report for it are found before the state is skipped.  Under
+ * leftmostFirst the search stops at the first match it reaches, which is
+ * the one a backtracking ECMAScript engine reports.
+ *
+ * Where no backreference can be reached and there are no counters, the
+ * state is just (node, position), kept in a bitset: the search takes
+ * O(nodes * length) steps.  Elsewhere it also holds the counter values and,
+ * for every group a backreference refers to, the last start and the last
+ * completed range, which is all the way on can depend on.  Those states
+ * go to a StateSet, a fixed number of words each, and the search is only
+ * polynomial, at O(nodes * length^(1 + 3 * groups)) states for
+ * backreferences to that many groups.  Over all start positions
+ * (\w+)\s\1 takes time quadratic in the length of the input and
+ * (a*)(a*)\2\1b cubic, so patterns with backreferences are not safe on
+ * untrusted input without a budget.
+ *
+ * Whether a loop iteration matched empty depends on where it started, so
+ * states entered after a loop whose body can match empty has started an
+ * iteration at the same position are not recorded.  The empty check itself
+ * keeps the search at one position finite.
+ */
+bool backtrack(const Package &package, const Input &input, size_t inputStartIndex, Output &output,
+               Meter &meter)
+{
+  const nfa::NFAPtr &nfa = package.nfa;
+
+  assert(inputStartIndex <= input.length);
+  const uint16_t *textStart = input.text + inputStartIndex;
+  size_t textLength = input.length - inputStartIndex;
+
+  std::vector<bool> visited;
+  StateSet visitedStates(2 + nfa->counters.size() + 3 * package.referencedStorages.size());
+  std::vector<size_t> key;
+
+  std::vector<size_t> counters(nfa->counters.size(), 0);
+  std::vector<Range> captures(output.captures.size());
+  std::vector<Range> completed(output.captures.size());
+  bool matched = false;
+  size_t matchedLength = 0;
+  size_t allocated = 0;
+
+  // Every state recorded is charged to the meter; once it runs out, the
+  // next step ends the search.
+  auto enter = [&](const nfa::Node *node, size_t currentText) -> bool {
+    if (counters.empty() &&
+        (package.reachesBackreference.empty() || !package.reachesBackreference[node->index])) {
+      // Laid out by position, so that the bitset only has to cover the part
+      // of the input the search has reached.
+      size_t visitedIndex = currentText * nfa->nodeCount + node->index;
+      if (visitedIndex >= visited.size()) {
+        size_t size = visited.size();
+        visited.resize(std::min(std::max(2 * visited.size(), visitedIndex + 1),
+                                nfa->nodeCount * (textLength + 1)), false);
+        allocated += (visited.size() - size) / 8;
+        meter.allocate((visited.size() - size) / 8);
+      }
+      if (visited[visitedIndex]) {
+        return false;
+      }
+      visited[visitedIndex] = true;
+      meter.addStates(1);
+      return true;
+    }
+
+    key.clear();
+    key.push_back(node->index);
+    key.push_back(currentText);
+    key.insert(key.end(), counters.begin(), counters.end());
+    for (auto storageIndex: package.referencedStorages) {
+      key.push_back(captures[storageIndex].position);
+      key.push_back(completed[storageIndex].position);
+      key.push_back(completed[storageIndex].length);
+    }
+    if (!visitedStates.insert(key.data(), meter)) {
+      return false;
+    }
+    meter.addStates(1);
+    return true;
+  };
+
+  std::vector<Frame> frames;
+  enter(nfa->start.get(), 0);
+  frames.push_back(Frame(nfa->start.get(), 0));
+
+  while (!frames.empty()) {
+    Frame &currentFrame = frames.back();
+    if (currentFrame.currentEdge >= currentFrame.node->edges.size()) {
+      if (currentFrame.savedStorage != Frame::NoStorage) {
+        captures[currentFrame.savedStorage] = currentFrame.savedCapture;
+        completed[currentFrame.savedStorage] = currentFrame.savedCompleted;
+      }
+      if (currentFrame.savedCounter != State::NoCounter) {
+        counters[currentFrame.savedCounter] = currentFrame.savedCounterValue;
+      }
+      frames.pop_back();
+      continue;
+    }
+
+    if (!meter.step()) {
+      break;
+    }
+
+    const nfa::EdgePtr &currentEdge = currentFrame.node->edges[currentFrame.currentEdge++];
+    size_t currentText = currentFrame.currentText;
+    bool pass = false;
+
+    switch (currentEdge->type) {
+    case nfa::EdgeType::CharacterSet:
+      pass = test_character_set(currentEdge->expr, textStart[currentText], package.ignoreCase);
+      if (pass) {
+        ++currentText;
+      }
+      break;
+
+    case nfa::EdgeType::String: {
+        const std::vector<uint16_t> &literal = currentEdge->literal->getText();
+        pass = literal.size() <= textLength - currentText &&
+               (package.ignoreCase ?
+                utf16::equal_ignoring_case(textStart + currentText, literal.data(), literal.size()) :
+                utf16::equal(textStart + currentText, literal.data(), literal.size()));
+        if (pass) {
+          currentText += literal.size();
+        }
+      }
+      break;
+
+    case nfa::EdgeType::Backreference: {
+        // A group that has not been completed matches the empty string.  The
+        // input is already lowercased under ignoreCase, and so is the text
+        // the group captured.
+        const Range &range = completed[currentEdge->storageIndex];
+        if (range.position == Range::NotFound) {
+          pass = true;
+        }
+        else if (range.length <= textLength - currentText &&
+                 utf16::equal(textStart + currentText, input.text + range.position, range.length)) {
+          currentText += range.length;
+          pass = true;
+        }
+      }
+      break;
+
+    case nfa::EdgeType::Assertion:
+      switch (currentEdge->assertion->getAssertionType()) {
+      case ast::AssertionType::BeginOfLine:
+        pass = (inputStartIndex + currentText == 0) ||
+               (package.multiline && is_line_terminator(textStart[currentText - 1]));
+        break;
+
+      case ast::AssertionType::EndOfLine:
+        pass = (currentText == textLength) ||
+               (package.multiline && is_line_terminator(textStart[currentText]));
+        break;
+
+      case ast::AssertionType::WordBoundary:
+      case ast::AssertionType::NonWordBoundary:
+        pass = (inputStartIndex + currentText > 0 && is_word_char(textStart[currentText - 1])) ^
+               (currentText <= textLength && is_word_char(textStart[currentText]));
+        if (currentEdge->assertion->getAssertionType() ==
+            ast::AssertionType::NonWordBoundary) {
+          pass = !pass;
+        }
+        break;
+
+      case ast::AssertionType::LookAhead: {
+          auto it = package.subNFAs.find(static_cast<const ast::LookAheadAssertionExpr *>(currentEdge->assertion));
+          assert(it != package.subNFAs.end());
+          Candidate subCandidate;
+          pass = find_longest_candidate(package, it->second, input, inputStartIndex + currentText, true,
+                                        subCandidate, meter);
+          if (static_cast<const ast::LookAheadAssertionExpr *>(currentEdge->assertion)->isInverse()) {
+            pass = !pass;
+          }
+        }
+        break;
+
+      default:
+        assert(false);
+        break;
+      }
+      break;
+
+    case nfa::EdgeType::Epsilon:
+    case nfa::EdgeType::BeginCapture:
+    case nfa::EdgeType::EndCapture:
+    case nfa::EdgeType::BeginNonGreedy:
+    case nfa::EdgeType::EndNonGreedy:
+    case nfa::EdgeType::ResetCounter:
+    case nfa::EdgeType::IncrementCounter:
+      pass = true;
+      break;
+
+    case nfa::EdgeType::RepeatCounter:
+      pass = counters[currentEdge->counterIndex] < nfa->counters[currentEdge->counterIndex].maximum;
+      break;
+
+    case nfa::EdgeType::ExitCounter:
+      pass = counters[currentEdge->counterIndex] >= nfa->counters[currentEdge->counterIndex].minimum;
+      break;
+
+    default:
+      assert(false);
+      break;
+    }
+
+    if (!pass) {
+      continue;
+    }
+
+    bool inEmptyLoop = currentText == currentFrame.currentText &&
+                       (currentFrame.inEmptyLoop ||
+                        (!package.startsEmptyLoop.empty() && package.startsEmptyLoop[currentFrame.node->index]));
+
+    frames.push_back(Frame(currentEdge->node.get(), currentText));
+    Frame &nextFrame = frames.back();
+    nextFrame.inEmptyLoop = inEmptyLoop;
+
+    switch (currentEdge->type) {
+    case nfa::EdgeType::BeginCapture:
+    case nfa::EdgeType::EndCapture: {
+        Range &capture = captures[currentEdge->storageIndex];
+        nextFrame.savedStorage = currentEdge->storageIndex;
+        nextFrame.savedCapture = capture;
+        nextFrame.savedCompleted = completed[currentEdge->storageIndex];
+
+        if (currentEdge->type == nfa::EdgeType::BeginCapture) {
+          capture.position = inputStartIndex + currentText;
+        }
+        else {
+          assert(inputStartIndex + currentText >= capture.position);
+          capture.length = inputStartIndex + currentText - capture.position;
+          completed[currentEdge->storageIndex] = capture;
+        }
+      }
+      break;
+
+    case nfa::EdgeType::ResetCounter:
+      nextFrame.savedCounter = currentEdge->counterIndex;
+      nextFrame.savedCounterValue = counters[currentEdge->counterIndex];
+      counters[currentEdge->counterIndex] = 0;
+      break;
+
+    case nfa::EdgeType::IncrementCounter: {
+        const nfa::Counter &counter = nfa->counters[currentEdge->counterIndex];
+        nextFrame.savedCounter = currentEdge->counterIndex;
+        nextFrame.savedCounterValue = counters[currentEdge->counterIndex];
+        if (counter.maximum != ast::QuantificationExpr::Infinite ||
+            nextFrame.savedCounterValue < counter.minimum) {
+          ++counters[currentEdge->counterIndex];
+        }
+      }
+      break;
+
+    default:
+      break;
+    }
+
+    if ((nextFrame.node->loopHead != nullptr && ends_empty_iteration(frames, nfa, counters)) ||
+        (!inEmptyLoop && !enter(nextFrame.node, currentText))) {
+      // Leave the frame without following any edge; popping it undoes what
+      // the edge changed.
+      nextFrame.currentEdge = nextFrame.node->edges.size();
+      continue;
+    }
+
+    if (currentEdge->node == nfa->end && (!matched || currentText > matchedLength)) {
+      matched = true;
+      matchedLength = currentText;
+      for (size_t i = 1; i < captures.size(); ++i) {
+        output.captures[i] = captures[i];
+      }
+
+      if (package.leftmostFirst) {
+        break;
+      }
+    }
+  }
+
+  meter.release(allocated);
+  visitedStates.release(meter);
+
+  if (!matched || meter.isAborted()) {
+    return false;
+  }
+
+  output.captures[0].position = inputStartIndex;
+  output.captures[0].length = matchedLength;
+  return true;
+}
+
 } // end namespace
 
-bool execute(const Package &package, const Input &input, size_t inputStartIndex, Output &output)
+void prepare(Package &package)
 {
-  CandidateVector candidates;
-  find_all_candidates(package, package.nfa, input, inputStartIndex, candidates);
+  const nfa::NFAPtr &nfa = package.nfa;
+  assert(nfa != nullptr);
+
+  package.referencedStorages.clear();
+  package.reachesBackreference.clear();
+  package.startsEmptyLoop.clear();
+
+  std::vector<std::vector<size_t>> predecessors(nfa->nodeCount);
+  std::vector<bool> visited(nfa->nodeCount, false);
+  std::vector<size_t> sources;
+  std::vector<const nfa::Node *> stack;
+
+  visited[nfa->start->index] = true;
+  stack.push_back(nfa->start.get());
+
+  while (!stack.empty()) {
+    const nfa::Node *node = stack.back();
+    stack.pop_back();
+
+    if (node->loopHead != nullptr) {
+      package.startsEmptyLoop.resize(nfa->nodeCount, false);
+      package.startsEmptyLoop[node->loopHead->index] = true;
+    }
+
+    for (auto &edge: node->edges) {
+      predecessors[edge->node->index].push_back(node->index);
+
+      if (edge->type == nfa::EdgeType::Backreference) {
+        package.referencedStorages.push_back(edge->storageIndex);
+        sources.push_back(node->index);
+      }
+
+      if (!visited[edge->node->index]) {
+        visited[edge->node->index] = true;
+        stack.push_back(edge->node.get());
+      }
+    }
+  }
+
+  if (sources.empty()) {
+    return;
+  }
+
+  std::vector<size_t> &storages = package.referencedStorages;
+  std::sort(storages.begin(), storages.end());
+  storages.erase(std::unique(storages.begin(), storages.end()), storages.end());
+
+  std::vector<bool> &reaches = package.reachesBackreference;
+  reaches.resize(nfa->nodeCount, false);
+  for (auto index: sources) {
+    reaches[index] = true;
+  }
+
+  while (!sources.empty()) {
+    size_t index = sources.back();
+    sources.pop_back();
+
+    for (auto predecessor: predecessors[index]) {
+      if (!reaches[predecessor]) {
+        reaches[predecessor] = true;
+        sources.push_back(predecessor);
+      }
+    }
+  }
+}
+
+bool can_backtrack(const Package &package, size_t textLength)
+{
+  if (package.leftmostFirst ||
+      !package.referencedStorages.empty() ||
+      !package.nfa->counters.empty()) {
+    return true;
+  }
+
+  // Whether nodeCount * (textLength + 1) <= backtrackLimit +
+  // VisitedBitsPerCodeUnit * textLength, without overflowing.
+  size_t nodeCount = package.nfa->nodeCount;
+  if (nodeCount > package.backtrackLimit) {
+    return false;
+  }
+  return nodeCount <= Package::VisitedBitsPerCodeUnit ||
+         textLength <= (package.backtrackLimit - nodeCount) / (nodeCount - Package::VisitedBitsPerCodeUnit);
+}
+
+bool execute(const Package &package, const Input &input, size_t inputStartIndex, Output &output,
+             Meter &meter)
+{
+  assert(inputStartIndex <= input.length);
+  if (can_backtrack(package, input.length - inputStartIndex)) {
+    return backtrack(package, input, inputStartIndex, output, meter);
+  }
 
-  if (candidates.empty()) {
+  Candidate longest;
+  if (!find_longest_candidate(package, package.nfa, input, inputStartIndex, false, longest, meter) ||
+      meter.isAborted()) {
     return false;
   }
 
-  Candidate &&longestCandidate = find_longest_candidate(candidates);
-  make_output(longestCandidate, inputStartIndex, output);
+  make_output(longest, inputStartIndex, output);
   return true;
 }
 
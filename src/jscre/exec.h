@@ -26,6 +26,9 @@
 #define __jscre_exec_h__
 
 #include "nfa.h"
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -38,6 +41,39 @@ struct Package {
   size_t storageCount;
   bool multiline;
   bool ignoreCase;
+
+  // Report the first match in priority order, as ECMAScript does, rather
+  // than the longest one.
+  bool leftmostFirst;
+
+  // Inputs for which nodeCount * (length + 1) fits in this many bits, plus
+  // VisitedBitsPerCodeUnit for every code unit, are matched by a
+  // backtracker that never visits a (node, position) twice; the rest go to
+  // the exhaustive search.  Patterns with counters or backreferences, and leftmost-first ones, are
+  // backtracked on any input, over states that also hold the counter
+  // values and the referenced captures.
+  size_t backtrackLimit;
+
+  // Filled in by prepare(): the capture groups that backreferences refer
+  // to and, by node index, whether a backreference can be reached from a
+  // node.  Both are empty for patterns without backreferences.
+  std::vector<size_t> referencedStorages;
+  std::vector<bool> reachesBackreference;
+
+  // Also filled in by prepare(): by node index, whether a node starts the
+  // iterations of a loop whose body can match empty.  Empty if there is no
+  // such loop.
+  std::vector<bool> startsEmptyLoop;
+
+  Package()
+    : storageCount(0),
+      multiline(false),
+      ignoreCase(false),
+      leftmostFirst(false),
+      backtrackLimit(DefaultBacktrackLimit) {}
+
+  static constexpr size_t DefaultBacktrackLimit = 1 << 18;
+  static constexpr size_t VisitedBitsPerCodeUnit = 64;
 };
 
 struct Input {
@@ -49,6 +85,13 @@ struct Input {
 
   Input(const Input &) = delete;
   Input &operator=(const Input &) = delete;
+
+  // Replaces the text with a copy of txt, in the same buffer if it has
+  // room for it.
+  void assign(const uint16_t *txt, size_t len, bool ignoreCase = false);
+
+private:
+  size_t _capacity;
 };
 
 struct Range {
@@ -72,7 +115,80 @@ struct Output {
 typedef std::shared_ptr<Input> InputPtr;
 typedef std::shared_ptr<Output> OutputPtr;
 
-bool execute(const Package &package, const Input &input, size_t inputStartIndex, Output &output);
+/*
+ * Limits on the work of a single call; a limit of zero means none.  Steps
+ * are edges followed by the NFA engines and code units scanned by the
+ * automata.  States are the search states the NFA engines keep, and memory
+ * the bytes those take up at once.  The deadline and the cancelled flag,
+ * which another thread may set, are polled every CheckInterval steps.
+ */
+struct Budget {
+  size_t stepLimit;
+  size_t stateLimit;
+  size_t memoryLimit;
+  std::chrono::steady_clock::time_point deadline;
+  const std::atomic<bool> *cancelled;
+
+  Budget()
+    : stepLimit(0),
+      stateLimit(0),
+      memoryLimit(0),
+      deadline(std::chrono::steady_clock::time_point::max()),
+      cancelled(nullptr) {}
+
+  static constexpr size_t CheckInterval = 1024;
+};
+
+/*
+ * Keeps the account of one call against its Budget.  Once the budget runs
+ * out the meter is aborted for good: every charge fails, and the engines
+ * return as if there were no match, which the caller tells apart with
+ * isAborted().
+ */
+class Meter {
+public:
+  explicit Meter(const Budget &budget = Budget());
+
+  Meter(const Meter &) = delete;
+  Meter &operator=(const Meter &) = delete;
+
+  bool step(size_t count = 1)
+  {
+    _steps += count;
+    return __builtin_expect(_steps < _nextCheck, true) || _check();
+  }
+
+  bool addStates(size_t count);
+  bool allocate(size_t bytes);
+  void release(size_t bytes);
+
+  bool isAborted() const { return _aborted; }
+  size_t getSteps() const { return _steps; }
+
+private:
+  void _schedule();
+  bool _check();
+  bool _abort();
+
+  Budget _budget;
+  size_t _steps;
+  size_t _nextCheck;
+  size_t _states;
+  size_t _memory;
+  bool _aborted;
+};
+
+bool test_character_set(const ast::CharacterClassExpr *expr, uint16_t ch, bool ignoreCase);
+bool is_word_char(uint16_t ch);
+bool is_line_terminator(uint16_t ch);
+
+void prepare(Package &package);
+
+// Whether execute() runs the backtracker, rather than the exhaustive
+// search, on textLength code units.
+bool can_backtrack(const Package &package, size_t textLength);
+bool execute(const Package &package, const Input &input, size_t inputStartIndex, Output &output,
+             Meter &meter);
 
 } // end namespace exec
 } // end namespace jscre
@@ -0,0 +1,191 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "latin1.h"
+#include <assert.h>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+#if defined(__x86_64__) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif /* defined(__x86_64__) && defined(__SSSE3__) */
+
+namespace jscre {
+namespace latin1 {
+
+namespace {
+
+#if defined(__x86_64__) && defined(__SSE2__)
+constexpr size_t vector_length = sizeof(__m128i);
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+} // end namespace
+
+bool is_ascii(const uint8_t *text, size_t length)
+{
+  size_t i = 0;
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  __m128i bits = _mm_setzero_si128();
+  while (__builtin_expect(length - i >= vector_length, true)) {
+    bits = _mm_or_si128(bits, _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i)));
+    i += vector_length;
+  }
+  if (_mm_movemask_epi8(bits) != 0) {
+    return false;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  for (; i < length; ++i) {
+    if (text[i] >= 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void widen(const uint8_t *text, size_t length, uint16_t *units)
+{
+  size_t i = 0;
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  while (__builtin_expect(length - i >= vector_length, true)) {
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(units + i), _mm_unpacklo_epi8(value, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(units + i + vector_length / 2),
+                     _mm_unpackhi_epi8(value, zero));
+    i += vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  for (; i < length; ++i) {
+    units[i] = text[i];
+  }
+}
+
+void to_utf16(const uint8_t *text,
+              size_t length,
+              std::vector<uint16_t> &units,
+              std::vector<size_t> &offsets)
+{
+  units.resize(length);
+  widen(text, length, units.data());
+
+  offsets.resize(length + 1);
+  for (size_t i = 0; i <= length; ++i) {
+    offsets[i] = i;
+  }
+}
+
+size_t find_any(const uint8_t *text, size_t length,
+                const uint16_t *needles, size_t needleCount)
+{
+  assert(needleCount > 0 && needleCount <= utf16::MaxNeedleCount);
+
+  uint8_t bytes[utf16::MaxNeedleCount];
+  size_t byteCount = 0;
+  for (size_t i = 0; i < needleCount; ++i) {
+    if (needles[i] <= 0xff) {
+      bytes[byteCount++] = static_cast<uint8_t>(needles[i]);
+    }
+  }
+
+  if (byteCount == 0) {
+    return length;
+  }
+
+  size_t i = 0;
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  const __m128i first = _mm_set1_epi8(bytes[0]);
+  const __m128i second = _mm_set1_epi8(bytes[byteCount > 1 ? 1 : 0]);
+  const __m128i third = _mm_set1_epi8(bytes[byteCount > 2 ? 2 : 0]);
+  const __m128i fourth = _mm_set1_epi8(bytes[byteCount > 3 ? 3 : 0]);
+
+  while (__builtin_expect(length - i >= vector_length, true)) {
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    const __m128i mask = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(value, first),
+                                                   _mm_cmpeq_epi8(value, second)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(value, third),
+                                                   _mm_cmpeq_epi8(value, fourth)));
+    int bits = _mm_movemask_epi8(mask);
+    if (bits != 0) {
+      return i + __builtin_ctz(bits);
+    }
+
+    i += vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  for (; i < length; ++i) {
+    for (size_t j = 0; j < byteCount; ++j) {
+      if (text[i] == bytes[j]) {
+        return i;
+      }
+    }
+  }
+  return length;
+}
+
+size_t find_in_table(const uint8_t *text, size_t length, const utf16::NibbleTable &table)
+{
+  size_t i = 0;
+
+#if defined(__x86_64__) && defined(__SSSE3__)
+  // Bytes from 0x80 on have a high nibble >= 8, which the high-nibble
+  // lookup rejects.
+  const __m128i lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+  const __m128i highTable = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibbleMask = _mm_set1_epi8(0xf);
+  const __m128i zero = _mm_setzero_si128();
+
+  while (__builtin_expect(length - i >= vector_length, true)) {
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    const __m128i lowBits = _mm_shuffle_epi8(lowTable, _mm_and_si128(value, nibbleMask));
+    const __m128i highBits = _mm_shuffle_epi8(highTable,
+                                              _mm_and_si128(_mm_srli_epi16(value, 4), nibbleMask));
+    const __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(lowBits, highBits), zero);
+    int bits = _mm_movemask_epi8(mask) ^ 0xffff;
+    if (bits != 0) {
+      return i + __builtin_ctz(bits);
+    }
+
+    i += vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSSE3__) */
+
+  for (; i < length; ++i) {
+    if (text[i] < 0x80 && (table[text[i] & 0xf] & (1 << (text[i] >> 4)))) {
+      return i;
+    }
+  }
+  return length;
+}
+
+} // end namespace latin1
+} // end namespace jscre
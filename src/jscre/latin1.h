@@ -0,0 +1,63 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_latin1_h__
+#define __jscre_latin1_h__
+
+#include "utf16_string.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace jscre {
+namespace latin1 {
+
+/*
+ * Latin-1 text has one byte per character, U+0000 to U+00FF, which is
+ * also its UTF-16 code unit.  ASCII text reads the same in Latin-1 and in
+ * UTF-8.
+ */
+bool is_ascii(const uint8_t *text, size_t length);
+
+// Writes the UTF-16 code units of text, one per byte, to units.
+void widen(const uint8_t *text, size_t length, uint16_t *units);
+
+// The same as utf8::to_utf16, for which every offset is its own index.
+void to_utf16(const uint8_t *text,
+              size_t length,
+              std::vector<uint16_t> &units,
+              std::vector<size_t> &offsets);
+
+/*
+ * The same as utf16::find_any and utf16::find_in_table on Latin-1 text.
+ * Needles beyond U+00FF never match.
+ */
+size_t find_any(const uint8_t *text, size_t length,
+                const uint16_t *needles, size_t needleCount);
+size_t find_in_table(const uint8_t *text, size_t length, const utf16::NibbleTable &table);
+
+} // end namespace latin1
+} // end namespace jscre
+
+#endif /* __jscre_latin1_h__ */
@@ -23,7 +23,9 @@
  */
 
 #include "nfa.h"
+#include "analyzer.h"
 #include <assert.h>
+#include <algorithm>
 #include <set>
 #include <sstream>
 #include <iterator>
@@ -32,10 +34,17 @@
 namespace jscre {
 namespace nfa {
 
+constexpr size_t Node::NoCounter;
+
 namespace {
 
 class ConstructNFARecursiveExprVisitor : public ast::RecursiveExprVisitor {
 public:
+  explicit ConstructNFARecursiveExprVisitor(const Limits &limits)
+    : _limits(limits),
+      _nodeCount(0),
+      _totalNodeCount(0) {}
+
   virtual void visitConcatenationExpr(ast::ConcatenationExpr *expr);
   virtual void visitDisjunctionExpr(ast::DisjunctionExpr *expr);
   virtual void visitEmptyExpr(ast::EmptyExpr *expr);
@@ -45,21 +54,69 @@ public:
   virtual void visitQuantificationExpr(ast::QuantificationExpr *expr);
   virtual void visitGroupExpr(ast::GroupExpr *expr);
   virtual void visitBackreferenceExpr(ast::BackreferenceExpr *expr);
+  virtual void visitLiteralExpr(ast::LiteralExpr *expr);
 
   NFAPtr &getMainNFA() { assert(_nfaStack.size() == 1); return _nfaStack.front(); }
   LookAheadNFAMap &getSubNFAs() { return _subNFAs; }
+  CounterVector &getCounters() { return _counters; }
+
+  size_t getNodeCount() const { return _nodeCount; }
+  size_t getTotalNodeCount() const { return _totalNodeCount; }
+  bool isOverflowed() const { return _totalNodeCount > _limits.nodeLimit; }
 
 private:
+  NodePtr newNode();
+  static void addExitEdge(const NodePtr &node, const EdgePtr &edge, bool greedy);
+  static bool isNullable(const ast::QuantificationExpr *expr);
+  void concatenateNFAs(size_t current);
+  NFAPtr constructCopy(ast::QuantificationExpr *expr);
+  void constructCountedQuantification(ast::QuantificationExpr *expr, NFAPtr subNFA);
+
+  Limits _limits;
+  size_t _nodeCount;
+  size_t _totalNodeCount;
   std::vector<NFAPtr> _nfaStack;
   LookAheadNFAMap _subNFAs;
+  CounterVector _counters;
 };
 
+NodePtr ConstructNFARecursiveExprVisitor::newNode()
+{
+  NodePtr node = std::make_shared<Node>();
+  node->index = _nodeCount++;
+  node->loopHead = nullptr;
+  node->loopCounter = Node::NoCounter;
+  ++_totalNodeCount;
+  return node;
+}
+
+void ConstructNFARecursiveExprVisitor::addExitEdge(const NodePtr &node, const EdgePtr &edge, bool greedy)
+{
+  // The edge that leaves a quantifier comes after the one that repeats it
+  // when greedy, and before it when not.
+  if (greedy) {
+    node->edges.push_back(edge);
+  }
+  else {
+    node->edges.insert(node->edges.begin(), edge);
+  }
+}
+
+bool ConstructNFARecursiveExprVisitor::isNullable(const ast::QuantificationExpr *expr)
+{
+  return analyzer::analyze_lengths(expr->getSubExpr()).minimum == 0;
+}
+
 void ConstructNFARecursiveExprVisitor::visitConcatenationExpr(ast::ConcatenationExpr *expr)
 {
   size_t current = _nfaStack.size();
   traverseConcatenationExpr(expr);
   assert(_nfaStack.size() > current);
+  concatenateNFAs(current);
+}
 
+void ConstructNFARecursiveExprVisitor::concatenateNFAs(size_t current)
+{
   NFAPtr nfa = std::make_shared<NFA>();
 
   for (size_t i = current; i < _nfaStack.size(); ++i) {
@@ -90,8 +147,8 @@ void ConstructNFARecursiveExprVisitor::visitDisjunctionExpr(ast::DisjunctionExpr
   assert(_nfaStack.size() > current);
 
   NFAPtr nfa = std::make_shared<NFA>();
-  nfa->start = std::make_shared<Node>();
-  nfa->end = std::make_shared<Node>();
+  nfa->start = newNode();
+  nfa->end = newNode();
 
   for (size_t i = current; i < _nfaStack.size(); ++i) {
     NFAPtr &subNFA = _nfaStack[i];
@@ -116,8 +173,8 @@ void ConstructNFARecursiveExprVisitor::visitDisjunctionExpr(ast::DisjunctionExpr
 void ConstructNFARecursiveExprVisitor::visitEmptyExpr(ast::EmptyExpr *expr)
 {
   NFAPtr nfa = std::make_shared<NFA>();
-  nfa->start = std::make_shared<Node>();
-  nfa->end = std::make_shared<Node>();
+  nfa->start = newNode();
+  nfa->end = newNode();
 
   EdgePtr edge = std::make_shared<Edge>();
   edge->type = EdgeType::Epsilon;
@@ -130,8 +187,8 @@ void ConstructNFARecursiveExprVisitor::visitEmptyExpr(ast::EmptyExpr *expr)
 void ConstructNFARecursiveExprVisitor::visitCharacterClassExpr(ast::CharacterClassExpr *expr)
 {
   NFAPtr nfa = std::make_shared<NFA>();
-  nfa->start = std::make_shared<Node>();
-  nfa->end = std::make_shared<Node>();
+  nfa->start = newNode();
+  nfa->end = newNode();
 
   EdgePtr edge = std::make_shared<Edge>();
   edge->type = EdgeType::CharacterSet;
@@ -145,8 +202,8 @@ void ConstructNFARecursiveExprVisitor::visitCharacterClassExpr(ast::CharacterCla
 void ConstructNFARecursiveExprVisitor::visitAssertionExpr(ast::AssertionExpr *expr)
 {
   NFAPtr nfa = std::make_shared<NFA>();
-  nfa->start = std::make_shared<Node>();
-  nfa->end = std::make_shared<Node>();
+  nfa->start = newNode();
+  nfa->end = newNode();
 
   EdgePtr edge = std::make_shared<Edge>();
   edge->type = EdgeType::Assertion;
@@ -161,9 +218,26 @@ void ConstructNFARecursiveExprVisitor::visitLookAheadAssertionExpr(ast::LookAhea
 {
   visitAssertionExpr(expr);
 
-  LookAheadNFAMap subSubNFAs;
-  NFAPtr &&subNFA = construct_nfa(expr->getSubExpr(), subSubNFAs);
-  assert(subNFA != nullptr);
+  // The copies of an unrolled repetition share the look-ahead NFAs built
+  // for the first one.
+  if (isOverflowed() || _subNFAs.find(expr) != _subNFAs.end()) {
+    return;
+  }
+
+  Limits subLimits(_limits);
+  subLimits.nodeLimit -= _totalNodeCount;
+
+  ConstructNFARecursiveExprVisitor visitor(subLimits);
+  visitor.traverseExpr(expr->getSubExpr());
+  _totalNodeCount += visitor.getTotalNodeCount();
+  if (isOverflowed()) {
+    return;
+  }
+
+  LookAheadNFAMap &subSubNFAs = visitor.getSubNFAs();
+  NFAPtr &subNFA = visitor.getMainNFA();
+  subNFA->nodeCount = visitor.getNodeCount();
+  subNFA->counters = std::move(visitor.getCounters());
   assert(_subNFAs.find(expr) == _subNFAs.end());
   _subNFAs.insert(std::make_pair(expr, subNFA));
 
@@ -175,11 +249,12 @@ void ConstructNFARecursiveExprVisitor::visitLookAheadAssertionExpr(ast::LookAhea
 
 void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::QuantificationExpr *expr)
 {
-  if (expr->getMinimum() == 0 &&
-      expr->getMaximum() == 0) {
+  if ((expr->getMinimum() == 0 &&
+       expr->getMaximum() == 0) ||
+      isOverflowed()) {
     NFAPtr nfa = std::make_shared<NFA>();
-    nfa->start = std::make_shared<Node>();
-    nfa->end = std::make_shared<Node>();
+    nfa->start = newNode();
+    nfa->end = newNode();
 
     EdgePtr edge = std::make_shared<Edge>();
     edge->type = EdgeType::Epsilon;
@@ -190,15 +265,36 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
     return;
   }
 
-  NFAPtr nfa = std::make_shared<NFA>();
+  size_t copies = expr->getMinimum();
+  if (expr->getMaximum() == ast::QuantificationExpr::Infinite) {
+    copies += 1;
+  }
+  else {
+    copies += expr->getMaximum() - expr->getMinimum();
+  }
+
+  // The first copy tells what unrolling would cost.  Repetitions that would
+  // take more than unrollLimit nodes, or take the NFA past nodeLimit, keep
+  // that one copy under a counter instead.
+  size_t totalNodeCount = _totalNodeCount;
+  NFAPtr first = constructCopy(expr);
+  size_t copyNodeCount = _totalNodeCount - totalNodeCount;
+  if (isOverflowed()) {
+    _nfaStack.push_back(first);
+    return;
+  }
+
+  if (copies > 1 &&
+      (copyNodeCount * copies > _limits.unrollLimit ||
+       copyNodeCount * (copies - 1) > _limits.nodeLimit - std::min(_limits.nodeLimit, _totalNodeCount))) {
+    constructCountedQuantification(expr, std::move(first));
+    return;
+  }
 
-  for (size_t i = 0; i < expr->getMinimum(); i++) {
-    size_t current = _nfaStack.size();
-    traverseQuantificationExpr(expr);
-    assert(_nfaStack.size() == current + 1);
+  NFAPtr nfa = std::make_shared<NFA>();
 
-    NFAPtr subNFA = std::move(_nfaStack[current]);
-    _nfaStack.pop_back();
+  for (size_t i = 0; i < expr->getMinimum() && !isOverflowed(); i++) {
+    NFAPtr subNFA = first != nullptr ? std::move(first) : constructCopy(expr);
 
     if (nfa->start == nullptr) {
       assert(nfa->end == nullptr);
@@ -216,12 +312,7 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
   }
 
   if (expr->getMaximum() == ast::QuantificationExpr::Infinite) {
-    size_t current = _nfaStack.size();
-    traverseQuantificationExpr(expr);
-    assert(_nfaStack.size() == current + 1);
-
-    NFAPtr subNFA = std::move(_nfaStack[current]);
-    _nfaStack.pop_back();
+    NFAPtr subNFA = first != nullptr ? std::move(first) : constructCopy(expr);
 
     {
       EdgePtr edge = std::make_shared<Edge>();
@@ -230,9 +321,13 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
       subNFA->end->edges.push_back(edge);
     }
 
+    if (isNullable(expr)) {
+      subNFA->end->loopHead = subNFA->start.get();
+    }
+
     {
-      NodePtr node1 = std::make_shared<Node>();
-      NodePtr node2 = std::make_shared<Node>();
+      NodePtr node1 = newNode();
+      NodePtr node2 = newNode();
 
       {
         EdgePtr edge = std::make_shared<Edge>();
@@ -245,14 +340,14 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
         EdgePtr edge = std::make_shared<Edge>();
         edge->type = EdgeType::Epsilon;
         edge->node = node2;
-        subNFA->end->edges.push_back(edge);
+        addExitEdge(subNFA->end, edge, expr->isGreedy());
       }
 
       {
         EdgePtr edge = std::make_shared<Edge>();
         edge->type = EdgeType::Epsilon;
         edge->node = node2;
-        node1->edges.push_back(edge);
+        addExitEdge(node1, edge, expr->isGreedy());
       }
 
       subNFA->start = node1;
@@ -275,16 +370,15 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
   }
   else {
     NodeVector subInitials;
+    bool nullable = isNullable(expr);
 
-    for (size_t i = expr->getMinimum(); i < expr->getMaximum(); i++) {
-      size_t current = _nfaStack.size();
-      traverseQuantificationExpr(expr);
-      assert(_nfaStack.size() == current + 1);
-
-      NFAPtr subNFA = std::move(_nfaStack[current]);
-      _nfaStack.pop_back();
+    for (size_t i = expr->getMinimum(); i < expr->getMaximum() && !isOverflowed(); i++) {
+      NFAPtr subNFA = first != nullptr ? std::move(first) : constructCopy(expr);
 
       subInitials.push_back(subNFA->start);
+      if (nullable) {
+        subNFA->end->loopHead = subNFA->start.get();
+      }
 
       if (nfa->start == nullptr) {
         assert(nfa->end == nullptr);
@@ -301,11 +395,21 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
       }
     }
 
+    // Skipping the optional copies must not end the last one, whose empty
+    // iterations fail.
+    if (nullable && !subInitials.empty()) {
+      EdgePtr edge = std::make_shared<Edge>();
+      edge->type = EdgeType::Epsilon;
+      edge->node = newNode();
+      nfa->end->edges.push_back(edge);
+      nfa->end = edge->node;
+    }
+
     for (auto &node: subInitials) {
       EdgePtr edge = std::make_shared<Edge>();
       edge->type = EdgeType::Epsilon;
       edge->node = nfa->end;
-      node->edges.push_back(edge);
+      addExitEdge(node, edge, expr->isGreedy());
     }
   }
 
@@ -317,7 +421,95 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
       edge->type = EdgeType::BeginNonGreedy;
       edge->node = nfa->start;
 
-      NodePtr node = std::make_shared<Node>();
+      NodePtr node = newNode();
+      node->edges.push_back(edge);
+      nfa->start = node;
+    }
+    {
+      EdgePtr edge = std::make_shared<Edge>();
+      edge->type = EdgeType::EndNonGreedy;
+      nfa->end->edges.push_back(edge);
+
+      NodePtr node = newNode();
+      edge->node = node;
+      nfa->end = node;
+    }
+  }
+
+  _nfaStack.push_back(nfa);
+}
+
+NFAPtr ConstructNFARecursiveExprVisitor::constructCopy(ast::QuantificationExpr *expr)
+{
+  size_t current = _nfaStack.size();
+  traverseQuantificationExpr(expr);
+  assert(_nfaStack.size() == current + 1);
+
+  NFAPtr subNFA = std::move(_nfaStack[current]);
+  _nfaStack.pop_back();
+  return std::move(subNFA);
+}
+
+void ConstructNFARecursiveExprVisitor::constructCountedQuantification(ast::QuantificationExpr *expr, NFAPtr subNFA)
+{
+  size_t counterIndex = _counters.size();
+  {
+    Counter counter;
+    counter.minimum = expr->getMinimum();
+    counter.maximum = expr->getMaximum();
+    _counters.push_back(counter);
+  }
+
+  NFAPtr nfa = std::make_shared<NFA>();
+  nfa->start = newNode();
+  nfa->end = newNode();
+
+  NodePtr head = newNode();
+
+  {
+    EdgePtr edge = std::make_shared<Edge>();
+    edge->type = EdgeType::ResetCounter;
+    edge->node = head;
+    edge->counterIndex = counterIndex;
+    nfa->start->edges.push_back(edge);
+  }
+
+  {
+    EdgePtr edge = std::make_shared<Edge>();
+    edge->type = EdgeType::RepeatCounter;
+    edge->node = subNFA->start;
+    edge->counterIndex = counterIndex;
+    head->edges.push_back(edge);
+  }
+
+  {
+    EdgePtr edge = std::make_shared<Edge>();
+    edge->type = EdgeType::IncrementCounter;
+    edge->node = head;
+    edge->counterIndex = counterIndex;
+    subNFA->end->edges.push_back(edge);
+  }
+
+  if (isNullable(expr)) {
+    subNFA->end->loopHead = head.get();
+    subNFA->end->loopCounter = counterIndex;
+  }
+
+  {
+    EdgePtr edge = std::make_shared<Edge>();
+    edge->type = EdgeType::ExitCounter;
+    edge->node = nfa->end;
+    edge->counterIndex = counterIndex;
+    addExitEdge(head, edge, expr->isGreedy());
+  }
+
+  if (!expr->isGreedy()) {
+    {
+      EdgePtr edge = std::make_shared<Edge>();
+      edge->type = EdgeType::BeginNonGreedy;
+      edge->node = nfa->start;
+
+      NodePtr node = newNode();
       node->edges.push_back(edge);
       nfa->start = node;
     }
@@ -326,7 +518,7 @@ void ConstructNFARecursiveExprVisitor::visitQuantificationExpr(ast::Quantificati
       edge->type = EdgeType::EndNonGreedy;
       nfa->end->edges.push_back(edge);
 
-      NodePtr node = std::make_shared<Node>();
+      NodePtr node = newNode();
       edge->node = node;
       nfa->end = node;
     }
@@ -349,7 +541,7 @@ void ConstructNFARecursiveExprVisitor::visitGroupExpr(ast::GroupExpr *expr)
       edge->node = nfa->start;
       edge->storageIndex = expr->getStorageIndex();
 
-      NodePtr node = std::make_shared<Node>();
+      NodePtr node = newNode();
       node->edges.push_back(edge);
       nfa->start = node;
     }
@@ -359,7 +551,7 @@ void ConstructNFARecursiveExprVisitor::visitGroupExpr(ast::GroupExpr *expr)
       edge->storageIndex = expr->getStorageIndex();
       nfa->end->edges.push_back(edge);
 
-      NodePtr node = std::make_shared<Node>();
+      NodePtr node = newNode();
       edge->node = node;
       nfa->end = node;
     }
@@ -369,8 +561,8 @@ void ConstructNFARecursiveExprVisitor::visitGroupExpr(ast::GroupExpr *expr)
 void ConstructNFARecursiveExprVisitor::visitBackreferenceExpr(ast::BackreferenceExpr *expr)
 {
   NFAPtr nfa = std::make_shared<NFA>();
-  nfa->start = std::make_shared<Node>();
-  nfa->end = std::make_shared<Node>();
+  nfa->start = newNode();
+  nfa->end = newNode();
 
   EdgePtr edge = std::make_shared<Edge>();
   edge->type = EdgeType::Backreference;
@@ -381,14 +573,37 @@ void ConstructNFARecursiveExprVisitor::visitBackreferenceExpr(ast::Backreference
   _nfaStack.push_back(nfa);
 }
 
+void ConstructNFARecursiveExprVisitor::visitLiteralExpr(ast::LiteralExpr *expr)
+{
+  NFAPtr nfa = std::make_shared<NFA>();
+  nfa->start = newNode();
+  nfa->end = newNode();
+
+  EdgePtr edge = std::make_shared<Edge>();
+  edge->type = EdgeType::String;
+  edge->node = nfa->end;
+  edge->literal = expr;
+  nfa->start->edges.push_back(edge);
+
+  _nfaStack.push_back(nfa);
+}
+
 } // end namespace
 
-NFAPtr construct_nfa(const ast::ExprPtr &expr, LookAheadNFAMap &subNFAs)
+NFAPtr construct_nfa(const ast::ExprPtr &expr, LookAheadNFAMap &subNFAs, const Limits &limits)
 {
-  ConstructNFARecursiveExprVisitor visitor;
+  ConstructNFARecursiveExprVisitor visitor(limits);
   visitor.traverseExpr(expr);
+  if (visitor.isOverflowed()) {
+    subNFAs.clear();
+    return nullptr;
+  }
+
+  NFAPtr &nfa = visitor.getMainNFA();
+  nfa->nodeCount = visitor.getNodeCount();
+  nfa->counters = std::move(visitor.getCounters());
   subNFAs = std::move(visitor.getSubNFAs());
-  return std::move(visitor.getMainNFA());
+  return std::move(nfa);
 }
 
 namespace {
@@ -444,6 +659,10 @@ std::string to_string(const NFAPtr &nfa, const LookAheadNFAMap &subNFAs, size_t
         os << std::string(currentIndent, ' ') << ast_to_string(edge->expr);
         break;
 
+      case EdgeType::String:
+        os << std::string(currentIndent, ' ') << ast_to_string(edge->literal);
+        break;
+
       case EdgeType::Assertion:
         switch (edge->assertion->getAssertionType()) {
         case ast::AssertionType::LookAhead:
@@ -479,6 +698,25 @@ std::string to_string(const NFAPtr &nfa, const LookAheadNFAMap &subNFAs, size_t
         os << std::string(currentIndent, ' ') << "End Non-Greedy" << "\n";
         break;
 
+      case EdgeType::ResetCounter:
+        os << std::string(currentIndent, ' ') << "Reset Counter #" << edge->counterIndex << "\n";
+        break;
+
+      case EdgeType::RepeatCounter:
+        os << std::string(currentIndent, ' ') << "Repeat Counter #" << edge->counterIndex
+           << " (< " << (nfa->counters[edge->counterIndex].maximum == ast::QuantificationExpr::Infinite ?
+                         "Inf" : std::to_string(nfa->counters[edge->counterIndex].maximum)) << ")\n";
+        break;
+
+      case EdgeType::IncrementCounter:
+        os << std::string(currentIndent, ' ') << "Increment Counter #" << edge->counterIndex << "\n";
+        break;
+
+      case EdgeType::ExitCounter:
+        os << std::string(currentIndent, ' ') << "Exit Counter #" << edge->counterIndex
+           << " (>= " << nfa->counters[edge->counterIndex].minimum << ")\n";
+        break;
+
       default:
         assert(false);
         break;
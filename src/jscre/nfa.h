@@ -46,19 +46,39 @@ struct NFA;
 typedef std::shared_ptr<NFA> NFAPtr;
 typedef std::map<const ast::LookAheadAssertionExpr *, NFAPtr> LookAheadNFAMap;
 
+/*
+ * loopHead is set on the last node of a loop body that can match the empty
+ * string, and of each copy beyond the minimum of such a body when a bounded
+ * repetition is unrolled, and points to the node that iteration starts
+ * from.  loopCounter is the loop's counter, or NoCounter if it is unrolled.
+ *
+ * As in JavaScript, an iteration beyond the minimum that ends where it
+ * started fails.  Executors that follow paths one at a time rely on this
+ * to never go round such a loop forever.
+ */
 struct Node {
+  size_t index;
   EdgeVector edges;
+  const Node *loopHead;
+  size_t loopCounter;
+
+  static constexpr size_t NoCounter = SIZE_MAX;
 };
 
 enum class EdgeType {
   Epsilon,
   CharacterSet,
+  String,
   Assertion,
   Backreference,
   BeginCapture,
   EndCapture,
   BeginNonGreedy,
-  EndNonGreedy
+  EndNonGreedy,
+  ResetCounter,
+  RepeatCounter,
+  IncrementCounter,
+  ExitCounter
 };
 
 struct Edge {
@@ -67,17 +87,56 @@ struct Edge {
 
   union {
     const ast::CharacterClassExpr *expr;
+    const ast::LiteralExpr *literal;
     const ast::AssertionExpr *assertion;
     size_t storageIndex;
+    size_t counterIndex;
   };
 };
 
+/*
+ * A counted repetition whose unrolled form would exceed the Limits below is
+ * compiled into a single copy of its sub-expression guarded by a counter:
+ *
+ *   start --ResetCounter--> head --RepeatCounter--> sub --IncrementCounter--> head
+ *                           head --ExitCounter--> end
+ *
+ * RepeatCounter passes while the counter is below maximum, ExitCounter passes
+ * once it has reached minimum.
+ */
+struct Counter {
+  size_t minimum;
+  size_t maximum;
+};
+
+typedef std::vector<Counter> CounterVector;
+
 struct NFA {
   NodePtr start;
   NodePtr end;
+  size_t nodeCount;
+  CounterVector counters;
+};
+
+/*
+ * unrollLimit is the most nodes a counted repetition is unrolled into, and
+ * nodeLimit the most the NFA and its look-ahead NFAs may take in all.  A
+ * repetition that would exceed either is compiled into a counter, which
+ * the DFAs cannot run.
+ */
+struct Limits {
+  size_t unrollLimit;
+  size_t nodeLimit;
+
+  Limits()
+    : unrollLimit(DefaultUnrollLimit),
+      nodeLimit(DefaultNodeLimit) {}
+
+  static constexpr size_t DefaultUnrollLimit = 1 << 12;
+  static constexpr size_t DefaultNodeLimit = 1 << 16;
 };
 
-NFAPtr construct_nfa(const ast::ExprPtr &expr, LookAheadNFAMap &subNFAs);
+NFAPtr construct_nfa(const ast::ExprPtr &expr, LookAheadNFAMap &subNFAs, const Limits &limits = Limits());
 std::string to_string(const NFAPtr &nfa, const LookAheadNFAMap &subNFAs);
 
 } // end namespace nfa
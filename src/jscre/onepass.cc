@@ -0,0 +1,272 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "onepass.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace jscre {
+namespace onepass {
+
+constexpr size_t OnePass::DefaultStateLimit;
+constexpr uint32_t OnePass::_DeadState;
+constexpr uint32_t OnePass::_Accept;
+
+namespace {
+
+constexpr uint32_t NoClass = UINT32_MAX;
+
+struct Path {
+  uint32_t node;
+  uint32_t classSet;
+  std::vector<uint32_t> tags;
+};
+
+/*
+ * Collects the ways out of node for the given assertion context: every
+ * transition and every arrival at the accept node, with the tags set on
+ * the way.  Returns false if two epsilon paths meet at one node, since
+ * the program is not one-pass then (this also rejects empty loops).
+ */
+bool collect_paths(const dfa::Program &program,
+                   uint32_t node,
+                   dfa::CharType before,
+                   dfa::CharType after,
+                   std::vector<Path> &paths)
+{
+  const std::vector<dfa::Program::Node> &nodes = program.getNodes();
+  std::vector<bool> visited(nodes.size(), false);
+  std::vector<Path> stack;
+
+  paths.clear();
+  stack.push_back(Path {node, NoClass, {}});
+
+  while (!stack.empty()) {
+    Path path = std::move(stack.back());
+    stack.pop_back();
+
+    if (path.classSet != NoClass) {
+      paths.push_back(std::move(path));
+      continue;
+    }
+
+    if (visited[path.node]) {
+      return false;
+    }
+    visited[path.node] = true;
+
+    if (path.node == program.getAccept()) {
+      paths.push_back(path);
+    }
+
+    for (auto &edge: nodes[path.node].edges) {
+      switch (edge.type) {
+      case dfa::Program::EdgeType::Epsilon:
+        stack.push_back(Path {edge.node, NoClass, path.tags});
+        if (edge.value != dfa::Program::NoTag) {
+          stack.back().tags.push_back(edge.value);
+        }
+        break;
+
+      case dfa::Program::EdgeType::Assertion:
+        if (program.testAssertion(static_cast<ast::AssertionType>(edge.value), before, after)) {
+          stack.push_back(Path {edge.node, NoClass, path.tags});
+        }
+        break;
+
+      case dfa::Program::EdgeType::Transition:
+        stack.push_back(Path {edge.node, edge.value, path.tags});
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+} // end namespace
+
+OnePassPtr OnePass::compile(const dfa::ProgramPtr &program, size_t stateLimit)
+{
+  assert(program != nullptr);
+  assert(program->getDirection() == dfa::Direction::Forward);
+
+  std::shared_ptr<OnePass> onePass(new OnePass());
+  onePass->_program = program;
+  onePass->_stride = program->getClassCount();
+  onePass->_tagCount = program->getTagCount();
+
+  // A state is a node entered after a code unit of a given type, which is
+  // what the assertions at its closure look at.
+  std::vector<std::pair<uint32_t, dfa::CharType>> states;
+  std::vector<uint32_t> stateMap(program->getNodes().size() * dfa::CharTypeCount, _DeadState);
+
+  auto intern = [&](uint32_t node, dfa::CharType type) -> uint32_t {
+    uint32_t &state = stateMap[node * dfa::CharTypeCount + static_cast<size_t>(type)];
+    if (state == _DeadState && states.size() < stateLimit) {
+      state = static_cast<uint32_t>(states.size());
+      states.push_back(std::make_pair(node, type));
+    }
+    return state;
+  };
+
+  for (size_t i = 0; i < dfa::CharTypeCount; ++i) {
+    onePass->_startStates[i] = intern(program->getStart(), static_cast<dfa::CharType>(i));
+    if (onePass->_startStates[i] == _DeadState) {
+      return nullptr;
+    }
+  }
+
+  std::vector<Path> paths;
+  std::vector<Action> &transitions = onePass->_transitions;
+  std::vector<Action> &accepts = onePass->_accepts;
+  std::vector<uint32_t> &tags = onePass->_tags;
+
+  for (size_t state = 0; state < states.size(); ++state) {
+    transitions.resize(transitions.size() + onePass->_stride, Action {_DeadState, 0, 0});
+    accepts.resize(accepts.size() + dfa::CharTypeCount, Action {_DeadState, 0, 0});
+
+    for (size_t i = 0; i < dfa::CharTypeCount; ++i) {
+      dfa::CharType after = static_cast<dfa::CharType>(i);
+      if (!collect_paths(*program, states[state].first, states[state].second, after, paths)) {
+        return nullptr;
+      }
+
+      for (auto &path: paths) {
+        uint32_t tagBegin = static_cast<uint32_t>(tags.size());
+        tags.insert(tags.end(), path.tags.begin(), path.tags.end());
+        uint32_t tagEnd = static_cast<uint32_t>(tags.size());
+
+        if (path.classSet == NoClass) {
+          Action &accept = accepts[state * dfa::CharTypeCount + i];
+          if (accept.next != _DeadState) {
+            return nullptr;
+          }
+          accept = Action {_Accept, tagBegin, tagEnd};
+          continue;
+        }
+
+        for (size_t cls = 0; cls < onePass->_stride; ++cls) {
+          if (program->getClassType(cls) != after || !program->testClass(path.classSet, cls)) {
+            continue;
+          }
+
+          Action &transition = transitions[state * onePass->_stride + cls];
+          if (transition.next != _DeadState) {
+            return nullptr;
+          }
+
+          transition = Action {intern(path.node, after), tagBegin, tagEnd};
+          if (transition.next == _DeadState) {
+            return nullptr;
+          }
+        }
+      }
+    }
+  }
+
+  onePass->_stateCount = states.size();
+  return onePass;
+}
+
+bool OnePass::match(const exec::Input &input,
+                    size_t inputStartIndex,
+                    exec::Output &output,
+                    exec::Meter &meter)
+{
+  assert(inputStartIndex <= input.length);
+
+  const uint16_t *text = input.text;
+  size_t length = input.length;
+
+  bool matched = false;
+  size_t matchEnd = 0;
+
+  _registers.assign(_tagCount, exec::Range::NotFound);
+
+  dfa::CharType before = inputStartIndex > 0 ? dfa::get_char_type(text[inputStartIndex - 1])
+                                             : dfa::CharType::Edge;
+  uint32_t state = _startStates[static_cast<size_t>(before)];
+
+  size_t current = inputStartIndex;
+  for ( ; current < length; ++current) {
+    if (__builtin_expect(!meter.step(), false)) {
+      return false;
+    }
+
+    size_t cls = _program->getClass(text[current]);
+
+    const Action &accept = _accepts[state * dfa::CharTypeCount +
+                                    static_cast<size_t>(_program->getClassType(cls))];
+    if (accept.next == _Accept) {
+      matched = true;
+      matchEnd = current;
+      _matchRegisters = _registers;
+      _apply(accept, current, _matchRegisters);
+    }
+
+    const Action &transition = _transitions[state * _stride + cls];
+    if (transition.next == _DeadState) {
+      break;
+    }
+
+    _apply(transition, current, _registers);
+    state = transition.next;
+  }
+
+  if (current == length) {
+    const Action &accept = _accepts[state * dfa::CharTypeCount +
+                                    static_cast<size_t>(dfa::CharType::Edge)];
+    if (accept.next == _Accept) {
+      matched = true;
+      matchEnd = current;
+      _matchRegisters = _registers;
+      _apply(accept, current, _matchRegisters);
+    }
+  }
+
+  if (!matched) {
+    return false;
+  }
+
+  output.captures[0].position = inputStartIndex;
+  output.captures[0].length = matchEnd - inputStartIndex;
+
+  for (size_t i = 1; i < output.captures.size() && 2 * i + 1 < _tagCount; ++i) {
+    size_t begin = _matchRegisters[2 * i];
+    size_t end = _matchRegisters[2 * i + 1];
+    if (begin != exec::Range::NotFound) {
+      output.captures[i].position = begin;
+      if (end != exec::Range::NotFound) {
+        assert(end >= begin);
+        output.captures[i].length = end - begin;
+      }
+    }
+  }
+
+  return true;
+}
+
+} // end namespace onepass
+} // end namespace jscre
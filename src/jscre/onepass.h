@@ -0,0 +1,111 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_onepass_h__
+#define __jscre_onepass_h__
+
+#include "dfa.h"
+#include "exec.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace jscre {
+namespace onepass {
+
+class OnePass;
+typedef std::shared_ptr<OnePass> OnePassPtr;
+
+/*
+ * A matcher for one-pass programs: wherever the match is, the next code
+ * unit (and the assertions around it) leaves at most one way to go on, and
+ * at most one way to accept.  Such a program runs as a single thread over
+ * a fully built transition table, setting the capture tags directly.
+ *
+ * compile() returns nullptr for programs that are not one-pass, or whose
+ * table would have more than stateLimit states.  Like dfa::DFA, a OnePass
+ * holds scratch registers and must not be shared between threads.
+ */
+class OnePass {
+public:
+  static OnePassPtr compile(const dfa::ProgramPtr &program,
+                            size_t stateLimit = DefaultStateLimit);
+
+  OnePass(const OnePass &) = delete;
+  OnePass &operator=(const OnePass &) = delete;
+
+  const dfa::ProgramPtr &getProgram() const { return _program; }
+
+  bool match(const exec::Input &input,
+             size_t inputStartIndex,
+             exec::Output &output,
+             exec::Meter &meter);
+
+  size_t getStateCount() const { return _stateCount; }
+
+  static constexpr size_t DefaultStateLimit = 1024;
+
+private:
+  OnePass() {}
+
+  /*
+   * Taking an action sets the tags in _tags[tagBegin, tagEnd) to the
+   * current position and moves to next, which is _DeadState for a
+   * transition that is not there and _Accept for an accepting action.
+   */
+  struct Action {
+    uint32_t next;
+    uint32_t tagBegin;
+    uint32_t tagEnd;
+  };
+
+  static constexpr uint32_t _DeadState = UINT32_MAX;
+  static constexpr uint32_t _Accept = UINT32_MAX - 1;
+
+  void _apply(const Action &action, size_t position, std::vector<size_t> &registers) const
+  {
+    for (uint32_t i = action.tagBegin; i < action.tagEnd; ++i) {
+      registers[_tags[i]] = position;
+    }
+  }
+
+  dfa::ProgramPtr _program;
+  size_t _stride;
+  size_t _tagCount;
+  size_t _stateCount;
+
+  uint32_t _startStates[dfa::CharTypeCount];
+  std::vector<Action> _transitions;
+  std::vector<Action> _accepts;
+  std::vector<uint32_t> _tags;
+
+  std::vector<size_t> _registers;
+  std::vector<size_t> _matchRegisters;
+};
+
+} // end namespace onepass
+} // end namespace jscre
+
+#endif /* __jscre_onepass_h__ */
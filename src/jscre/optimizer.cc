@@ -0,0 +1,348 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "optimizer.h"
+#include <assert.h>
+
+namespace jscre {
+namespace optimizer {
+
+namespace {
+
+bool is_single_character(const ast::ExprPtr &expr)
+{
+  if (expr->getType() != ast::ExprType::CharacterClass) {
+    return false;
+  }
+
+  const ast::CharacterClassExpr *cc = static_cast<const ast::CharacterClassExpr *>(expr.get());
+  if (cc->isInverse() || cc->getRanges().size() != 1) {
+    return false;
+  }
+
+  const ast::CharacterRange &range = cc->getRanges().front();
+  // '\0' never matches (it terminates the input), so it is kept as a class.
+  return range.first == range.second && range.first != '\0';
+}
+
+bool is_plain_character_class(const ast::ExprPtr &expr)
+{
+  return expr->getType() == ast::ExprType::CharacterClass &&
+         !static_cast<const ast::CharacterClassExpr *>(expr.get())->isInverse();
+}
+
+bool equals(const ast::ExprPtr &lhs, const ast::ExprPtr &rhs)
+{
+  if (lhs == rhs) {
+    return true;
+  }
+
+  if (lhs->getType() != rhs->getType()) {
+    return false;
+  }
+
+  switch (lhs->getType()) {
+  case ast::ExprType::CharacterClass: {
+      const ast::CharacterClassExpr *l = static_cast<const ast::CharacterClassExpr *>(lhs.get());
+      const ast::CharacterClassExpr *r = static_cast<const ast::CharacterClassExpr *>(rhs.get());
+      return l->isInverse() == r->isInverse() && l->getRanges() == r->getRanges();
+    }
+
+  case ast::ExprType::Assertion: {
+      const ast::AssertionExpr *l = static_cast<const ast::AssertionExpr *>(lhs.get());
+      const ast::AssertionExpr *r = static_cast<const ast::AssertionExpr *>(rhs.get());
+      return l->getAssertionType() != ast::AssertionType::LookAhead &&
+             l->getAssertionType() == r->getAssertionType();
+    }
+
+  default:
+    return false;
+  }
+}
+
+/*
+ * Appends the sequence of items matched by `expr` when it appears in a
+ * concatenation: concatenations and literals are spliced in, empty
+ * expressions vanish.
+ */
+void append_items(const ast::ExprPtr &expr, ast::ExprVector &items)
+{
+  switch (expr->getType()) {
+  case ast::ExprType::Concatenation:
+    for (auto &subExpr: static_cast<ast::ConcatenationExpr *>(expr.get())->getSubExprs()) {
+      append_items(subExpr, items);
+    }
+    break;
+
+  case ast::ExprType::Literal: {
+      const ast::ExprVector &characters = static_cast<ast::LiteralExpr *>(expr.get())->getCharacters();
+      items.insert(items.end(), characters.begin(), characters.end());
+    }
+    break;
+
+  case ast::ExprType::Empty:
+    break;
+
+  default:
+    items.push_back(expr);
+    break;
+  }
+}
+
+ast::ExprPtr make_concatenation(const ast::ExprVector &items)
+{
+  ast::ExprVector subExprs;
+
+  for (size_t i = 0; i < items.size(); ) {
+    size_t j = i;
+    while (j < items.size() && is_single_character(items[j])) {
+      ++j;
+    }
+
+    if (j - i >= 2) {
+      ast::ExprVector characters(items.begin() + i, items.begin() + j);
+      subExprs.push_back(std::make_shared<ast::LiteralExpr>(characters));
+      i = j;
+    }
+    else {
+      subExprs.push_back(items[i]);
+      ++i;
+    }
+  }
+
+  if (subExprs.empty()) {
+    return std::make_shared<ast::EmptyExpr>();
+  }
+  else if (subExprs.size() == 1) {
+    return subExprs.front();
+  }
+
+  return std::make_shared<ast::ConcatenationExpr>(subExprs);
+}
+
+ast::ExprPtr make_disjunction(const ast::ExprVector &alternatives)
+{
+  ast::ExprVector factored;
+  std::vector<ast::ExprVector> items(alternatives.size());
+  for (size_t i = 0; i < alternatives.size(); ++i) {
+    append_items(alternatives[i], items[i]);
+  }
+
+  for (size_t i = 0; i < alternatives.size(); ) {
+    size_t j = i + 1;
+    if (!items[i].empty()) {
+      while (j < alternatives.size() &&
+             !items[j].empty() &&
+             equals(items[i].front(), items[j].front())) {
+        ++j;
+      }
+    }
+
+    if (j - i < 2) {
+      factored.push_back(alternatives[i]);
+      ++i;
+      continue;
+    }
+
+    size_t prefixLength = 1;
+    while (true) {
+      bool common = true;
+      for (size_t k = i; k < j && common; ++k) {
+        common = prefixLength < items[k].size() &&
+                 equals(items[i][prefixLength], items[k][prefixLength]);
+      }
+
+      if (!common) {
+        break;
+      }
+      ++prefixLength;
+    }
+
+    ast::ExprVector suffixes;
+    for (size_t k = i; k < j; ++k) {
+      ast::ExprVector suffix(items[k].begin() + prefixLength, items[k].end());
+      suffixes.push_back(make_concatenation(suffix));
+    }
+
+    ast::ExprVector prefix(items[i].begin(), items[i].begin() + prefixLength);
+    append_items(make_disjunction(suffixes), prefix);
+    factored.push_back(make_concatenation(prefix));
+    i = j;
+  }
+
+  ast::ExprVector merged;
+  for (auto &alternative: factored) {
+    if (!merged.empty() &&
+        is_plain_character_class(merged.back()) &&
+        is_plain_character_class(alternative)) {
+      ast::CharacterRangeVector ranges = static_cast<ast::CharacterClassExpr *>(merged.back().get())->getRanges();
+      const ast::CharacterRangeVector &moreRanges = static_cast<ast::CharacterClassExpr *>(alternative.get())->getRanges();
+      ranges.insert(ranges.end(), moreRanges.begin(), moreRanges.end());
+      merged.back() = std::make_shared<ast::CharacterClassExpr>(ranges);
+    }
+    else {
+      merged.push_back(alternative);
+    }
+  }
+
+  if (merged.size() == 1) {
+    return merged.front();
+  }
+
+  return std::make_shared<ast::DisjunctionExpr>(merged);
+}
+
+class OptimizeRecursiveExprVisitor : public ast::RecursiveExprVisitor {
+public:
+  ast::ExprPtr optimize(const ast::ExprPtr &expr);
+
+  virtual void visitConcatenationExpr(ast::ConcatenationExpr *expr);
+  virtual void visitDisjunctionExpr(ast::DisjunctionExpr *expr);
+  virtual void visitEmptyExpr(ast::EmptyExpr *expr);
+  virtual void visitCharacterClassExpr(ast::CharacterClassExpr *expr);
+  virtual void visitAssertionExpr(ast::AssertionExpr *expr);
+  virtual void visitLookAheadAssertionExpr(ast::LookAheadAssertionExpr *expr);
+  virtual void visitQuantificationExpr(ast::QuantificationExpr *expr);
+  virtual void visitGroupExpr(ast::GroupExpr *expr);
+  virtual void visitBackreferenceExpr(ast::BackreferenceExpr *expr);
+  virtual void visitLiteralExpr(ast::LiteralExpr *expr);
+
+private:
+  ast::ExprVector _exprStack;
+  ast::ExprPtr _result;
+};
+
+ast::ExprPtr OptimizeRecursiveExprVisitor::optimize(const ast::ExprPtr &expr)
+{
+  _exprStack.push_back(expr);
+  traverseExpr(expr);
+  _exprStack.pop_back();
+
+  assert(_result != nullptr);
+  ast::ExprPtr result = std::move(_result);
+  _result = nullptr;
+  return result;
+}
+
+void OptimizeRecursiveExprVisitor::visitConcatenationExpr(ast::ConcatenationExpr *expr)
+{
+  ast::ExprVector items;
+  for (auto &subExpr: expr->getSubExprs()) {
+    append_items(optimize(subExpr), items);
+  }
+
+  _result = make_concatenation(items);
+}
+
+void OptimizeRecursiveExprVisitor::visitDisjunctionExpr(ast::DisjunctionExpr *expr)
+{
+  ast::ExprVector alternatives;
+  for (auto &subExpr: expr->getSubExprs()) {
+    ast::ExprPtr alternative = optimize(subExpr);
+    if (alternative->getType() == ast::ExprType::Disjunction) {
+      const ast::ExprVector &subAlternatives = static_cast<ast::DisjunctionExpr *>(alternative.get())->getSubExprs();
+      alternatives.insert(alternatives.end(), subAlternatives.begin(), subAlternatives.end());
+    }
+    else {
+      alternatives.push_back(alternative);
+    }
+  }
+
+  _result = make_disjunction(alternatives);
+}
+
+void OptimizeRecursiveExprVisitor::visitEmptyExpr(ast::EmptyExpr *expr)
+{
+  _result = _exprStack.back();
+}
+
+void OptimizeRecursiveExprVisitor::visitCharacterClassExpr(ast::CharacterClassExpr *expr)
+{
+  _result = _exprStack.back();
+}
+
+void OptimizeRecursiveExprVisitor::visitAssertionExpr(ast::AssertionExpr *expr)
+{
+  _result = _exprStack.back();
+}
+
+void OptimizeRecursiveExprVisitor::visitLookAheadAssertionExpr(ast::LookAheadAssertionExpr *expr)
+{
+  ast::ExprPtr subExpr = optimize(expr->getSubExpr());
+  if (subExpr == expr->getSubExpr()) {
+    _result = _exprStack.back();
+  }
+  else {
+    _result = std::make_shared<ast::LookAheadAssertionExpr>(subExpr, expr->isInverse());
+  }
+}
+
+void OptimizeRecursiveExprVisitor::visitQuantificationExpr(ast::QuantificationExpr *expr)
+{
+  ast::ExprPtr subExpr = optimize(expr->getSubExpr());
+  if (subExpr == expr->getSubExpr()) {
+    _result = _exprStack.back();
+  }
+  else {
+    _result = std::make_shared<ast::QuantificationExpr>(subExpr,
+                                                        expr->getMinimum(),
+                                                        expr->getMaximum(),
+                                                        expr->isGreedy());
+  }
+}
+
+void OptimizeRecursiveExprVisitor::visitGroupExpr(ast::GroupExpr *expr)
+{
+  ast::ExprPtr subExpr = optimize(expr->getSubExpr());
+  if (!expr->shouldCapture()) {
+    _result = subExpr;
+  }
+  else if (subExpr == expr->getSubExpr()) {
+    _result = _exprStack.back();
+  }
+  else {
+    _result = std::make_shared<ast::GroupExpr>(subExpr, expr->getStorageIndex());
+  }
+}
+
+void OptimizeRecursiveExprVisitor::visitBackreferenceExpr(ast::BackreferenceExpr *expr)
+{
+  _result = _exprStack.back();
+}
+
+void OptimizeRecursiveExprVisitor::visitLiteralExpr(ast::LiteralExpr *expr)
+{
+  _result = _exprStack.back();
+}
+
+} // end namespace
+
+ast::ExprPtr optimize(const ast::ExprPtr &expr)
+{
+  OptimizeRecursiveExprVisitor visitor;
+  return visitor.optimize(expr);
+}
+
+} // end namespace optimizer
+} // end namespace jscre
@@ -0,0 +1,50 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_optimizer_h__
+#define __jscre_optimizer_h__
+
+#include "ast.h"
+
+namespace jscre {
+namespace optimizer {
+
+/*
+ * Rewrites a parsed expression into an equivalent but smaller one:
+ *
+ *   - non-capturing groups are dropped,
+ *   - nested concatenations and disjunctions are flattened,
+ *   - runs of single characters are merged into literals,
+ *   - common prefixes of adjacent alternatives are factored out,
+ *   - adjacent single-class alternatives are merged into one class.
+ *
+ * Alternatives are never reordered, so the priority among paths (and thus
+ * the captures reported for a match) is preserved.
+ */
+ast::ExprPtr optimize(const ast::ExprPtr &expr);
+
+} // end namespace optimizer
+} // end namespace jscre
+
+#endif /* __jscre_optimizer_h__ */
@@ -43,8 +43,8 @@ const char *invalid_hex_escape_seq = "Invalid hexidecimal escape sequence.";
 const char *invalid_uni_escape_seq = "Invalid unicode escape sequence.";
 const char *invalid_char_class_range = "Invalid character class range.";
 const char *invalid_quantif_range = "Invalid quantification range.";
-const char *non_greedy_not_support = "Non-greedy quantification is not supported.";
-const char *backref_not_support = "Backreference is not supported.";
+const char *undefined_backref = "Backreference to an undefined group.";
+const char *backref_in_lookahead = "Backreference in look-ahead assertion is not supported.";
 
 } // end namespace errmsg
 } // end namespace
@@ -70,6 +70,9 @@ ast::ExprPtr Parser::parse()
   _error = nullptr;
   _current = 0;
   _storageIndex = 0;
+  _lookAheadDepth = 0;
+  _backreferenceIndex = 0;
+  _backreferencePosition = 0;
 
   ast::ExprPtr expr = _parsePattern();
   assert(expr != nullptr || _error != nullptr);
@@ -78,6 +81,9 @@ ast::ExprPtr Parser::parse()
     if (_current < _input->length) {
       _makeError(errmsg::end_of_expr_expected);
     }
+    else if (_backreferenceIndex > _storageIndex) {
+      _makeError(errmsg::undefined_backref, _backreferencePosition);
+    }
   }
 
   if (_error == nullptr) {
@@ -102,6 +108,7 @@ ast::ExprPtr Parser::_parsePattern()
  */
 ast::ExprPtr Parser::_parseDisjunction()
 {
+  size_t position = _current;
   ast::ExprPtr expr;
   do {
     ast::ExprPtr subExpr = _parseAlternative();
@@ -122,6 +129,7 @@ ast::ExprPtr Parser::_parseDisjunction()
   } while (_input->text[_current++] == '|');
 
   --_current;
+  expr->setSpan(position, _current - position);
   return expr;
 }
 
@@ -132,6 +140,7 @@ ast::ExprPtr Parser::_parseDisjunction()
  */
 ast::ExprPtr Parser::_parseAlternative()
 {
+  size_t position = _current;
   ast::ExprPtr expr;
   while (true) {
     switch (_input->text[_current]) {
@@ -139,18 +148,21 @@ ast::ExprPtr Parser::_parseAlternative()
     case '|':
     case ')':
       if (expr == nullptr) {
-        return std::make_shared<ast::EmptyExpr>();
+        expr = std::make_shared<ast::EmptyExpr>();
       }
+      expr->setSpan(position, _current - position);
       return expr;
 
     default:
       break;
     }
 
+    size_t termPosition = _current;
     ast::ExprPtr subExpr = _parseTerm();
     if (subExpr == nullptr) {
       return nullptr;
     }
+    subExpr->setSpan(termPosition, _current - termPosition);
 
     if (expr == nullptr) {
       expr = subExpr;
@@ -192,6 +204,7 @@ ast::ExprPtr Parser::_parseAlternative()
  */
 ast::ExprPtr Parser::_parseTerm()
 {
+  size_t position = _current;
   switch (_input->text[_current++]) {
   case '^':
     return std::make_shared<ast::AssertionExpr>(ast::AssertionType::BeginOfLine);
@@ -242,6 +255,7 @@ ast::ExprPtr Parser::_parseTerm()
   if (expr == nullptr) {
     return nullptr;
   }
+  expr->setSpan(position, _current - position);
 
   size_t minimum = 0;
   size_t maximum = 0;
@@ -312,11 +326,6 @@ ast::ExprPtr Parser::_parseTerm()
     return nullptr;
   }
 
-  if (!greedy) {
-    _makeError(errmsg::non_greedy_not_support);
-    return nullptr;
-  }
-
   return std::make_shared<ast::QuantificationExpr>(expr, minimum, maximum, greedy);
 }
 
@@ -327,7 +336,9 @@ ast::ExprPtr Parser::_parseLookAheadAssertion()
 
   bool inverse = _input->text[_current++] == '!';
 
+  ++_lookAheadDepth;
   ast::ExprPtr subExpr = _parseDisjunction();
+  --_lookAheadDepth;
   if (subExpr == nullptr) {
     return nullptr;
   }
@@ -426,9 +437,7 @@ ast::ExprPtr Parser::_parseAtomEscape()
   case '7':
   case '8':
   case '9':
-    _makeError(errmsg::backref_not_support);
-    return nullptr;
-    //return _parseBackreference();
+    return _parseBackreference();
 
   case 'f':
   case 'n':
@@ -823,11 +832,24 @@ ast::ExprPtr Parser::_parseBackreference()
   assert(_input->text[_current] >= '0' &&
          _input->text[_current] <= '9');
 
+  if (_lookAheadDepth > 0) {
+    _makeError(errmsg::backref_in_lookahead);
+    return nullptr;
+  }
+
+  size_t position = _current - 1;
   size_t index = _scanDecimalDigits();
   if (_error != nullptr) {
     return nullptr;
   }
 
+  // Groups may be referred to before they are opened, so whether the
+  // group exists is only known once the whole pattern has been parsed.
+  if (index > _backreferenceIndex) {
+    _backreferenceIndex = index;
+    _backreferencePosition = position;
+  }
+
   return std::make_shared<ast::BackreferenceExpr>(index);
 }
 
@@ -62,7 +62,10 @@ public:
   explicit Parser(const InputPtr &input)
     : _input(input),
       _current(0),
-      _storageIndex(0) {}
+      _storageIndex(0),
+      _lookAheadDepth(0),
+      _backreferenceIndex(0),
+      _backreferencePosition(0) {}
 
   Parser(const Parser &) = delete;
   Parser &operator=(const Parser &) = delete;
@@ -106,6 +109,9 @@ private:
 
   size_t _current;
   size_t _storageIndex;
+  size_t _lookAheadDepth;
+  size_t _backreferenceIndex;
+  size_t _backreferencePosition;
 };
 
 } // end namespace parser
@@ -0,0 +1,135 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "prefilter.h"
+#include "latin1.h"
+#include <assert.h>
+#include <string.h>
+
+namespace jscre {
+namespace prefilter {
+
+Prefilter::Prefilter()
+  : _kind(Kind::None),
+    _needleCount(0)
+{
+}
+
+Prefilter::Prefilter(const ast::CharacterRangeVector &ranges)
+  : _kind(Kind::None),
+    _needleCount(0)
+{
+  if (ranges.empty()) {
+    return;
+  }
+
+  size_t count = 0;
+  for (auto &range: ranges) {
+    count += range.second - range.first + 1;
+  }
+
+  if (count <= utf16::MaxNeedleCount) {
+    _kind = Kind::Needles;
+    for (auto &range: ranges) {
+      for (uint32_t ch = range.first; ch <= range.second; ++ch) {
+        _needles[_needleCount++] = static_cast<uint16_t>(ch);
+      }
+    }
+  }
+  else if (ranges.back().second < 0x80) {
+    _kind = Kind::NibbleTable;
+    memset(_table, 0, sizeof(_table));
+    for (auto &range: ranges) {
+      for (uint16_t ch = range.first; ch <= range.second; ++ch) {
+        _table[ch & 0xf] |= 1 << (ch >> 4);
+      }
+    }
+  }
+  else if (ranges.size() <= _MaxRangeCount &&
+           !(ranges.front().first == 0 && ranges.back().second == 0xffff)) {
+    _kind = Kind::Ranges;
+    _ranges = ranges;
+  }
+}
+
+size_t Prefilter::find(const uint16_t *text, size_t length, size_t from) const
+{
+  assert(from <= length);
+
+  switch (_kind) {
+  case Kind::None:
+    return from;
+
+  case Kind::Needles:
+    return from + utf16::find_any(text + from, length - from, _needles, _needleCount);
+
+  case Kind::NibbleTable:
+    return from + utf16::find_in_table(text + from, length - from, _table);
+
+  case Kind::Ranges:
+    return _findInRanges(text, length, from);
+  }
+
+  return from;
+}
+
+size_t Prefilter::find(const uint8_t *text, size_t length, size_t from) const
+{
+  assert(from <= length);
+
+  switch (_kind) {
+  case Kind::None:
+    return from;
+
+  case Kind::Needles:
+    return from + latin1::find_any(text + from, length - from, _needles, _needleCount);
+
+  case Kind::NibbleTable:
+    return from + latin1::find_in_table(text + from, length - from, _table);
+
+  case Kind::Ranges:
+    return _findInRanges(text, length, from);
+  }
+
+  return from;
+}
+
+template <typename CharT>
+size_t Prefilter::_findInRanges(const CharT *text, size_t length, size_t from) const
+{
+  for ( ; from < length; ++from) {
+    for (auto &range: _ranges) {
+      if (text[from] < range.first) {
+        break;
+      }
+      else if (text[from] <= range.second) {
+        return from;
+      }
+    }
+  }
+  return length;
+}
+
+} // end namespace prefilter
+} // end namespace jscre
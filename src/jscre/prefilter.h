@@ -0,0 +1,79 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_prefilter_h__
+#define __jscre_prefilter_h__
+
+#include "ast.h"
+#include "utf16_string.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jscre {
+namespace prefilter {
+
+/*
+ * Skips start positions whose code unit cannot begin a match.  The scan is
+ * picked from the shape of the set: a vectorized needle scan for up to
+ * utf16::MaxNeedleCount code units, a nibble-table scan for other ASCII
+ * sets, and a plain range test otherwise.
+ */
+class Prefilter {
+public:
+  Prefilter();
+  explicit Prefilter(const ast::CharacterRangeVector &ranges);
+
+  bool isEnabled() const { return _kind != Kind::None; }
+
+  // Returns the first position >= from whose code unit is in the set, or
+  // length if there is none.
+  size_t find(const uint16_t *text, size_t length, size_t from) const;
+
+  // The same on Latin-1 text.
+  size_t find(const uint8_t *text, size_t length, size_t from) const;
+
+private:
+  enum class Kind {
+    None,
+    Needles,
+    NibbleTable,
+    Ranges
+  };
+
+  static constexpr size_t _MaxRangeCount = 8;
+
+  template <typename CharT>
+  size_t _findInRanges(const CharT *text, size_t length, size_t from) const;
+
+  Kind _kind;
+  size_t _needleCount;
+  uint16_t _needles[utf16::MaxNeedleCount];
+  utf16::NibbleTable _table;
+  ast::CharacterRangeVector _ranges;
+};
+
+} // end namespace prefilter
+} // end namespace jscre
+
+#endif /* __jscre_prefilter_h__ */
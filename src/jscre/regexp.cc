@@ -24,13 +24,43 @@
 
 #include "regexp.h"
 #include "nfa.h"
+#include "optimizer.h"
+#include "utf16_case.h"
+#include "utf16_string.h"
+#include "utf8.h"
+#include "latin1.h"
 #include <assert.h>
+#include <algorithm>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 namespace jscre {
 namespace regexp {
 
+namespace {
+namespace errmsg {
+
+const char *pattern_too_large = "Pattern is too large.";
+
+} // end namespace errmsg
+
+// Whether a match of program can take in a line feed.
+bool spans_lines(const dfa::ProgramPtr &program)
+{
+  size_t lineFeed = program->getClass('\n');
+  for (auto &node: program->getNodes()) {
+    for (auto &edge: node.edges) {
+      if (edge.type == dfa::Program::EdgeType::Transition && program->testClass(edge.value, lineFeed)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+} // end namespace
+
 Match::Match(const exec::InputPtr &input,
              const exec::OutputPtr &output)
   : _input(input),
@@ -125,24 +155,113 @@ RegExp::RegExp(const uint16_t *pattern,
                size_t patternLength,
                bool global,
                bool multiline,
-               bool ignoreCase)
+               bool ignoreCase,
+               bool leftmostFirst,
+               const nfa::Limits &limits)
   : _global(global),
     _multiline(multiline),
     _ignoreCase(ignoreCase),
+    _leftmostFirst(leftmostFirst),
     _lastIndex(0),
-    _pattern(std::make_shared<parser::Input>(pattern, patternLength))
+    _pattern(std::make_shared<parser::Input>(pattern, patternLength)),
+    _engines(),
+    _spansLines(true),
+    _utf8Programs(),
+    _latin1Programs()
 {
   parser::Parser parser(_pattern);
   _expr = parser.parse();
   _error = parser.getError();
 
   if (_expr != nullptr) {
-    _package.nfa = nfa::construct_nfa(_expr, _package.subNFAs);
+    // Hazards are looked for before optimizing, while the expression still
+    // knows where its parts are in the pattern.
+    _hazards = analyzer::analyze_hazards(_expr, _ignoreCase, limits.unrollLimit);
+    _expr = optimizer::optimize(_expr);
+    _package.nfa = nfa::construct_nfa(_expr, _package.subNFAs, limits);
+    if (_package.nfa == nullptr) {
+      _error = std::make_shared<parser::Error>(errmsg::pattern_too_large, 0);
+      _expr = nullptr;
+    }
+  }
+
+  _anchors.begin = false;
+  _anchors.end = false;
+  _lengths.minimum = 0;
+  _lengths.maximum = analyzer::Lengths::Infinite;
+  _search = Strategy::Search::Scan;
+
+  if (_expr != nullptr && _expr->getType() == ast::ExprType::Literal &&
+      !static_cast<const ast::LiteralExpr *>(_expr.get())->getText().empty()) {
+    // The input is lowercased under ignoreCase, so the literal is folded the
+    // way utf16::equal_ignoring_case folds it.
+    _literal = static_cast<const ast::LiteralExpr *>(_expr.get())->getText();
+    if (_ignoreCase) {
+      for (auto &ch: _literal) {
+        if (ch >= 'A' && ch <= 'Z') {
+          ch += 'a' - 'A';
+        }
+      }
+    }
+
+    _lengths.minimum = _literal.size();
+    _lengths.maximum = _literal.size();
+    _search = Strategy::Search::Literal;
+  }
+  else if (_expr != nullptr) {
+    ast::CharacterRangeVector firstCharacters;
+    if (analyzer::analyze_first_characters(_expr, _ignoreCase, firstCharacters)) {
+      _prefilter = prefilter::Prefilter(firstCharacters);
+    }
+
+    _anchors = analyzer::analyze_anchors(_expr);
+    _lengths = analyzer::analyze_lengths(_expr);
+
+    dfa::ProgramPtr forward = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                                    dfa::Direction::Forward);
+    if (forward != nullptr) {
+      // Both capture engines report the longest match; under leftmost-first
+      // the backtracker runs instead, and the DFAs only look for where a
+      // match starts, which does not depend on the semantics.
+      if (!_leftmostFirst) {
+        _engines.onePass = onepass::OnePass::compile(forward);
+        if (_engines.onePass == nullptr) {
+          _engines.tdfa = std::make_shared<tdfa::TDFA>(forward);
+        }
+      }
+
+      if (!_anchors.begin) {
+        dfa::ProgramPtr reverse = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                                        dfa::Direction::Reverse);
+        assert(reverse != nullptr);
+        _engines.forwardDFA = std::make_shared<dfa::DFA>(forward, false);
+        _engines.anchoredDFA = std::make_shared<dfa::DFA>(forward);
+        _engines.reverseDFA = std::make_shared<dfa::DFA>(reverse);
+      }
+      _spansLines = spans_lines(forward);
+    }
+
+    if (_anchors.begin) {
+      _search = Strategy::Search::Anchored;
+    }
+    else if (_engines.reverseDFA != nullptr) {
+      _search = Strategy::Search::DFA;
+    }
+    else if (_prefilter.isEnabled()) {
+      _search = Strategy::Search::Prefilter;
+    }
   }
 
   _package.storageCount = parser.getStorageCount();
   _package.multiline = _multiline;
   _package.ignoreCase = _ignoreCase;
+  _package.leftmostFirst = _leftmostFirst;
+
+  if (_package.nfa != nullptr) {
+    exec::prepare(_package);
+  }
+
+  _spareEngines.push_back(_engines);
 }
 
 const uint16_t *RegExp::getPattern() const
@@ -197,18 +316,292 @@ std::string RegExp::toString() const
   return os.str();
 }
 
+Strategy RegExp::getStrategy(size_t textLength, bool captures) const
+{
+  Strategy strategy;
+  strategy.search = _search;
+
+  if (!_literal.empty()) {
+    strategy.engine = Strategy::Engine::Literal;
+  }
+  else if ((!captures || _package.storageCount == 0) && !_leftmostFirst && _engines.anchoredDFA != nullptr) {
+    // Without captures the longest match is all there is to find, and the
+    // anchored DFA finds its end.
+    strategy.engine = Strategy::Engine::DFA;
+  }
+  else if (_engines.onePass != nullptr) {
+    strategy.engine = Strategy::Engine::OnePass;
+  }
+  else if (_engines.tdfa != nullptr) {
+    strategy.engine = Strategy::Engine::TaggedDFA;
+  }
+  else if (_package.nfa != nullptr && exec::can_backtrack(_package, textLength)) {
+    strategy.engine = Strategy::Engine::Backtrack;
+  }
+  else {
+    strategy.engine = Strategy::Engine::Exhaustive;
+  }
+
+  return strategy;
+}
+
+Complexity RegExp::analyzeComplexity() const
+{
+  Complexity complexity;
+  complexity.worstCase = Complexity::Class::Linear;
+  complexity.hazards = _hazards;
+  complexity.nfaNodes = 0;
+  complexity.dfaStates = 0;
+
+  if (_package.nfa == nullptr) {
+    return complexity;
+  }
+
+  complexity.nfaNodes = _package.nfa->nodeCount;
+  for (auto &subNFA: _package.subNFAs) {
+    complexity.nfaNodes += subNFA.second->nodeCount;
+  }
+
+  dfa::ProgramPtr forward = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                                  dfa::Direction::Forward);
+  if (forward != nullptr) {
+    dfa::DFA probe(forward, _anchors.begin, dfa::DFA::DefaultStateLimit + 2);
+    complexity.dfaStates = probe.explore(dfa::DFA::DefaultStateLimit);
+  }
+
+  bool ambiguous = false;
+  for (auto &hazard: _hazards) {
+    ambiguous = ambiguous || hazard.kind != analyzer::HazardKind::LargeRepetition;
+  }
+
+  // The backtracker's visited bitset grows with the input, so a pattern
+  // that the longest input there is leaves to the exhaustive search has too
+  // many nodes for it on every long input.
+  if (ambiguous || getStrategy(SIZE_MAX).engine == Strategy::Engine::Exhaustive) {
+    complexity.worstCase = Complexity::Class::Exponential;
+  }
+  else if (!_package.referencedStorages.empty()) {
+    complexity.worstCase = Complexity::Class::Polynomial;
+  }
+  else if (forward == nullptr || complexity.dfaStates > dfa::DFA::DefaultStateLimit) {
+    complexity.worstCase = Complexity::Class::Quadratic;
+  }
+
+  return complexity;
+}
+
 bool RegExp::test(const uint16_t *text, size_t textLength) const
 {
-  return exec(text, textLength) != nullptr;
+  return test(text, textLength, exec::Budget()) == Status::Match;
 }
 
 MatchPtr RegExp::exec(const uint16_t *text, size_t textLength) const
 {
-  assert(text != nullptr);
-  return _exec(std::make_shared<exec::Input>(text, textLength, _ignoreCase));
+  MatchPtr match;
+  exec(text, textLength, exec::Budget(), match);
+  return match;
 }
 
 MatchVector RegExp::execAll(const uint16_t *text, size_t textLength) const
+{
+  MatchVector matches;
+  execAll(text, textLength, exec::Budget(), matches);
+  return std::move(matches);
+}
+
+bool RegExp::testUTF8(const uint8_t *text, size_t textLength) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::UTF8, 0, 1, false, false, false, matches);
+  return !matches.empty();
+}
+
+bool RegExp::execUTF8(const uint8_t *text, size_t textLength, size_t startIndex,
+                      ByteMatch &match, bool utf16Offsets) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::UTF8, startIndex, 1, true, utf16Offsets, false,
+             matches);
+  if (matches.empty()) {
+    return false;
+  }
+
+  match = std::move(matches.front());
+  return true;
+}
+
+ByteMatchVector RegExp::execAllUTF8(const uint8_t *text, size_t textLength, bool utf16Offsets) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::UTF8, 0, _global ? SIZE_MAX : 1, true, utf16Offsets,
+             false, matches);
+  return matches;
+}
+
+bool RegExp::testLatin1(const uint8_t *text, size_t textLength) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::Latin1, 0, 1, false, false, false, matches);
+  return !matches.empty();
+}
+
+bool RegExp::execLatin1(const uint8_t *text, size_t textLength, size_t startIndex,
+                        ByteMatch &match) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::Latin1, startIndex, 1, true, false, false, matches);
+  if (matches.empty()) {
+    return false;
+  }
+
+  match = std::move(matches.front());
+  return true;
+}
+
+ByteMatchVector RegExp::execAllLatin1(const uint8_t *text, size_t textLength) const
+{
+  ByteMatchVector matches;
+  _execBytes(text, textLength, dfa::Encoding::Latin1, 0, _global ? SIZE_MAX : 1, true, false,
+             false, matches);
+  return matches;
+}
+
+size_t RegExp::execWindow(const uint8_t *text, size_t textLength, dfa::Encoding encoding,
+                          size_t startIndex, bool final, ByteMatchVector &matches) const
+{
+  return _execBytes(text, textLength, encoding, startIndex, SIZE_MAX, true, false, !final, matches);
+}
+
+MatchVector RegExp::execAllParallel(const uint16_t *text, size_t textLength,
+                                    size_t threadCount) const
+{
+  size_t sliceCount = std::min(threadCount, textLength / _MinSliceLength);
+  if (!_global || sliceCount < 2 || hasError() || (!_multiline && (_anchors.begin || _anchors.end))) {
+    size_t lastIndex = getLastIndex();
+    MatchVector matches = execAll(text, textLength);
+    setLastIndex(lastIndex);
+    return std::move(matches);
+  }
+
+  assert(text != nullptr);
+  exec::InputPtr input = std::make_shared<exec::Input>(text, textLength, _ignoreCase);
+
+  std::vector<Slice> slices(sliceCount);
+  for (size_t i = 0; i < sliceCount; ++i) {
+    slices[i].begin = textLength / sliceCount * i;
+    slices[i].end = (i + 1 < sliceCount) ? textLength / sliceCount * (i + 1) : textLength;
+  }
+
+  // The first slice is where the global loop starts, so what it finds
+  // there is final; it runs on this thread.
+  EnginesLease engines(*this);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < sliceCount; ++i) {
+    threads.emplace_back([this, &input, &slices, i]() {
+      EnginesLease engines(*this);
+      _scanSlice(input, slices[i], engines.get());
+    });
+  }
+  _scanSlice(input, slices[0], engines.get());
+  for (auto &thread: threads) {
+    thread.join();
+  }
+
+  // Follow the global loop through the slices.  A search from an index
+  // between where a slice's search started and where its match starts
+  // finds that match, and one from past the slice's last search finds
+  // nothing before its end; anywhere else the loop searches itself.
+  MatchVector matches;
+  exec::Meter meter;
+  size_t inputStartIndex = 0;
+
+  for (auto &slice: slices) {
+    size_t next = 0;
+    while (inputStartIndex < slice.end) {
+      while (next < slice.matches.size() && slice.matches[next]->getMatchedIndex() < inputStartIndex) {
+        ++next;
+      }
+
+      MatchPtr match;
+      if (next < slice.matches.size() && slice.searchIndices[next] <= inputStartIndex) {
+        match = std::move(slice.matches[next++]);
+      }
+      else if (next == slice.matches.size() && slice.rest <= inputStartIndex) {
+        break;
+      }
+      else {
+        match = _scan(input, inputStartIndex, slice.end, meter, true, engines.get());
+        if (match == nullptr) {
+          break;
+        }
+      }
+
+      inputStartIndex = match->getMatchedIndex() + match->getMatchedLength();
+      if (match->getMatchedLength() == 0) {
+        ++inputStartIndex;
+      }
+      matches.push_back(std::move(match));
+    }
+
+    inputStartIndex = std::max(inputStartIndex, slice.end);
+  }
+
+  return std::move(matches);
+}
+
+void RegExp::testBatch(const Text *texts, size_t count, uint64_t *bitmap,
+                       size_t threadCount, size_t laneCount) const
+{
+  assert(bitmap != nullptr || count == 0);
+  _execBatch(texts, count, bitmap, nullptr, threadCount, laneCount);
+}
+
+void RegExp::execBatch(const Text *texts, size_t count, exec::Range *ranges,
+                       size_t threadCount, size_t laneCount) const
+{
+  assert(ranges != nullptr || count == 0);
+  _execBatch(texts, count, nullptr, ranges, threadCount, laneCount);
+}
+
+stream::StreamPtr RegExp::createStream(const stream::Stream::Callback &callback) const
+{
+  if (_package.nfa == nullptr || _leftmostFirst) {
+    return nullptr;
+  }
+
+  dfa::ProgramPtr forward = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                                  dfa::Direction::Forward);
+  if (forward == nullptr) {
+    return nullptr;
+  }
+
+  return std::make_shared<stream::Stream>(forward, _ignoreCase, callback);
+}
+
+Status RegExp::test(const uint16_t *text, size_t textLength, const exec::Budget &budget) const
+{
+  assert(text != nullptr);
+  exec::Meter meter(budget);
+  if (_exec(std::make_shared<exec::Input>(text, textLength, _ignoreCase), meter, false) != nullptr) {
+    return Status::Match;
+  }
+  return meter.isAborted() ? Status::Aborted : Status::NoMatch;
+}
+
+Status RegExp::exec(const uint16_t *text, size_t textLength, const exec::Budget &budget,
+                    MatchPtr &match) const
+{
+  assert(text != nullptr);
+  exec::Meter meter(budget);
+  match = _exec(std::make_shared<exec::Input>(text, textLength, _ignoreCase), meter);
+  if (match != nullptr) {
+    return Status::Match;
+  }
+  return meter.isAborted() ? Status::Aborted : Status::NoMatch;
+}
+
+Status RegExp::execAll(const uint16_t *text, size_t textLength, const exec::Budget &budget,
+                       MatchVector &matches) const
 {
   if (_global) {
     setLastIndex(0);
@@ -216,19 +609,28 @@ MatchVector RegExp::execAll(const uint16_t *text, size_t textLength) const
 
   assert(text != nullptr);
   exec::InputPtr input = std::make_shared<exec::Input>(text, textLength, _ignoreCase);
+  exec::Meter meter(budget);
 
-  MatchVector matches;
+  matches.clear();
 
   MatchPtr match;
-  while ((match = std::move(_exec(input))) != nullptr) {
+  while ((match = std::move(_exec(input, meter))) != nullptr) {
+    bool empty = (match->getMatchedLength() == 0);
     matches.push_back(std::move(match));
 
     if (!_global) {
       break;
     }
+
+    if (empty) {
+      setLastIndex(getLastIndex() + 1);
+    }
   }
 
-  return std::move(matches);
+  if (meter.isAborted()) {
+    return Status::Aborted;
+  }
+  return matches.empty() ? Status::NoMatch : Status::Match;
 }
 
 namespace {
@@ -367,9 +769,10 @@ void RegExp::replace(std::function<void (const MatchPtr &match,
   exec::InputPtr inputPtr = std::make_shared<exec::Input>(input, inputLength, _ignoreCase);
 
   std::vector<ReplaceRecord> records;
+  exec::Meter meter;
 
   MatchPtr match;
-  while ((match = std::move(_exec(inputPtr))) != nullptr) {
+  while ((match = std::move(_exec(inputPtr, meter))) != nullptr) {
     ReplaceRecord rec;
     func(match, rec.newSubStr, rec.newSubStrLength);
 
@@ -381,6 +784,10 @@ void RegExp::replace(std::function<void (const MatchPtr &match,
     if (!_global) {
       break;
     }
+
+    if (records.back().matchedLength == 0) {
+      setLastIndex(getLastIndex() + 1);
+    }
   }
 
   outputLength = inputLength;
@@ -414,7 +821,192 @@ void RegExp::replace(std::function<void (const MatchPtr &match,
   memcpy(currentOutput, currentInput, remaining * sizeof(uint16_t));
 }
 
-MatchPtr RegExp::_exec(const exec::InputPtr &input) const
+RegExp::Engines RegExp::_copyEngines() const
+{
+  Engines engines = Engines();
+
+  if (_engines.forwardDFA != nullptr) {
+    engines.forwardDFA = std::make_shared<dfa::DFA>(_engines.forwardDFA->getProgram(), false);
+    engines.anchoredDFA = std::make_shared<dfa::DFA>(_engines.anchoredDFA->getProgram());
+    engines.reverseDFA = std::make_shared<dfa::DFA>(_engines.reverseDFA->getProgram());
+  }
+
+  if (_engines.onePass != nullptr) {
+    engines.onePass = onepass::OnePass::compile(_engines.onePass->getProgram());
+    assert(engines.onePass != nullptr);
+  }
+
+  if (_engines.tdfa != nullptr) {
+    engines.tdfa = std::make_shared<tdfa::TDFA>(_engines.tdfa->getProgram());
+  }
+
+  return engines;
+}
+
+RegExp::Engines RegExp::_takeEngines() const
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_spareEngines.empty()) {
+      Engines engines = std::move(_spareEngines.back());
+      _spareEngines.pop_back();
+      return engines;
+    }
+  }
+
+  return _copyEngines();
+}
+
+void RegExp::_returnEngines(Engines &&engines) const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  _spareEngines.push_back(std::move(engines));
+}
+
+/*
+ * Runs the global loop from slice.begin for as long as it finds matches
+ * starting before slice.end.
+ */
+void RegExp::_scanSlice(const exec::InputPtr &input, Slice &slice, const Engines &engines) const
+{
+  exec::Meter meter;
+  size_t inputStartIndex = slice.begin;
+
+  while (inputStartIndex < slice.end) {
+    slice.rest = inputStartIndex;
+    MatchPtr match = _scan(input, inputStartIndex, slice.end, meter, true, engines);
+    if (match == nullptr) {
+      return;
+    }
+
+    slice.searchIndices.push_back(slice.rest);
+    if (match->getMatchedLength() == 0) {
+      ++inputStartIndex;
+    }
+    slice.matches.push_back(std::move(match));
+  }
+
+  slice.rest = inputStartIndex;
+}
+
+void RegExp::_execBatch(const Text *texts, size_t count, uint64_t *bitmap, exec::Range *ranges,
+                        size_t threadCount, size_t laneCount) const
+{
+  assert(texts != nullptr || count == 0);
+
+  if (hasError()) {
+    for (size_t i = 0; i < count; ++i) {
+      if (bitmap != nullptr) {
+        bitmap[i / 64] &= ~(UINT64_C(1) << (i % 64));
+      }
+      if (ranges != nullptr) {
+        ranges[i] = exec::Range();
+      }
+    }
+    return;
+  }
+
+  // Slices start on a word of the bitmap, so that no two threads write to
+  // the same word.
+  size_t sliceCount = std::max<size_t>(std::min(threadCount, count / _MinBatchSlice), 1);
+  size_t sliceLength = (count / sliceCount + 63) / 64 * 64;
+
+  std::vector<std::thread> threads;
+  for (size_t begin = sliceLength; begin < count; begin += sliceLength) {
+    size_t end = std::min(count, begin + sliceLength);
+    threads.emplace_back([this, texts, begin, end, bitmap, ranges, laneCount]() {
+      EnginesLease engines(*this);
+      _execBatchSlice(texts, begin, end, bitmap, ranges, laneCount, engines.get());
+    });
+  }
+
+  {
+    EnginesLease engines(*this);
+    _execBatchSlice(texts, 0, std::min(count, sliceLength), bitmap, ranges, laneCount, engines.get());
+  }
+  for (auto &thread: threads) {
+    thread.join();
+  }
+}
+
+void RegExp::_execBatchSlice(const Text *texts, size_t begin, size_t end, uint64_t *bitmap,
+                             exec::Range *ranges, size_t laneCount, const Engines &engines) const
+{
+  if (begin == end) {
+    return;
+  }
+
+  exec::Input input(texts[begin].text, texts[begin].length, _ignoreCase);
+  exec::Output output(_package);
+  exec::Meter meter;
+
+  // The forward DFA finds where the nearest match of each text ends.  A
+  // text without one has no match, and one whose match ends before its end
+  // has a match that starts before it too, which is all test wants.
+  bool interleaved = laneCount > 1 && _search == Strategy::Search::DFA;
+  std::vector<const uint16_t *> chunkTexts;
+  std::vector<size_t> chunkLengths;
+  std::vector<uint16_t> folded;
+  dfa::DFA::Result results[_BatchChunk];
+  size_t positions[_BatchChunk];
+
+  for (size_t i = begin; i < end; ++i) {
+    size_t chunk = (i - begin) % _BatchChunk;
+    if (interleaved && chunk == 0) {
+      size_t chunkEnd = std::min(end, i + _BatchChunk);
+      chunkTexts.clear();
+      chunkLengths.clear();
+      folded.clear();
+      for (size_t j = i; j < chunkEnd; ++j) {
+        chunkTexts.push_back(texts[j].text);
+        chunkLengths.push_back(texts[j].length);
+        if (_ignoreCase) {
+          folded.insert(folded.end(), texts[j].text, texts[j].text + texts[j].length);
+        }
+      }
+
+      if (_ignoreCase) {
+        utf16::to_lower(folded.data(), folded.size());
+        for (size_t j = 0, offset = 0; j < chunkTexts.size(); offset += chunkLengths[j++]) {
+          chunkTexts[j] = folded.data() + offset;
+        }
+      }
+
+      engines.forwardDFA->searchInterleaved(chunkTexts.data(), chunkLengths.data(),
+                                            chunkTexts.size(), laneCount, results, positions,
+                                            meter);
+    }
+
+    bool found;
+    if (interleaved && results[chunk] == dfa::DFA::Result::NoMatch) {
+      found = false;
+    }
+    else if (interleaved && ranges == nullptr && results[chunk] == dfa::DFA::Result::Match &&
+             positions[chunk] < texts[i].length) {
+      found = true;
+    }
+    else {
+      input.assign(texts[i].text, texts[i].length, _ignoreCase);
+      size_t inputStartIndex = 0;
+      found = _find(input, inputStartIndex, input.length, output,
+                    getStrategy(input.length, false).engine, meter, engines);
+    }
+
+    if (bitmap != nullptr) {
+      if (found) {
+        bitmap[i / 64] |= UINT64_C(1) << (i % 64);
+      }
+      else {
+        bitmap[i / 64] &= ~(UINT64_C(1) << (i % 64));
+      }
+    }
+    if (ranges != nullptr) {
+      ranges[i] = found ? output.captures[0] : exec::Range();
+    }
+  }
+}
+
+MatchPtr RegExp::_exec(const exec::InputPtr &input, exec::Meter &meter, bool captures) const
 {
   assert(input != nullptr);
 
@@ -429,25 +1021,620 @@ MatchPtr RegExp::_exec(const exec::InputPtr &input) const
     }
   }
 
+  EnginesLease engines(*this);
+  MatchPtr match = _scan(input, inputStartIndex, input->length, meter, captures, engines.get());
+  if (match == nullptr && meter.isAborted()) {
+    return nullptr;
+  }
+
+  if (_global) {
+    _lastIndex = inputStartIndex;
+  }
+
+  return match;
+}
+
+/*
+ * Looks for the first match starting at or after inputStartIndex and
+ * before stop.  On a match inputStartIndex is moved to its end, otherwise
+ * to where the search stopped.
+ */
+MatchPtr RegExp::_scan(const exec::InputPtr &input, size_t &inputStartIndex, size_t stop,
+                       exec::Meter &meter, bool captures, const Engines &engines) const
+{
+  Strategy::Engine engine = getStrategy(input->length, captures).engine;
   exec::OutputPtr output = std::make_shared<exec::Output>(_package);
 
-  while (inputStartIndex < input->length) {
-    if (exec::execute(_package, *input, inputStartIndex, *output)) {
-      if (_global) {
-        _lastIndex = output->captures[0].position + output->captures[0].length;
-      }
+  if (_find(*input, inputStartIndex, stop, *output, engine, meter, engines)) {
+    return std::make_shared<Match>(input, output);
+  }
+
+  return nullptr;
+}
+
+// The loop of _scan, with the match left in output.
+bool RegExp::_find(const exec::Input &input, size_t &inputStartIndex, size_t stop,
+                   exec::Output &output, Strategy::Engine engine, exec::Meter &meter,
+                   const Engines &engines) const
+{
+  assert(stop <= input.length);
+
+  while (inputStartIndex < stop) {
+    if (!_findCandidate(input, inputStartIndex, stop, meter, engines)) {
+      break;
+    }
 
-      return std::make_shared<Match>(input, output);
+    if (_execute(input, inputStartIndex, output, engine, meter, engines)) {
+      inputStartIndex = output.captures[0].position + output.captures[0].length;
+      return true;
+    }
+
+    if (meter.isAborted()) {
+      return false;
     }
 
     ++inputStartIndex;
   }
 
-  if (_global) {
-    _lastIndex = inputStartIndex;
+  return false;
+}
+
+bool RegExp::_execute(const exec::Input &input, size_t inputStartIndex, exec::Output &output,
+                      Strategy::Engine engine, exec::Meter &meter, const Engines &engines) const
+{
+  dfa::DFA::Result result = dfa::DFA::Result::GaveUp;
+
+  switch (engine) {
+  case Strategy::Engine::Literal:
+    // _findCandidate only stops where the literal occurs.
+    output.captures[0].position = inputStartIndex;
+    output.captures[0].length = _literal.size();
+    return true;
+
+  case Strategy::Engine::DFA: {
+      size_t end;
+      result = engines.anchoredDFA->search(input.text, input.length, inputStartIndex, input.length, true,
+                                           end, meter);
+      if (result == dfa::DFA::Result::Match) {
+        output.captures[0].position = inputStartIndex;
+        output.captures[0].length = end - inputStartIndex;
+      }
+    }
+    break;
+
+  case Strategy::Engine::OnePass:
+    return engines.onePass->match(input, inputStartIndex, output, meter);
+
+  case Strategy::Engine::TaggedDFA:
+    result = engines.tdfa->match(input, inputStartIndex, output, meter);
+    break;
+
+  case Strategy::Engine::Backtrack:
+  case Strategy::Engine::Exhaustive:
+    break;
   }
 
-  return nullptr;
+  switch (result) {
+  case dfa::DFA::Result::Match:
+    return true;
+
+  case dfa::DFA::Result::NoMatch:
+    return false;
+
+  case dfa::DFA::Result::GaveUp:
+    break;
+  }
+
+  return exec::execute(_package, input, inputStartIndex, output, meter);
+}
+
+bool RegExp::_findCandidate(const exec::Input &input, size_t &inputStartIndex, size_t stop,
+                            exec::Meter &meter, const Engines &engines) const
+{
+  assert(inputStartIndex < stop && stop <= input.length);
+
+  if (input.length - inputStartIndex < _lengths.minimum) {
+    return false;
+  }
+
+  switch (_search) {
+  case Strategy::Search::Literal: {
+      size_t end = std::min(input.length, stop - 1 + _literal.size());
+      inputStartIndex += utf16::find(input.text + inputStartIndex, end - inputStartIndex,
+                                     _literal.data(), _literal.size());
+      return inputStartIndex < stop;
+    }
+
+  case Strategy::Search::Anchored:
+    if (!_multiline) {
+      return inputStartIndex == 0;
+    }
+
+    if (inputStartIndex > 0 && !exec::is_line_terminator(input.text[inputStartIndex - 1])) {
+      static const uint16_t lineTerminators[] = {'\r', '\n', 0x2028, 0x2029};
+      inputStartIndex += utf16::find_any(input.text + inputStartIndex,
+                                         stop - inputStartIndex,
+                                         lineTerminators,
+                                         sizeof(lineTerminators) / sizeof(lineTerminators[0])) + 1;
+    }
+
+    return inputStartIndex < stop;
+
+  case Strategy::Search::DFA: {
+      dfa::DFA::Result result;
+      if (_anchors.end && !_multiline) {
+        // Every match ends at the end of input, so the leftmost one starts at
+        // the farthest position the reversed pattern reaches from there.  A
+        // scan that gives up may have passed nearer ones, which the search
+        // below must not start from.
+        size_t start;
+        result = engines.reverseDFA->search(input.text, input.length, inputStartIndex, input.length, true,
+                                            start, meter);
+        if (result == dfa::DFA::Result::Match) {
+          inputStartIndex = start;
+        }
+      }
+      else {
+        result = _findCandidateWithDFA(input, inputStartIndex, stop, meter, engines);
+      }
+
+      switch (result) {
+      case dfa::DFA::Result::Match:
+        return inputStartIndex < stop;
+
+      case dfa::DFA::Result::NoMatch:
+        return false;
+
+      case dfa::DFA::Result::GaveUp:
+        break;
+      }
+    }
+    break;
+
+  case Strategy::Search::Prefilter:
+  case Strategy::Search::Scan:
+    break;
+  }
+
+  inputStartIndex = _prefilter.find(input.text, stop, inputStartIndex);
+  return inputStartIndex < stop;
+}
+
+dfa::DFA::Result RegExp::_findCandidateWithDFA(const exec::Input &input, size_t &inputStartIndex,
+                                               size_t stop, exec::Meter &meter,
+                                               const Engines &engines) const
+{
+  // A match starting before stop ends within maximum code units of it,
+  // and before the next line feed if it cannot take one in; the scan need
+  // not go further to rule such matches out.
+  size_t to = input.length;
+  if (stop < input.length) {
+    if (_lengths.maximum != analyzer::Lengths::Infinite) {
+      to = std::min(to, stop - 1 + _lengths.maximum);
+    }
+    if (!_spansLines) {
+      static const uint16_t lineFeed = '\n';
+      to = std::min(to, stop + utf16::find(input.text + stop, input.length - stop, &lineFeed, 1));
+    }
+  }
+
+  // The earliest match end bounds the leftmost match: it cannot start after
+  // the start of the match ending there, nor more than maximum code units
+  // before that end.
+  size_t end;
+  dfa::DFA::Result result = engines.forwardDFA->search(input.text, input.length, inputStartIndex, to,
+                                                       false, end, meter);
+  if (result != dfa::DFA::Result::Match) {
+    return result;
+  }
+
+  size_t low = inputStartIndex;
+  if (_lengths.maximum != analyzer::Lengths::Infinite && end - low > _lengths.maximum) {
+    low = end - _lengths.maximum;
+  }
+
+  if (_lengths.minimum == _lengths.maximum) {
+    inputStartIndex = end - _lengths.minimum;
+    assert(inputStartIndex >= low);
+    return dfa::DFA::Result::Match;
+  }
+
+  size_t high;
+  result = engines.reverseDFA->search(input.text, input.length, low, end, true, high, meter);
+  if (result != dfa::DFA::Result::Match) {
+    assert(result == dfa::DFA::Result::GaveUp || meter.isAborted());
+    return result;
+  }
+
+  // A match starting before high would have to end after end.
+  for (size_t start = low; start < high; ++start) {
+    start = _prefilter.find(input.text, high, start);
+    if (start >= high) {
+      break;
+    }
+
+    size_t position;
+    result = engines.anchoredDFA->search(input.text, input.length, start, input.length, false, position,
+                                         meter);
+    if (result != dfa::DFA::Result::NoMatch || meter.isAborted()) {
+      inputStartIndex = start;
+      return result;
+    }
+  }
+
+  inputStartIndex = high;
+  return dfa::DFA::Result::Match;
+}
+
+const RegExp::ByteDFAs &RegExp::_prepareByteDFAs(dfa::Encoding encoding, Engines &engines) const
+{
+  assert(encoding != dfa::Encoding::UTF16);
+
+  ByteDFAs &dfas = (encoding == dfa::Encoding::UTF8) ? engines.utf8DFAs : engines.latin1DFAs;
+  if (dfas.prepared) {
+    return dfas;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  BytePrograms &programs = (encoding == dfa::Encoding::UTF8) ? _utf8Programs : _latin1Programs;
+  if (!programs.prepared) {
+    programs.prepared = true;
+    programs.forward = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                             dfa::Direction::Forward, encoding);
+    if (programs.forward != nullptr) {
+      programs.reverse = dfa::Program::compile(_package.nfa, _multiline, _ignoreCase,
+                                               dfa::Direction::Reverse, encoding);
+      assert(programs.reverse != nullptr);
+      programs.spansLines = spans_lines(programs.forward);
+    }
+  }
+  BytePrograms prepared = programs;
+  lock.unlock();
+
+  dfas.prepared = true;
+  if (prepared.forward != nullptr) {
+    dfas.forward = std::make_shared<dfa::DFA>(prepared.forward, false);
+    dfas.anchored = std::make_shared<dfa::DFA>(prepared.forward);
+    dfas.reverse = std::make_shared<dfa::DFA>(prepared.reverse);
+    dfas.spansLines = prepared.spansLines;
+  }
+  return dfas;
+}
+
+/*
+ * Finds up to limit matches from startIndex on, the way execAll does, and
+ * returns the index the search stopped at.  Text the byte DFAs can read is
+ * searched in place; the rest of the search, if they cannot go on, runs on
+ * the text transcoded to UTF-16.  A partial search, for execWindow, stops
+ * instead, and also stops before anything that the end of the text
+ * decides.
+ */
+size_t RegExp::_execBytes(const uint8_t *text, size_t textLength, dfa::Encoding encoding,
+                          size_t startIndex, size_t limit, bool captures, bool utf16Offsets,
+                          bool partial, ByteMatchVector &matches) const
+{
+  assert(text != nullptr || textLength == 0);
+  assert(encoding != dfa::Encoding::UTF16);
+  matches.clear();
+
+  if (_package.nfa == nullptr) {
+    return textLength;
+  }
+
+  // ASCII text reads the same in Latin-1, whose DFAs need no character
+  // boundaries and also exist for multiline patterns with ^ or $.
+  bool utf8 = (encoding == dfa::Encoding::UTF8 && !latin1::is_ascii(text, textLength));
+  EnginesLease engines(*this);
+  const ByteDFAs &dfas = _prepareByteDFAs(utf8 ? dfa::Encoding::UTF8 : dfa::Encoding::Latin1,
+                                          engines.get());
+
+  exec::Meter meter;
+  size_t index = startIndex;
+
+  if (dfas.forward != nullptr && (!utf8 || utf8::is_bmp(text, textLength))) {
+    // Code units are counted as far as unitsIndex, where matches go on.
+    size_t units = 0;
+    size_t unitsIndex = 0;
+
+    while (matches.size() < limit && index < textLength) {
+      ByteMatch match;
+      size_t horizon = 0;
+      dfa::DFA::Result result = _matchBytes(dfas, text, textLength, index, captures, match,
+                                            horizon, meter, engines.get());
+      if (result == dfa::DFA::Result::GaveUp) {
+        if (partial) {
+          return index;
+        }
+        break;
+      }
+      else if (partial && horizon >= textLength) {
+        // The end of the text was taken into account, which more text would
+        // change.  A match can only take part in that if it is this one, or
+        // if it starts within the maximum length of a match from the end,
+        // and after the last line feed if no match can take one in.
+        size_t resume = index;
+        size_t maximum = _lengths.maximum;
+        if (maximum != analyzer::Lengths::Infinite) {
+          // A code unit takes at most three bytes of UTF-8.
+          maximum *= utf8 ? 3 : 1;
+          if (maximum < textLength - index) {
+            resume = textLength - maximum;
+          }
+        }
+
+        if (!dfas.spansLines) {
+          for (size_t position = textLength; position > resume; --position) {
+            if (text[position - 1] == '\n') {
+              resume = position;
+              break;
+            }
+          }
+        }
+
+        if (result == dfa::DFA::Result::Match) {
+          resume = std::min(resume, match.captures[0].position);
+        }
+        while (utf8 && resume > index && resume < textLength && utf8::is_continuation(text[resume])) {
+          --resume;
+        }
+        return resume;
+      }
+      else if (result == dfa::DFA::Result::NoMatch) {
+        return textLength;
+      }
+
+      const exec::Range &range = match.captures[0];
+      if (utf16Offsets && !utf8) {
+        match.utf16Captures = match.captures;
+      }
+      else if (utf16Offsets) {
+        units += utf8::count_utf16(text + unitsIndex, range.position - unitsIndex);
+        unitsIndex = range.position;
+
+        for (auto &capture: match.captures) {
+          exec::Range utf16Capture;
+          if (capture.position != exec::Range::NotFound) {
+            utf16Capture.position = units + utf8::count_utf16(text + unitsIndex, capture.position - unitsIndex);
+            utf16Capture.length = utf8::count_utf16(text + capture.position, capture.length);
+          }
+          match.utf16Captures.push_back(utf16Capture);
+        }
+      }
+
+      // After an empty match the search moves on by one character, which
+      // is one code unit here.
+      index = range.position + range.length;
+      if (range.length == 0) {
+        ++index;
+        while (utf8 && index < textLength && utf8::is_continuation(text[index])) {
+          ++index;
+        }
+      }
+
+      matches.push_back(std::move(match));
+    }
+  }
+
+  if (matches.size() >= limit || index >= textLength || partial) {
+    return index;
+  }
+
+  std::vector<uint16_t> units;
+  std::vector<size_t> offsets;
+  if (encoding == dfa::Encoding::UTF8) {
+    utf8::to_utf16(text, textLength, units, offsets);
+  }
+  else {
+    latin1::to_utf16(text, textLength, units, offsets);
+  }
+
+  exec::InputPtr input = std::make_shared<exec::Input>(units.data(), units.size(), _ignoreCase);
+  size_t inputStartIndex = std::lower_bound(offsets.begin(), offsets.end(), index) - offsets.begin();
+
+  while (matches.size() < limit && inputStartIndex < input->length) {
+    MatchPtr match = _scan(input, inputStartIndex, input->length, meter, captures, engines.get());
+    if (match == nullptr) {
+      break;
+    }
+
+    ByteMatch result;
+    for (size_t i = 0; i < match->getCapturedCount(); ++i) {
+      exec::Range utf16Capture;
+      exec::Range capture;
+      if (match->getCapturedTextIndex(i) != exec::Range::NotFound) {
+        utf16Capture.position = match->getCapturedTextIndex(i);
+        utf16Capture.length = match->getCapturedTextLength(i);
+        capture.position = offsets[utf16Capture.position];
+        capture.length = offsets[utf16Capture.position + utf16Capture.length] - capture.position;
+      }
+
+      result.captures.push_back(capture);
+      if (utf16Offsets) {
+        result.utf16Captures.push_back(utf16Capture);
+      }
+    }
+
+    if (match->getMatchedLength() == 0) {
+      ++inputStartIndex;
+    }
+
+    matches.push_back(std::move(result));
+  }
+
+  return (inputStartIndex < offsets.size()) ? offsets[inputStartIndex] : textLength;
+}
+
+/*
+ * Finds the first match from startIndex on in text that the DFAs can
+ * read.  They find where it is; captures, and the end of the match under
+ * leftmost-first, come from the usual engines, run on the match
+ * transcoded to UTF-16.  GaveUp means the search has to be done on the
+ * transcoded text instead.
+ */
+dfa::DFA::Result RegExp::_matchBytes(const ByteDFAs &dfas, const uint8_t *text, size_t textLength,
+                                     size_t startIndex, bool captures, ByteMatch &match,
+                                     size_t &horizon, exec::Meter &meter,
+                                     const Engines &engines) const
+{
+  bool utf8 = (dfas.forward->getProgram()->getEncoding() == dfa::Encoding::UTF8);
+  dfa::DFA::Result result;
+  size_t start = startIndex;
+  size_t end;
+
+  if (_anchors.begin && !_multiline) {
+    if (startIndex > 0) {
+      return dfa::DFA::Result::NoMatch;
+    }
+  }
+  else {
+    // In Latin-1 a byte is a code unit, so the prefilter skips the start
+    // positions it rules out, as in _findCandidateWithDFA.  Its sets are
+    // folded to lower case, as exec::Input folds the text, so it cannot be
+    // used on bytes under ignoreCase.
+    bool prefilter = !utf8 && !_ignoreCase;
+    if (prefilter) {
+      startIndex = _prefilter.find(text, textLength, startIndex);
+      if (startIndex >= textLength) {
+        return dfa::DFA::Result::NoMatch;
+      }
+    }
+
+    // The earliest match end bounds the leftmost match.
+    result = dfas.forward->search(text, textLength, startIndex, textLength, false, end, meter);
+    horizon = std::max(horizon, dfas.forward->getHorizon());
+    if (result != dfa::DFA::Result::Match) {
+      return result;
+    }
+
+    size_t high;
+    result = dfas.reverse->search(text, textLength, startIndex, end, true, high, meter);
+    horizon = std::max(horizon, dfas.reverse->getHorizon());
+    if (result != dfa::DFA::Result::Match) {
+      assert(result == dfa::DFA::Result::GaveUp);
+      return result;
+    }
+
+    start = high;
+    for (size_t position = startIndex; position < high; ++position) {
+      if (utf8 && utf8::is_continuation(text[position])) {
+        continue;
+      }
+      else if (prefilter) {
+        position = _prefilter.find(text, high, position);
+        if (position >= high) {
+          break;
+        }
+      }
+
+      result = dfas.anchored->search(text, textLength, position, textLength, false, end, meter);
+      horizon = std::max(horizon, dfas.anchored->getHorizon());
+      if (result == dfa::DFA::Result::GaveUp) {
+        return result;
+      }
+      else if (result == dfa::DFA::Result::Match) {
+        start = position;
+        break;
+      }
+    }
+
+    // Like _exec, no match is looked for at the end of the text.
+    if (start >= textLength) {
+      return dfa::DFA::Result::NoMatch;
+    }
+  }
+
+  result = dfas.anchored->search(text, textLength, start, textLength, true, end, meter);
+  horizon = std::max(horizon, dfas.anchored->getHorizon());
+  if (result != dfa::DFA::Result::Match) {
+    return result;
+  }
+
+  match.captures.assign(1 + _package.storageCount, exec::Range());
+  match.captures[0].position = start;
+  match.captures[0].length = end - start;
+
+  if (!captures || !_literal.empty() || (_package.storageCount == 0 && !_leftmostFirst)) {
+    return dfa::DFA::Result::Match;
+  }
+
+  // The match, and a character on either side of it for the assertions,
+  // is transcoded for the capture engines.
+  size_t windowStart = start;
+  if (windowStart > 0) {
+    do {
+      --windowStart;
+    } while (utf8 && windowStart > 0 && utf8::is_continuation(text[windowStart]));
+  }
+
+  size_t windowEnd = end;
+  if (windowEnd < textLength) {
+    do {
+      ++windowEnd;
+    } while (utf8 && windowEnd < textLength && utf8::is_continuation(text[windowEnd]));
+  }
+  horizon = std::max(horizon, windowEnd);
+
+  std::vector<uint16_t> units;
+  std::vector<size_t> offsets;
+  if (utf8) {
+    utf8::to_utf16(text + windowStart, windowEnd - windowStart, units, offsets);
+  }
+  else {
+    latin1::to_utf16(text + windowStart, windowEnd - windowStart, units, offsets);
+  }
+
+  exec::Input input(units.data(), units.size(), _ignoreCase);
+  exec::Output output(_package);
+  size_t inputStartIndex = (start > windowStart) ? 1 : 0;
+  size_t inputEnd = inputStartIndex + (utf8 ? utf8::count_utf16(text + start, end - start) : end - start);
+
+  if (!_execute(input, inputStartIndex, output, getStrategy(input.length).engine, meter, engines)) {
+    return dfa::DFA::Result::GaveUp;
+  }
+
+  // The window ends where the text may not, and a match that relies on
+  // that cannot be told from a real one here.
+  size_t matchEnd = output.captures[0].position + output.captures[0].length;
+  if (_leftmostFirst ? matchEnd > inputEnd : matchEnd != inputEnd) {
+    return dfa::DFA::Result::GaveUp;
+  }
+
+  for (size_t i = 0; i < output.captures.size(); ++i) {
+    const exec::Range &range = output.captures[i];
+    if (range.position != exec::Range::NotFound) {
+      match.captures[i].position = windowStart + offsets[range.position];
+      match.captures[i].length = offsets[range.position + range.length] - offsets[range.position];
+    }
+  }
+
+  return dfa::DFA::Result::Match;
+}
+
+std::string to_string(const Strategy &strategy)
+{
+  static const char *searches[] = {"Literal", "Anchored", "DFA", "Prefilter", "Scan"};
+  static const char *engines[] = {"Literal", "DFA", "OnePass", "TaggedDFA", "Backtrack", "Exhaustive"};
+
+  std::ostringstream os;
+  os << "Search: " << searches[static_cast<size_t>(strategy.search)]
+     << ", Engine: " << engines[static_cast<size_t>(strategy.engine)];
+  return os.str();
+}
+
+std::string to_string(const Complexity &complexity)
+{
+  static const char *classes[] = {"Linear", "Quadratic", "Polynomial", "Exponential"};
+  static const char *kinds[] = {"NestedQuantifier", "OverlappingAlternation", "LargeRepetition"};
+
+  std::ostringstream os;
+  os << "Worst case: " << classes[static_cast<size_t>(complexity.worstCase)]
+     << ", NFA nodes: " << complexity.nfaNodes
+     << ", DFA states: " << complexity.dfaStates;
+  for (auto &hazard: complexity.hazards) {
+    os << ", " << kinds[static_cast<size_t>(hazard.kind)]
+       << " at " << hazard.position << ":" << hazard.length;
+  }
+  return os.str();
 }
 
 void replace(const RegExp &re,
@@ -27,10 +27,18 @@
 
 #include "ast.h"
 #include "parser.h"
+#include "nfa.h"
 #include "exec.h"
+#include "prefilter.h"
+#include "analyzer.h"
+#include "dfa.h"
+#include "tdfa.h"
+#include "onepass.h"
+#include "stream.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <functional>
@@ -63,13 +71,124 @@ private:
 typedef std::shared_ptr<Match> MatchPtr;
 typedef std::vector<MatchPtr> MatchVector;
 
+/*
+ * A match in UTF-8 or Latin-1 text.  captures holds byte ranges, with
+ * exec::Range::NotFound for groups that took no part in the match; if
+ * asked for, utf16Captures holds the same ranges in code units of UTF-8
+ * text transcoded to UTF-16.
+ */
+struct ByteMatch {
+  std::vector<exec::Range> captures;
+  std::vector<exec::Range> utf16Captures;
+};
+
+typedef std::vector<ByteMatch> ByteMatchVector;
+
+// A run of UTF-16 code units held by the caller.
+struct Text {
+  const uint16_t *text;
+  size_t length;
+};
+
+typedef std::vector<Text> TextVector;
+
+/*
+ * How a RegExp goes about a call: the way start positions are found, which
+ * is fixed when the pattern is compiled, and the engine that runs at each
+ * of them, which also depends on the input and on whether captures are
+ * wanted.  Engines that give up on an input (the DFAs, when their state
+ * cache thrashes) fall back to the backtracker or the exhaustive search.
+ */
+struct Strategy {
+  enum class Search {
+    Literal,
+    Anchored,
+    DFA,
+    Prefilter,
+    Scan
+  };
+
+  enum class Engine {
+    Literal,
+    DFA,
+    OnePass,
+    TaggedDFA,
+    Backtrack,
+    Exhaustive
+  };
+
+  Search search;
+  Engine engine;
+};
+
+std::string to_string(const Strategy &strategy);
+
+/*
+ * The outcome of a call made on an exec::Budget.  A call is Aborted when
+ * the budget runs out, or it is cancelled, before the outcome is known.
+ */
+enum class Status {
+  Match,
+  NoMatch,
+  Aborted
+};
+
+/*
+ * What a pattern may cost to match, for turning risky patterns away before
+ * they are used.  worstCase is an estimate of how one call grows with the
+ * length of the input, taking into account the engines a call can fall
+ * back to:
+ *
+ * - Linear: the DFAs handle the pattern within their state limit.
+ * - Quadratic: there is no DFA, or it has too many states, so the
+ *   backtracker may run from every start position.
+ * - Polynomial: backreferences, for which the backtracker keeps a
+ *   position per referenced group.  One group is enough to make a call
+ *   quadratic, so these need an exec::Budget on untrusted input.
+ * - Exponential: a nested quantifier or an overlapping alternation, which
+ *   the exhaustive search and look-ahead assertions may explore every way
+ *   of matching, or a pattern that long inputs leave to the exhaustive
+ *   search: one with more than exec::Package::VisitedBitsPerCodeUnit NFA
+ *   nodes, and no counters or backreferences, outside leftmost-first
+ *   mode.
+ *
+ * hazards locates the offending sub-expressions in the pattern.  nfaNodes
+ * counts the nodes of the NFA and its look-ahead NFAs; dfaStates counts the
+ * states of the DFA, up to one more than dfa::DFA::DefaultStateLimit, and
+ * is 0 if the pattern has no DFA.
+ */
+struct Complexity {
+  enum class Class {
+    Linear,
+    Quadratic,
+    Polynomial,
+    Exponential
+  };
+
+  Class worstCase;
+  analyzer::HazardVector hazards;
+  size_t nfaNodes;
+  size_t dfaStates;
+};
+
+std::string to_string(const Complexity &complexity);
+
+/*
+ * A RegExp can be shared between threads: each call runs on engines of its
+ * own.  lastIndex is the exception, so test, exec, execAll and replace on a
+ * global RegExp, which use it, must not run on more than one thread at a
+ * time; on a RegExp that is not global they can, as can the calls that
+ * leave lastIndex alone.
+ */
 class RegExp {
 public:
   RegExp(const uint16_t *pattern,
          size_t patternLength,
          bool global = false,
          bool multiline = false,
-         bool ignoreCase = false);
+         bool ignoreCase = false,
+         bool leftmostFirst = false,
+         const nfa::Limits &limits = nfa::Limits());
 
   RegExp(const RegExp &) = delete;
   RegExp &operator=(const RegExp &) = delete;
@@ -77,6 +196,7 @@ public:
   bool getGlobal() const { return _global; }
   bool getMultiline() const { return _multiline; }
   bool getIgnoreCase() const { return _ignoreCase; }
+  bool getLeftmostFirst() const { return _leftmostFirst; }
 
   const uint16_t *getPattern() const;
   size_t getPatternLength() const;
@@ -88,14 +208,101 @@ public:
   std::string toString() const;
   size_t getStorageCount() const { return _package.storageCount; }
 
+  // The NFA the pattern compiles to, or null if it has an error.
+  const nfa::NFAPtr &getNFA() const { return _package.nfa; }
+
+  size_t getBacktrackLimit() const { return _package.backtrackLimit; }
+  void setBacktrackLimit(size_t backtrackLimit) { _package.backtrackLimit = backtrackLimit; }
+
   size_t getLastIndex() const { return _lastIndex; }
   void setLastIndex(size_t lastIndex) const { _lastIndex = lastIndex; }
 
+  Strategy getStrategy(size_t textLength, bool captures = true) const;
+
+  // Builds the whole DFA to measure it, so it is best called once, when
+  // the pattern is loaded.
+  Complexity analyzeComplexity() const;
+
   bool test(const uint16_t *text, size_t textLength) const;
   MatchPtr exec(const uint16_t *text, size_t textLength) const;
 
   MatchVector execAll(const uint16_t *text, size_t textLength) const;
 
+  // The same searches on UTF-8 text.  Well-formed text without characters
+  // beyond the Basic Multilingual Plane is read as it is by the DFAs when
+  // the pattern has them; everything else is transcoded to UTF-16 first,
+  // with malformed bytes read as U+FFFD.  These calls neither use nor
+  // update lastIndex: execUTF8 searches from the byte offset startIndex,
+  // and execAllUTF8 finds every match if the RegExp is global.
+  bool testUTF8(const uint8_t *text, size_t textLength) const;
+  bool execUTF8(const uint8_t *text, size_t textLength, size_t startIndex,
+                ByteMatch &match, bool utf16Offsets = false) const;
+  ByteMatchVector execAllUTF8(const uint8_t *text, size_t textLength,
+                              bool utf16Offsets = false) const;
+
+  // The same on Latin-1 text, whose byte offsets are also its UTF-16
+  // offsets.  The DFAs read it as it is; ASCII text in UTF-8 takes this
+  // path too.
+  bool testLatin1(const uint8_t *text, size_t textLength) const;
+  bool execLatin1(const uint8_t *text, size_t textLength, size_t startIndex,
+                  ByteMatch &match) const;
+  ByteMatchVector execAllLatin1(const uint8_t *text, size_t textLength) const;
+
+  // The matches execAll finds, found by up to threadCount threads that
+  // each search one slice of the text with their own copies of the
+  // engines.  A match that runs across the end of a slice can leave the
+  // next slice's search out of step with the sequential one, and the
+  // matches after it are looked for again until the two agree.  Slices
+  // only pay off on long texts; short ones, and patterns anchored to the
+  // start or end of the text, are searched on the calling thread, as is
+  // everything if the RegExp is not global.  lastIndex is neither used
+  // nor updated.
+  MatchVector execAllParallel(const uint16_t *text, size_t textLength,
+                              size_t threadCount) const;
+
+  // test and exec on each of count texts, searched from its start, for
+  // many short texts: the copy of the text and the search state are set
+  // up once for all of them.  testBatch sets bit i % 64 of bitmap[i / 64]
+  // if texts[i] has a match and clears it otherwise; execBatch stores the
+  // span of the first match of texts[i], or exec::Range() if there is
+  // none, in ranges[i].  Large batches are split between up to
+  // threadCount threads, on 64-text boundaries.  Where the DFAs look for
+  // matches, each thread first scans laneCount texts at a time in
+  // lockstep (see dfa::DFA::searchInterleaved), which settles the texts
+  // without a match, and for testBatch most of the others; a laneCount
+  // below 2 scans them one by one.  lastIndex is neither used nor
+  // updated.
+  void testBatch(const Text *texts, size_t count, uint64_t *bitmap,
+                 size_t threadCount = 1,
+                 size_t laneCount = dfa::DFA::DefaultLaneCount) const;
+  void execBatch(const Text *texts, size_t count, exec::Range *ranges,
+                 size_t threadCount = 1,
+                 size_t laneCount = dfa::DFA::DefaultLaneCount) const;
+
+  // Searches text, in UTF-8 or Latin-1, as a window onto a longer text
+  // that only ends there if final is set.  matches receives what a global
+  // execAllUTF8 or execAllLatin1 finds from startIndex on that the rest of
+  // the text cannot change, and the index returned is where the search
+  // goes on from with more of the text.  Only the DFAs can tell that, so
+  // for patterns or text they cannot read this returns startIndex until
+  // the window is final.
+  size_t execWindow(const uint8_t *text, size_t textLength, dfa::Encoding encoding,
+                    size_t startIndex, bool final, ByteMatchVector &matches) const;
+
+  // A stream that reports the matches a global execAll would find in the
+  // input fed to it.  Returns nullptr under leftmost-first, and for
+  // patterns that need the backtracker or the exhaustive search
+  // (backreferences, look-ahead assertions and large counted repetitions).
+  stream::StreamPtr createStream(const stream::Stream::Callback &callback) const;
+
+  // The same calls on a budget.  An aborted call leaves lastIndex as it
+  // was, and execAll keeps the matches found before it gave up.
+  Status test(const uint16_t *text, size_t textLength, const exec::Budget &budget) const;
+  Status exec(const uint16_t *text, size_t textLength, const exec::Budget &budget,
+              MatchPtr &match) const;
+  Status execAll(const uint16_t *text, size_t textLength, const exec::Budget &budget,
+                 MatchVector &matches) const;
+
   void replace(const uint16_t *templ,
                size_t templLength,
                const uint16_t *input,
@@ -112,18 +319,135 @@ public:
                size_t &outputLength) const;
 
 private:
-  MatchPtr _exec(const exec::InputPtr &input) const;
+  // The DFAs of one byte encoding, built on the first call that needs
+  // them; null if the pattern has no program for it.  spansLines tells
+  // whether a match can take in a line feed.
+  struct ByteDFAs {
+    bool prepared;
+    dfa::DFAPtr forward;
+    dfa::DFAPtr anchored;
+    dfa::DFAPtr reverse;
+    bool spansLines;
+  };
+
+  // The programs the byte DFAs are built from, compiled once for all sets
+  // of engines.
+  struct BytePrograms {
+    bool prepared;
+    dfa::ProgramPtr forward;
+    dfa::ProgramPtr reverse;
+    bool spansLines;
+  };
+
+  // The engines that keep a cache or scratch registers from call to call.
+  // A call takes a set of its own from the spare ones, or builds another
+  // from the same programs if none is left, and puts it back when it is
+  // done, so that calls on different threads never share one.
+  struct Engines {
+    dfa::DFAPtr forwardDFA;
+    dfa::DFAPtr anchoredDFA;
+    dfa::DFAPtr reverseDFA;
+    onepass::OnePassPtr onePass;
+    tdfa::TDFAPtr tdfa;
+    ByteDFAs utf8DFAs;
+    ByteDFAs latin1DFAs;
+  };
+
+  // What the global loop finds when run from begin, for execAllParallel:
+  // each match starting before end, along with the index its search
+  // started from, and the index of the search that found nothing more
+  // before end.
+  struct Slice {
+    size_t begin;
+    size_t end;
+    std::vector<size_t> searchIndices;
+    MatchVector matches;
+    size_t rest;
+  };
+
+  // Shorter slices are not worth a thread.
+  static constexpr size_t _MinSliceLength = 1 << 16;
+
+  // Nor are fewer texts of a batch, which are scanned in lockstep in
+  // chunks of _BatchChunk.
+  static constexpr size_t _MinBatchSlice = 1 << 10;
+  static constexpr size_t _BatchChunk = 256;
+
+  Engines _copyEngines() const;
+  Engines _takeEngines() const;
+  void _returnEngines(Engines &&engines) const;
+
+  // Holds a set of engines taken for a call until it goes out of scope.
+  class EnginesLease {
+  public:
+    explicit EnginesLease(const RegExp &re)
+      : _re(re),
+        _engines(re._takeEngines()) {}
+    ~EnginesLease() { _re._returnEngines(std::move(_engines)); }
+
+    EnginesLease(const EnginesLease &) = delete;
+    EnginesLease &operator=(const EnginesLease &) = delete;
+
+    Engines &get() { return _engines; }
+
+  private:
+    const RegExp &_re;
+    Engines _engines;
+  };
+  void _scanSlice(const exec::InputPtr &input, Slice &slice, const Engines &engines) const;
+
+  void _execBatch(const Text *texts, size_t count, uint64_t *bitmap, exec::Range *ranges,
+                  size_t threadCount, size_t laneCount) const;
+  void _execBatchSlice(const Text *texts, size_t begin, size_t end, uint64_t *bitmap,
+                       exec::Range *ranges, size_t laneCount, const Engines &engines) const;
+
+  MatchPtr _exec(const exec::InputPtr &input, exec::Meter &meter, bool captures = true) const;
+  MatchPtr _scan(const exec::InputPtr &input, size_t &inputStartIndex, size_t stop,
+                 exec::Meter &meter, bool captures, const Engines &engines) const;
+  bool _find(const exec::Input &input, size_t &inputStartIndex, size_t stop, exec::Output &output,
+             Strategy::Engine engine, exec::Meter &meter, const Engines &engines) const;
+  bool _findCandidate(const exec::Input &input, size_t &inputStartIndex, size_t stop,
+                      exec::Meter &meter, const Engines &engines) const;
+  dfa::DFA::Result _findCandidateWithDFA(const exec::Input &input, size_t &inputStartIndex,
+                                         size_t stop, exec::Meter &meter,
+                                         const Engines &engines) const;
+  bool _execute(const exec::Input &input, size_t inputStartIndex, exec::Output &output,
+                Strategy::Engine engine, exec::Meter &meter, const Engines &engines) const;
+
+  const ByteDFAs &_prepareByteDFAs(dfa::Encoding encoding, Engines &engines) const;
+  size_t _execBytes(const uint8_t *text, size_t textLength, dfa::Encoding encoding,
+                    size_t startIndex, size_t limit, bool captures, bool utf16Offsets,
+                    bool partial, ByteMatchVector &matches) const;
+  dfa::DFA::Result _matchBytes(const ByteDFAs &dfas, const uint8_t *text, size_t textLength,
+                               size_t startIndex, bool captures, ByteMatch &match,
+                               size_t &horizon, exec::Meter &meter,
+                               const Engines &engines) const;
 
   bool _global;
   bool _multiline;
   bool _ignoreCase;
+  bool _leftmostFirst;
 
   mutable size_t _lastIndex;
 
   parser::InputPtr _pattern;
   parser::ErrorPtr _error;
   ast::ExprPtr _expr;
+  analyzer::HazardVector _hazards;
   exec::Package _package;
+  prefilter::Prefilter _prefilter;
+  analyzer::Anchors _anchors;
+  analyzer::Lengths _lengths;
+  Strategy::Search _search;
+  std::vector<uint16_t> _literal;
+  Engines _engines;
+  bool _spansLines;
+
+  // Guards the spare engines and the byte programs.
+  mutable std::mutex _mutex;
+  mutable std::vector<Engines> _spareEngines;
+  mutable BytePrograms _utf8Programs;
+  mutable BytePrograms _latin1Programs;
 };
 
 typedef std::shared_ptr<RegExp> RegExpPtr;
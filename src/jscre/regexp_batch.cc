@@ -0,0 +1,124 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "regexp_batch.h"
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace jscre {
+namespace regexp {
+
+namespace {
+
+// Joins the threads when it goes out of scope, including when starting one
+// of them throws, so that those already running are not left joinable.
+class ThreadJoiner {
+public:
+  explicit ThreadJoiner(std::vector<std::thread> &threads)
+    : _threads(threads) {}
+
+  ~ThreadJoiner()
+  {
+    for (auto &thread: _threads) {
+      thread.join();
+    }
+  }
+
+private:
+  std::vector<std::thread> &_threads;
+};
+
+} // end namespace
+
+CompiledPatternVector compile_batch(const TextVector &patterns,
+                                    size_t threadCount,
+                                    bool global,
+                                    bool multiline,
+                                    bool ignoreCase,
+                                    bool leftmostFirst,
+                                    const nfa::Limits &limits)
+{
+  // By pattern, the distinct pattern it is a copy of.  Global patterns
+  // each get a RegExp of their own, since they keep lastIndex.
+  std::map<std::vector<uint16_t>, size_t> distinctIndices;
+  std::vector<size_t> distinct;
+  std::vector<size_t> copyOf(patterns.size());
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    if (global) {
+      copyOf[i] = distinct.size();
+      distinct.push_back(i);
+      continue;
+    }
+
+    std::vector<uint16_t> key(patterns[i].text, patterns[i].text + patterns[i].length);
+    auto it = distinctIndices.insert(std::make_pair(std::move(key), distinct.size())).first;
+    if (it->second == distinct.size()) {
+      distinct.push_back(i);
+    }
+    copyOf[i] = it->second;
+  }
+
+  std::vector<CompiledPattern> compiled(distinct.size());
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t k = next++; k < distinct.size(); k = next++) {
+      const Text &pattern = patterns[distinct[k]];
+      RegExpPtr re = std::make_shared<RegExp>(pattern.text, pattern.length, global, multiline,
+                                              ignoreCase, leftmostFirst, limits);
+      if (re->hasError()) {
+        compiled[k].error = std::make_shared<parser::Error>(re->getErrorMessage(),
+                                                            re->getErrorPosition());
+      }
+      else {
+        compiled[k].regExp = std::move(re);
+      }
+    }
+  };
+
+  {
+    std::vector<std::thread> threads;
+    ThreadJoiner joiner(threads);
+    size_t workerCount = std::min(threadCount, distinct.size());
+    for (size_t i = 1; i < workerCount; ++i) {
+      threads.emplace_back(work);
+    }
+    work();
+  }
+
+  CompiledPatternVector result(patterns.size());
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    assert(copyOf[i] < compiled.size());
+    result[i] = compiled[copyOf[i]];
+  }
+
+  return std::move(result);
+}
+
+} // end namespace regexp
+} // end namespace jscre
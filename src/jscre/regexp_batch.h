@@ -0,0 +1,67 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_regexp_batch_h__
+#define __jscre_regexp_batch_h__
+
+#include "regexp.h"
+#include "parser.h"
+#include "nfa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace jscre {
+namespace regexp {
+
+/*
+ * One pattern of a batch: its RegExp, or the error that kept it from
+ * compiling, with the message and position the RegExp would report.
+ */
+struct CompiledPattern {
+  RegExpPtr regExp;
+  parser::ErrorPtr error;
+};
+
+typedef std::vector<CompiledPattern> CompiledPatternVector;
+
+/*
+ * Compiles patterns that share their flags on up to threadCount threads,
+ * the calling thread among them, and returns them in the order they were
+ * given.  Identical patterns are compiled once and share their RegExp,
+ * which any number of threads can use, unless they are global: each of
+ * those gets a RegExp of its own, with its own lastIndex.
+ */
+CompiledPatternVector compile_batch(const TextVector &patterns,
+                                    size_t threadCount,
+                                    bool global = false,
+                                    bool multiline = false,
+                                    bool ignoreCase = false,
+                                    bool leftmostFirst = false,
+                                    const nfa::Limits &limits = nfa::Limits());
+
+} // end namespace regexp
+} // end namespace jscre
+
+#endif /* __jscre_regexp_batch_h__ */
@@ -0,0 +1,343 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "regexp_set.h"
+#include "exec.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace jscre {
+namespace regexp {
+
+constexpr size_t RegExpSet::DefaultShardSize;
+
+// Holds a Matcher taken for a call until it goes out of scope.
+class RegExpSet::MatcherLease {
+public:
+  explicit MatcherLease(const RegExpSet &set)
+    : _set(set),
+      _matcher(set._takeMatcher()) {}
+  ~MatcherLease() { _set._returnMatcher(std::move(_matcher)); }
+
+  MatcherLease(const MatcherLease &) = delete;
+  MatcherLease &operator=(const MatcherLease &) = delete;
+
+  Matcher &get() { return *_matcher; }
+
+private:
+  const RegExpSet &_set;
+  std::unique_ptr<Matcher> _matcher;
+};
+
+RegExpSet::RegExpSet(bool multiline,
+                     bool ignoreCase,
+                     bool leftmostFirst,
+                     const nfa::Limits &limits,
+                     size_t shardSize)
+  : _multiline(multiline),
+    _ignoreCase(ignoreCase),
+    _leftmostFirst(leftmostFirst),
+    _limits(limits),
+    _shardSize(std::max<size_t>(shardSize, 1)),
+    _snapshot(std::make_shared<Snapshot>(Snapshot {std::vector<ShardPtr>(), 0, 0}))
+{
+}
+
+RegExpSet::~RegExpSet()
+{
+}
+
+size_t RegExpSet::add(const uint16_t *pattern, size_t patternLength)
+{
+  RegExpPtr re = std::make_shared<RegExp>(pattern, patternLength, false, _multiline, _ignoreCase,
+                                          _leftmostFirst, _limits);
+  bool hasProgram = re->getNFA() != nullptr &&
+                    dfa::Program::compile(re->getNFA(), _multiline, _ignoreCase,
+                                          dfa::Direction::Forward) != nullptr;
+
+  std::lock_guard<std::mutex> lock(_writeMutex);
+  std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(*_getSnapshot());
+
+  size_t index = snapshot->indexCount;
+  size_t shardIndex = index / _shardSize;
+  if (shardIndex == snapshot->shards.size()) {
+    snapshot->shards.push_back(nullptr);
+  }
+
+  std::vector<size_t> indices;
+  std::vector<RegExpPtr> regExps;
+  std::vector<bool> inProgram;
+  if (snapshot->shards[shardIndex] != nullptr) {
+    indices = snapshot->shards[shardIndex]->indices;
+    regExps = snapshot->shards[shardIndex]->regExps;
+    inProgram = snapshot->shards[shardIndex]->inProgram;
+  }
+  indices.push_back(index);
+  regExps.push_back(std::move(re));
+  inProgram.push_back(hasProgram);
+
+  snapshot->shards[shardIndex] = _buildShard(std::move(indices), std::move(regExps),
+                                             std::move(inProgram));
+  ++snapshot->count;
+  ++snapshot->indexCount;
+
+  std::atomic_store(&_snapshot, SnapshotPtr(std::move(snapshot)));
+  return index;
+}
+
+bool RegExpSet::remove(size_t index)
+{
+  std::lock_guard<std::mutex> lock(_writeMutex);
+  SnapshotPtr current = _getSnapshot();
+
+  size_t shardIndex = index / _shardSize;
+  if (shardIndex >= current->shards.size() || current->shards[shardIndex] == nullptr) {
+    return false;
+  }
+
+  const Shard &shard = *current->shards[shardIndex];
+  auto it = std::lower_bound(shard.indices.begin(), shard.indices.end(), index);
+  if (it == shard.indices.end() || *it != index) {
+    return false;
+  }
+
+  std::vector<size_t> indices(shard.indices);
+  std::vector<RegExpPtr> regExps(shard.regExps);
+  std::vector<bool> inProgram(shard.inProgram);
+  size_t position = static_cast<size_t>(it - shard.indices.begin());
+  indices.erase(indices.begin() + position);
+  regExps.erase(regExps.begin() + position);
+  inProgram.erase(inProgram.begin() + position);
+
+  std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>(*current);
+  snapshot->shards[shardIndex] = indices.empty() ? nullptr
+                                                 : _buildShard(std::move(indices), std::move(regExps),
+                                                               std::move(inProgram));
+  --snapshot->count;
+
+  std::atomic_store(&_snapshot, SnapshotPtr(std::move(snapshot)));
+  return true;
+}
+
+size_t RegExpSet::getCount() const
+{
+  return _getSnapshot()->count;
+}
+
+size_t RegExpSet::getIndexCount() const
+{
+  return _getSnapshot()->indexCount;
+}
+
+RegExpPtr RegExpSet::getRegExp(size_t index) const
+{
+  SnapshotPtr snapshot = _getSnapshot();
+
+  size_t shardIndex = index / _shardSize;
+  if (shardIndex >= snapshot->shards.size() || snapshot->shards[shardIndex] == nullptr) {
+    return nullptr;
+  }
+
+  const Shard &shard = *snapshot->shards[shardIndex];
+  auto it = std::lower_bound(shard.indices.begin(), shard.indices.end(), index);
+  if (it == shard.indices.end() || *it != index) {
+    return nullptr;
+  }
+  return shard.regExps[static_cast<size_t>(it - shard.indices.begin())];
+}
+
+std::vector<size_t> RegExpSet::test(const uint16_t *text, size_t textLength) const
+{
+  MatcherLease matcher(*this);
+  return matcher.get().test(text, textLength);
+}
+
+MatchVector RegExpSet::exec(const uint16_t *text, size_t textLength) const
+{
+  MatcherLease matcher(*this);
+  return matcher.get().exec(text, textLength);
+}
+
+std::unique_ptr<RegExpSet::Matcher> RegExpSet::_takeMatcher() const
+{
+  {
+    std::lock_guard<std::mutex> lock(_matcherMutex);
+    if (!_spareMatchers.empty()) {
+      std::unique_ptr<Matcher> matcher = std::move(_spareMatchers.back());
+      _spareMatchers.pop_back();
+      return matcher;
+    }
+  }
+
+  return std::unique_ptr<Matcher>(new Matcher(*this));
+}
+
+void RegExpSet::_returnMatcher(std::unique_ptr<Matcher> &&matcher) const
+{
+  std::lock_guard<std::mutex> lock(_matcherMutex);
+  _spareMatchers.push_back(std::move(matcher));
+}
+
+RegExpSet::ShardPtr RegExpSet::_buildShard(std::vector<size_t> indices,
+                                           std::vector<RegExpPtr> regExps,
+                                           std::vector<bool> inProgram) const
+{
+  assert(!indices.empty() && indices.size() == regExps.size() && indices.size() == inProgram.size());
+
+  std::shared_ptr<Shard> shard = std::make_shared<Shard>();
+
+  std::vector<nfa::NFAPtr> nfas;
+  for (size_t i = 0; i < regExps.size(); ++i) {
+    if (inProgram[i]) {
+      nfas.push_back(regExps[i]->getNFA());
+      shard->programPatterns.push_back(i);
+    }
+    else if (regExps[i]->getNFA() != nullptr) {
+      shard->otherPatterns.push_back(i);
+    }
+  }
+
+  if (!nfas.empty()) {
+    shard->program = dfa::Program::compile(nfas, _multiline, _ignoreCase);
+    assert(shard->program != nullptr);
+  }
+
+  shard->indices.swap(indices);
+  shard->regExps.swap(regExps);
+  shard->inProgram.swap(inProgram);
+  return shard;
+}
+
+RegExpSet::Matcher::Matcher(const RegExpSet &set)
+  : _set(set)
+{
+}
+
+std::vector<size_t> RegExpSet::Matcher::test(const uint16_t *text, size_t textLength)
+{
+  std::vector<std::pair<ShardState *, size_t>> found;
+  _match(text, textLength, found);
+
+  std::vector<size_t> indices;
+  for (auto &pattern: found) {
+    indices.push_back(pattern.first->shard->indices[pattern.second]);
+  }
+  return std::move(indices);
+}
+
+MatchVector RegExpSet::Matcher::exec(const uint16_t *text, size_t textLength)
+{
+  std::vector<std::pair<ShardState *, size_t>> found;
+  _match(text, textLength, found);
+
+  MatchVector matches(_snapshot->indexCount);
+  for (auto &pattern: found) {
+    size_t index = pattern.first->shard->indices[pattern.second];
+    matches[index] = pattern.first->shard->regExps[pattern.second]->exec(text, textLength);
+  }
+  return std::move(matches);
+}
+
+/*
+ * Moves on to the latest snapshot, keeping the DFAs of the shards it
+ * shares with the one before.
+ */
+void RegExpSet::Matcher::_update()
+{
+  SnapshotPtr snapshot = _set._getSnapshot();
+  if (snapshot == _snapshot) {
+    return;
+  }
+
+  std::vector<ShardState> shards(snapshot->shards.size());
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (i < _shards.size() && _shards[i].shard == snapshot->shards[i]) {
+      shards[i] = std::move(_shards[i]);
+      continue;
+    }
+
+    shards[i].shard = snapshot->shards[i];
+    if (shards[i].shard != nullptr && shards[i].shard->program != nullptr) {
+      shards[i].dfa = std::make_shared<dfa::DFA>(shards[i].shard->program, false);
+    }
+  }
+
+  _snapshot = std::move(snapshot);
+  _shards.swap(shards);
+}
+
+/*
+ * Finds the patterns that match somewhere in text, as shards and
+ * positions in them, in the order of their indices.
+ */
+void RegExpSet::Matcher::_match(const uint16_t *text, size_t textLength,
+                                std::vector<std::pair<ShardState *, size_t>> &found)
+{
+  assert(text != nullptr);
+  _update();
+
+  std::unique_ptr<exec::Input> input;
+  exec::Meter meter;
+  std::vector<bool> matched;
+
+  for (auto &state: _shards) {
+    if (state.shard == nullptr) {
+      continue;
+    }
+
+    const Shard &shard = *state.shard;
+    size_t first = found.size();
+
+    if (state.dfa != nullptr) {
+      if (input == nullptr) {
+        input.reset(new exec::Input(text, textLength, _set._ignoreCase));
+      }
+      dfa::DFA::Result result = state.dfa->searchPatterns(input->text, input->length, matched, meter);
+
+      // Past where the DFA gave up, the patterns it has not seen match yet
+      // still might.
+      for (size_t i = 0; i < shard.programPatterns.size(); ++i) {
+        size_t position = shard.programPatterns[i];
+        if (matched[i] ||
+            (result == dfa::DFA::Result::GaveUp && shard.regExps[position]->test(text, textLength))) {
+          found.push_back(std::make_pair(&state, position));
+        }
+      }
+    }
+
+    for (auto &position: shard.otherPatterns) {
+      if (shard.regExps[position]->test(text, textLength)) {
+        found.push_back(std::make_pair(&state, position));
+      }
+    }
+
+    std::sort(found.begin() + first, found.end(),
+              [](const std::pair<ShardState *, size_t> &a, const std::pair<ShardState *, size_t> &b) {
+                return a.second < b.second;
+              });
+  }
+}
+
+} // end namespace regexp
+} // end namespace jscre
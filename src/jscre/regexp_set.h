@@ -0,0 +1,192 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_regexp_set_h__
+#define __jscre_regexp_set_h__
+
+#include "regexp.h"
+#include "nfa.h"
+#include "dfa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace jscre {
+namespace regexp {
+
+/*
+ * Patterns that share their flags, matched against a text together.  The
+ * patterns the DFAs can run are compiled into combined programs, whose
+ * DFAs read the text once for all of them: states are sets of NFA nodes,
+ * so a prefix the patterns have in common is read by the same states, and
+ * each accepting state knows which patterns accept there.  Patterns that
+ * need the backtracker (look-ahead assertions, backreferences and large
+ * counted repetitions) are tested one by one, as are the rest of a program
+ * when its DFA gives up on a text.
+ *
+ * A pattern keeps the index add() gives it until it is removed, and
+ * indices are not reused.  The patterns are kept in shards of shardSize
+ * consecutive indices, each with a program of its own, so adding or
+ * removing a pattern only compiles its shard again.  Every change makes a
+ * new snapshot of the shards, which shares the ones that did not change,
+ * and swaps it in atomically; readers go on with the snapshot they have
+ * until their next call.
+ *
+ * add(), remove(), test() and exec() can all be called from any thread.
+ * test() and exec() lease a Matcher from the set for the call, and make a
+ * new one when the others are all in use; a thread can also keep a
+ * Matcher of its own.
+ */
+class RegExpSet {
+public:
+  explicit RegExpSet(bool multiline = false,
+                     bool ignoreCase = false,
+                     bool leftmostFirst = false,
+                     const nfa::Limits &limits = nfa::Limits(),
+                     size_t shardSize = DefaultShardSize);
+  ~RegExpSet();
+
+  RegExpSet(const RegExpSet &) = delete;
+  RegExpSet &operator=(const RegExpSet &) = delete;
+
+  bool getMultiline() const { return _multiline; }
+  bool getIgnoreCase() const { return _ignoreCase; }
+  bool getLeftmostFirst() const { return _leftmostFirst; }
+
+  // Adds a pattern and returns its index.  A pattern with an error never
+  // matches; its RegExp tells what the error is.
+  size_t add(const uint16_t *pattern, size_t patternLength);
+
+  // Removes the pattern at index; returns false if there is none.
+  bool remove(size_t index);
+
+  // The number of patterns, and one past the last index given out.
+  size_t getCount() const;
+  size_t getIndexCount() const;
+
+  // The RegExp of the pattern at index, or nullptr if there is none.
+  RegExpPtr getRegExp(size_t index) const;
+
+  // The indices of the patterns that match somewhere in text, in order.
+  std::vector<size_t> test(const uint16_t *text, size_t textLength) const;
+
+  // By index, the first match of each pattern in text, or nullptr if it
+  // has none.  Only the patterns test() reports are searched for.
+  MatchVector exec(const uint16_t *text, size_t textLength) const;
+
+  class Matcher;
+
+  static constexpr size_t DefaultShardSize = 64;
+
+private:
+  /*
+   * The patterns at some of the indices of a shard, in order.  program
+   * combines those that have one; programPatterns gives the position of
+   * each of them, otherPatterns those of the rest, and inProgram tells the
+   * two apart by position.  The RegExps are not global, so any number of
+   * threads can match with them at once.
+   */
+  struct Shard {
+    std::vector<size_t> indices;
+    std::vector<RegExpPtr> regExps;
+    dfa::ProgramPtr program;
+    std::vector<size_t> programPatterns;
+    std::vector<size_t> otherPatterns;
+    std::vector<bool> inProgram;
+  };
+
+  typedef std::shared_ptr<const Shard> ShardPtr;
+
+  struct Snapshot {
+    std::vector<ShardPtr> shards;
+    size_t count;
+    size_t indexCount;
+  };
+
+  typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+  ShardPtr _buildShard(std::vector<size_t> indices,
+                       std::vector<RegExpPtr> regExps,
+                       std::vector<bool> inProgram) const;
+  SnapshotPtr _getSnapshot() const { return std::atomic_load(&_snapshot); }
+
+  std::unique_ptr<Matcher> _takeMatcher() const;
+  void _returnMatcher(std::unique_ptr<Matcher> &&matcher) const;
+
+  class MatcherLease;
+
+  bool _multiline;
+  bool _ignoreCase;
+  bool _leftmostFirst;
+  nfa::Limits _limits;
+  size_t _shardSize;
+
+  std::mutex _writeMutex;
+  SnapshotPtr _snapshot;
+
+  // Guards the spare Matchers.
+  mutable std::mutex _matcherMutex;
+  mutable std::vector<std::unique_ptr<Matcher>> _spareMatchers;
+};
+
+/*
+ * Matches texts against the latest snapshot of a RegExpSet, with DFAs of
+ * its own.  A DFA is kept for as long as its shard does not change.  The
+ * RegExps of the patterns, which are used for their matches and when a
+ * DFA gives up, are shared with the set and its other Matchers.
+ */
+class RegExpSet::Matcher {
+public:
+  explicit Matcher(const RegExpSet &set);
+
+  Matcher(const Matcher &) = delete;
+  Matcher &operator=(const Matcher &) = delete;
+
+  std::vector<size_t> test(const uint16_t *text, size_t textLength);
+  MatchVector exec(const uint16_t *text, size_t textLength);
+
+private:
+  struct ShardState {
+    ShardPtr shard;
+    dfa::DFAPtr dfa;
+  };
+
+  void _update();
+  void _match(const uint16_t *text, size_t textLength,
+              std::vector<std::pair<ShardState *, size_t>> &found);
+
+  const RegExpSet &_set;
+  SnapshotPtr _snapshot;
+  std::vector<ShardState> _shards;
+};
+
+typedef std::shared_ptr<RegExpSet> RegExpSetPtr;
+
+} // end namespace regexp
+} // end namespace jscre
+
+#endif /* __jscre_regexp_set_h__ */
@@ -0,0 +1,128 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "scan.h"
+#include "utf8.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace jscre {
+namespace scan {
+
+bool scan_file(const char *path,
+               const regexp::RegExp &re,
+               const Callback &callback,
+               dfa::Encoding encoding,
+               size_t windowSize)
+{
+  assert(path != nullptr);
+  assert(encoding != dfa::Encoding::UTF16);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t fileSize = static_cast<size_t>(st.st_size);
+  size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  windowSize = std::max(windowSize + pageSize - 1, pageSize) / pageSize * pageSize;
+
+  size_t window = windowSize;
+  size_t index = 0;
+  while (index < fileSize) {
+    // The character before index is mapped too, as context for the
+    // assertions; it takes at most four bytes.
+    size_t offset = (index - std::min<size_t>(index, 4)) / pageSize * pageSize;
+    size_t length = std::min(index - offset + window, fileSize - offset);
+    bool final = (offset + length == fileSize);
+
+    void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(offset));
+    if (map == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+
+    const uint8_t *text = static_cast<const uint8_t *>(map);
+    size_t start = 0;
+    size_t startIndex = index - offset;
+    size_t textLength = length;
+    if (encoding == dfa::Encoding::UTF8) {
+      // The text seen starts and ends with whole characters: one the window
+      // cuts at its end waits for the next window.
+      while (start < startIndex && utf8::is_continuation(text[start])) {
+        ++start;
+      }
+      if (!final) {
+        while (textLength > startIndex && utf8::is_continuation(text[textLength - 1])) {
+          --textLength;
+        }
+        if (textLength > startIndex && text[textLength - 1] >= 0xc0) {
+          --textLength;
+        }
+      }
+    }
+
+    regexp::ByteMatchVector matches;
+    size_t resume = start + re.execWindow(text + start, textLength - start, encoding,
+                                          startIndex - start, final, matches);
+    munmap(map, length);
+
+    for (auto &match: matches) {
+      for (auto &capture: match.captures) {
+        if (capture.position != exec::Range::NotFound) {
+          capture.position += offset + start;
+        }
+      }
+      callback(match);
+    }
+
+    if (final) {
+      break;
+    }
+    else if (resume > startIndex) {
+      index = offset + resume;
+      window = windowSize;
+    }
+    else {
+      window *= 2;
+    }
+  }
+
+  close(fd);
+  return true;
+}
+
+} // end namespace scan
+} // end namespace jscre
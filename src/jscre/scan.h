@@ -0,0 +1,61 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_scan_h__
+#define __jscre_scan_h__
+
+#include "regexp.h"
+#include "dfa.h"
+#include <stddef.h>
+#include <functional>
+
+namespace jscre {
+namespace scan {
+
+typedef std::function<void (const regexp::ByteMatch &match)> Callback;
+
+constexpr size_t DefaultWindowSize = 64 << 20;
+
+/*
+ * Reports the matches a global execAllUTF8 (or execAllLatin1, for Latin-1
+ * files) finds in the file at path, as absolute byte offsets, without
+ * reading it into memory.  The file is mapped for sequential access a
+ * window of windowSize bytes at a time, and the DFAs run on the mapped
+ * pages as they are (see RegExp::execWindow).  A window moves on past the
+ * matches it settles; one that settles nothing is doubled, so a match, or
+ * a pattern without DFAs, can make it span the rest of the file.
+ *
+ * Returns false if the file cannot be opened or mapped, after reporting
+ * the matches found before that.
+ */
+bool scan_file(const char *path,
+               const regexp::RegExp &re,
+               const Callback &callback,
+               dfa::Encoding encoding = dfa::Encoding::UTF8,
+               size_t windowSize = DefaultWindowSize);
+
+} // end namespace scan
+} // end namespace jscre
+
+#endif /* __jscre_scan_h__ */
@@ -0,0 +1,237 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "stream.h"
+#include "utf16_case.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace jscre {
+namespace stream {
+
+constexpr size_t Stream::_NoClass;
+
+Stream::Stream(const dfa::ProgramPtr &program,
+               bool ignoreCase,
+               const Callback &callback)
+  : _program(program),
+    _ignoreCase(ignoreCase),
+    _callback(callback),
+    _textStart(0),
+    _end(0),
+    _finished(false),
+    _position(0),
+    _before(dfa::CharType::Edge),
+    _matched(false),
+    _matchStart(0),
+    _matchEnd(0),
+    _marks(program->getNodes().size(), 0),
+    _generation(0)
+{
+  assert(_program->getDirection() == dfa::Direction::Forward);
+}
+
+void Stream::feed(const uint16_t *chunk, size_t length)
+{
+  assert(!_finished);
+  assert(chunk != nullptr || length == 0);
+
+  size_t offset = _text.size();
+  _text.insert(_text.end(), chunk, chunk + length);
+  if (_ignoreCase) {
+    utf16::to_lower(_text.data() + offset, length);
+  }
+  _end += length;
+
+  _run();
+  _trim();
+}
+
+void Stream::finish()
+{
+  assert(!_finished);
+  _finished = true;
+
+  // The end of the input is the last position a match can end at.  A
+  // match settled there may leave code units to search again, after which
+  // the end has to be looked at once more.
+  while (true) {
+    _step(dfa::CharType::Edge, _NoClass);
+    if (!_matched) {
+      break;
+    }
+
+    _emit();
+    if (_position > _end) {
+      break;
+    }
+    _run();
+  }
+
+  _threads.clear();
+  _text.clear();
+  _textStart = _end;
+}
+
+void Stream::_run()
+{
+  while (_position < _end) {
+    size_t cls = _program->getClass(_text[_position - _textStart]);
+    dfa::CharType type = _program->getClassType(cls);
+    _step(type, cls);
+    _before = type;
+    ++_position;
+
+    if (_matched && _threads.empty()) {
+      _emit();
+    }
+  }
+}
+
+/*
+ * Follows the threads through the zero-width edges at _position, now that
+ * the code unit after it is known, then across that code unit unless the
+ * input has ended.  Where two threads meet, the one that started first
+ * takes the node: the rest of their matches would be the same.
+ */
+void Stream::_step(dfa::CharType after, size_t cls)
+{
+  const std::vector<dfa::Program::Node> &nodes = _program->getNodes();
+
+  // New matches may start here until one has been found.  Like RegExp's
+  // own search, this does not look for matches starting at the end of the
+  // input.
+  if (!_matched && cls != _NoClass) {
+    _threads.push_back(Thread {_program->getStart(), _position});
+  }
+
+  if (++_generation == 0) {
+    std::fill(_marks.begin(), _marks.end(), 0);
+    _generation = 1;
+  }
+
+  _closure.clear();
+  _stack.assign(_threads.rbegin(), _threads.rend());
+
+  while (!_stack.empty()) {
+    Thread thread = _stack.back();
+    _stack.pop_back();
+
+    if (_marks[thread.node] == _generation) {
+      continue;
+    }
+    _marks[thread.node] = _generation;
+
+    if (thread.node == _program->getAccept()) {
+      // Threads are visited in order of where they started, and once a
+      // match is found only those starting no later are left, so this is
+      // the leftmost match, and the longest for its start so far.
+      if (!_matched || thread.start <= _matchStart) {
+        _matched = true;
+        _matchStart = thread.start;
+        _matchEnd = _position;
+      }
+    }
+
+    const dfa::Program::Node &node = nodes[thread.node];
+    if (node.consuming) {
+      _closure.push_back(thread);
+    }
+
+    for (auto it = node.edges.rbegin(); it != node.edges.rend(); ++it) {
+      switch (it->type) {
+      case dfa::Program::EdgeType::Epsilon:
+        _stack.push_back(Thread {it->node, thread.start});
+        break;
+
+      case dfa::Program::EdgeType::Assertion:
+        if (_program->testAssertion(static_cast<ast::AssertionType>(it->value), _before, after)) {
+          _stack.push_back(Thread {it->node, thread.start});
+        }
+        break;
+
+      case dfa::Program::EdgeType::Transition:
+        break;
+      }
+    }
+  }
+
+  _threads.clear();
+  if (cls == _NoClass) {
+    return;
+  }
+
+  for (auto &thread: _closure) {
+    if (_matched && thread.start > _matchStart) {
+      continue;
+    }
+    for (auto &edge: nodes[thread.node].edges) {
+      if (edge.type == dfa::Program::EdgeType::Transition && _program->testClass(edge.value, cls)) {
+        _threads.push_back(Thread {edge.node, thread.start});
+      }
+    }
+  }
+}
+
+/*
+ * Reports the pending match and goes back to search from its end, or one
+ * past it if it is empty.
+ */
+void Stream::_emit()
+{
+  assert(_matched);
+  _callback(_matchStart, _matchEnd - _matchStart);
+
+  size_t position = _matchEnd;
+  if (_matchStart == _matchEnd) {
+    ++position;
+  }
+
+  _matched = false;
+  _threads.clear();
+  _position = position;
+  if (_position > _end) {
+    return;
+  }
+  _before = _position == 0 ? dfa::CharType::Edge : _typeAt(_position - 1);
+}
+
+/*
+ * Drops the code units that will not be searched again.  While a match is
+ * pending, the search may go back to its end; either way the code unit
+ * before where it resumes is kept for context.
+ */
+void Stream::_trim()
+{
+  size_t keep = _matched ? _matchEnd : _end;
+  keep = std::max(keep > 0 ? keep - 1 : 0, _textStart);
+
+  size_t count = keep - _textStart;
+  if (count > 0 && count * 2 >= _text.size()) {
+    _text.erase(_text.begin(), _text.begin() + count);
+    _textStart = keep;
+  }
+}
+
+} // end namespace stream
+} // end namespace jscre
@@ -0,0 +1,128 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __jscre_stream_h__
+#define __jscre_stream_h__
+
+#include "dfa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace jscre {
+namespace stream {
+
+class Stream;
+typedef std::shared_ptr<Stream> StreamPtr;
+
+/*
+ * Matches a forward program against input that arrives in chunks, for
+ * inputs too large, or too open-ended, to hold in one buffer.  Matches are
+ * reported the way a global execAll finds them (leftmost-longest, with an
+ * empty match moving the search on by one code unit), as absolute offsets
+ * into everything fed so far.
+ *
+ * The search runs one thread per program node, each remembering where its
+ * match started, so no code unit has to be looked at twice unless a match
+ * is pending: once a match is found the search keeps going to see whether
+ * it gets longer, or an earlier one turns up, and the code units after its
+ * end are kept so the search can resume there.  Otherwise only the last
+ * code unit is kept, which is all the context ^, $, \b and \B need; their
+ * checks wait for the code unit after the position, so a chunk boundary
+ * changes nothing.
+ *
+ * A Stream must not be shared between threads.
+ */
+class Stream {
+public:
+  typedef std::function<void (size_t position, size_t length)> Callback;
+
+  Stream(const dfa::ProgramPtr &program,
+         bool ignoreCase,
+         const Callback &callback);
+
+  Stream(const Stream &) = delete;
+  Stream &operator=(const Stream &) = delete;
+
+  // Runs the search over chunk, reporting the matches that it settles.
+  void feed(const uint16_t *chunk, size_t length);
+
+  // Ends the input and reports the matches still pending.  Nothing may be
+  // fed after this.
+  void finish();
+
+  size_t getLength() const { return _end; }
+  size_t getBufferedLength() const { return _text.size(); }
+
+private:
+  struct Thread {
+    uint32_t node;
+    size_t start;
+  };
+
+  static constexpr size_t _NoClass = SIZE_MAX;
+
+  void _run();
+  void _step(dfa::CharType after, size_t cls);
+  void _emit();
+  void _trim();
+
+  dfa::CharType _typeAt(size_t position) const
+  {
+    return _program->getClassType(_program->getClass(_text[position - _textStart]));
+  }
+
+  dfa::ProgramPtr _program;
+  bool _ignoreCase;
+  Callback _callback;
+
+  // Code units from _textStart up to _end; everything before has been
+  // searched for good.
+  std::vector<uint16_t> _text;
+  size_t _textStart;
+  size_t _end;
+  bool _finished;
+
+  // The next code unit to search, and the type of the one before it.
+  size_t _position;
+  dfa::CharType _before;
+
+  // Threads waiting at _position, in order of where they started.
+  std::vector<Thread> _threads;
+
+  bool _matched;
+  size_t _matchStart;
+  size_t _matchEnd;
+
+  std::vector<Thread> _closure;
+  std::vector<Thread> _stack;
+  std::vector<uint32_t> _marks;
+  uint32_t _generation;
+};
+
+} // end namespace stream
+} // end namespace jscre
+
+#endif /* __jscre_stream_h__ */
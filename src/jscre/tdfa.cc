@@ -0,0 +1,354 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tdfa.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace jscre {
+namespace tdfa {
+
+constexpr uint32_t TDFA::_Unknown;
+constexpr uint32_t TDFA::_DeadState;
+constexpr uint32_t TDFA::_NoSlot;
+constexpr uint32_t TDFA::_NoClass;
+constexpr uint32_t TDFA::_Position;
+constexpr uint32_t TDFA::_NoChain;
+
+TDFA::TDFA(const dfa::ProgramPtr &program,
+           size_t stateLimit)
+  : _program(program),
+    _stateLimit(std::max<size_t>(stateLimit, 2)),
+    _stride(program->getClassCount()),
+    _tagCount(program->getTagCount()),
+    _failed(false),
+    _charsSinceReset(0),
+    _marks(program->getNodes().size(), 0),
+    _targetMarks(program->getNodes().size(), 0),
+    _parents(program->getNodes().size(), dfa::Program::NoNode),
+    _generation(0)
+{
+  assert(_program != nullptr);
+  assert(_program->getDirection() == dfa::Direction::Forward);
+  _reset();
+}
+
+void TDFA::_reset()
+{
+  _states.clear();
+  _stateMap.clear();
+  _table.clear();
+  _accepts.clear();
+  std::fill(_startStates, _startStates + dfa::CharTypeCount, _Unknown);
+  _charsSinceReset = 0;
+
+  // The dead state has no nodes left; the scan stops as soon as it is
+  // reached, so its transitions are never looked at.
+  _states.push_back(State {Kernel(), dfa::CharType::Edge});
+  _table.resize(_stride, Transition {_DeadState, _NoSlot, {}, {}});
+  _accepts.resize(dfa::CharTypeCount, Accept {true, _NoSlot, {}});
+}
+
+uint32_t TDFA::_intern(const Kernel &kernel, dfa::CharType type)
+{
+  if (kernel.empty()) {
+    return _DeadState;
+  }
+
+  auto key = std::make_pair(type, kernel);
+  auto it = _stateMap.find(key);
+  if (it != _stateMap.end()) {
+    return it->second;
+  }
+
+  if (_states.size() >= _stateLimit) {
+    return _Unknown;
+  }
+
+  uint32_t state = static_cast<uint32_t>(_states.size());
+  _states.push_back(State {kernel, type});
+  _stateMap.insert(std::make_pair(std::move(key), state));
+  _table.resize(_table.size() + _stride, Transition {_Unknown, _NoSlot, {}, {}});
+  _accepts.resize(_accepts.size() + dfa::CharTypeCount, Accept {false, _NoSlot, {}});
+  return state;
+}
+
+uint32_t TDFA::_startState(dfa::CharType type)
+{
+  uint32_t &start = _startStates[static_cast<size_t>(type)];
+  if (start == _Unknown) {
+    Kernel kernel(1, _program->getStart());
+    start = _intern(kernel, type);
+    if (start == _Unknown) {
+      _reset();
+      start = _intern(kernel, type);
+    }
+  }
+  return start;
+}
+
+void TDFA::_closure(uint32_t state, dfa::CharType before, dfa::CharType after, uint32_t cls,
+                    uint32_t &acceptSlot, std::vector<uint32_t> &acceptTags,
+                    Kernel *kernel, std::vector<uint32_t> *operations)
+{
+  const std::vector<dfa::Program::Node> &nodes = _program->getNodes();
+  const Kernel &current = _states[state].kernel;
+
+  if (++_generation == 0) {
+    std::fill(_marks.begin(), _marks.end(), 0);
+    std::fill(_targetMarks.begin(), _targetMarks.end(), 0);
+    _generation = 1;
+  }
+
+  acceptSlot = _NoSlot;
+  acceptTags.clear();
+  _tagChains.clear();
+
+  // Every slot is followed depth-first in edge order, so nodes are reached
+  // (and transitions taken) in the priority order of the paths leading to
+  // them.  Only the first path to reach a node is kept.  No input is
+  // consumed within a closure, so a path that ends a loop iteration it also
+  // started here has matched empty, and is dropped.
+  for (uint32_t slot = 0; slot < current.size(); ++slot) {
+    _stack.push_back(Item {current[slot], _NoClass, _NoChain, dfa::Program::NoNode});
+
+    while (!_stack.empty()) {
+      Item item = _stack.back();
+      _stack.pop_back();
+
+      if (item.classSet != _NoClass) {
+        if (kernel == nullptr ||
+            !_program->testClass(item.classSet, cls) ||
+            _targetMarks[item.node] == _generation) {
+          continue;
+        }
+        _targetMarks[item.node] = _generation;
+
+        size_t base = operations->size();
+        kernel->push_back(item.node);
+        for (size_t tag = 0; tag < _tagCount; ++tag) {
+          operations->push_back(static_cast<uint32_t>(slot * _tagCount + tag));
+        }
+        for (uint32_t chain = item.tags; chain != _NoChain; chain = _tagChains[chain].second) {
+          (*operations)[base + _tagChains[chain].first] = _Position;
+        }
+        continue;
+      }
+
+      if (_marks[item.node] == _generation) {
+        continue;
+      }
+
+      uint32_t loopHead = nodes[item.node].loopHead;
+      if (loopHead != dfa::Program::NoNode) {
+        uint32_t ancestor = item.parent;
+        while (ancestor != dfa::Program::NoNode && ancestor != loopHead) {
+          ancestor = _parents[ancestor];
+        }
+        if (ancestor == loopHead) {
+          continue;
+        }
+      }
+
+      _marks[item.node] = _generation;
+      _parents[item.node] = item.parent;
+
+      if (item.node == _program->getAccept() && acceptSlot == _NoSlot) {
+        acceptSlot = slot;
+        for (uint32_t chain = item.tags; chain != _NoChain; chain = _tagChains[chain].second) {
+          acceptTags.push_back(_tagChains[chain].first);
+        }
+      }
+
+      const dfa::Program::Node &node = nodes[item.node];
+      for (auto it = node.edges.rbegin(); it != node.edges.rend(); ++it) {
+        switch (it->type) {
+        case dfa::Program::EdgeType::Epsilon:
+          if (it->value == dfa::Program::NoTag) {
+            _stack.push_back(Item {it->node, _NoClass, item.tags, item.node});
+          }
+          else {
+            _tagChains.push_back(std::make_pair(it->value, item.tags));
+            _stack.push_back(Item {it->node, _NoClass, static_cast<uint32_t>(_tagChains.size() - 1), item.node});
+          }
+          break;
+
+        case dfa::Program::EdgeType::Assertion:
+          if (_program->testAssertion(static_cast<ast::AssertionType>(it->value), before, after)) {
+            _stack.push_back(Item {it->node, _NoClass, item.tags, item.node});
+          }
+          break;
+
+        case dfa::Program::EdgeType::Transition:
+          _stack.push_back(Item {it->node, it->value, item.tags, item.node});
+          break;
+        }
+      }
+    }
+  }
+}
+
+const TDFA::Transition *TDFA::_step(uint32_t &state, uint32_t cls)
+{
+  dfa::CharType type = _program->getClassType(cls);
+
+  uint32_t acceptSlot;
+  std::vector<uint32_t> acceptTags;
+  Kernel kernel;
+  std::vector<uint32_t> operations;
+  _closure(state, _states[state].type, type, cls, acceptSlot, acceptTags, &kernel, &operations);
+
+  uint32_t next = _intern(kernel, type);
+  if (next == _Unknown) {
+    if (_charsSinceReset < _MinCharsPerState * _states.size()) {
+      _failed = true;
+      return nullptr;
+    }
+
+    // The register layout only depends on the order of the kernel, so the
+    // registers in use stay valid across the reset.
+    State current = _states[state];
+    _reset();
+    state = _intern(current.kernel, current.type);
+    next = _intern(kernel, type);
+    assert(state != _Unknown && next != _Unknown);
+  }
+
+  Transition &transition = _table[state * _stride + cls];
+  transition.next = next;
+  transition.acceptSlot = acceptSlot;
+  transition.acceptTags = std::move(acceptTags);
+  transition.operations = std::move(operations);
+  return &transition;
+}
+
+const TDFA::Accept &TDFA::_accept(uint32_t state, dfa::CharType boundary)
+{
+  Accept &accept = _accepts[state * dfa::CharTypeCount + static_cast<size_t>(boundary)];
+  if (!accept.computed) {
+    _closure(state, _states[state].type, boundary, _NoClass, accept.slot, accept.tags, nullptr, nullptr);
+    accept.computed = true;
+  }
+  return accept;
+}
+
+dfa::DFA::Result TDFA::match(const exec::Input &input,
+                             size_t inputStartIndex,
+                             exec::Output &output,
+                             exec::Meter &meter)
+{
+  assert(inputStartIndex <= input.length);
+
+  const uint16_t *text = input.text;
+  size_t length = input.length;
+
+  _failed = false;
+  bool matched = false;
+  size_t matchEnd = 0;
+
+  _registers.assign(_tagCount, exec::Range::NotFound);
+  _matchRegisters.assign(_tagCount, exec::Range::NotFound);
+
+  uint32_t state = _startState(inputStartIndex > 0 ? dfa::get_char_type(text[inputStartIndex - 1])
+                                                   : dfa::CharType::Edge);
+
+  size_t current = inputStartIndex;
+  for ( ; current < length; ++current) {
+    if (__builtin_expect(!meter.step(), false)) {
+      return dfa::DFA::Result::NoMatch;
+    }
+
+    uint32_t cls = static_cast<uint32_t>(_program->getClass(text[current]));
+    const Transition *transition = &_table[state * _stride + cls];
+    if (__builtin_expect(transition->next == _Unknown, false)) {
+      transition = _step(state, cls);
+      if (_failed) {
+        return dfa::DFA::Result::GaveUp;
+      }
+    }
+    ++_charsSinceReset;
+
+    if (transition->acceptSlot != _NoSlot) {
+      matched = true;
+      matchEnd = current;
+      std::copy(_registers.begin() + transition->acceptSlot * _tagCount,
+                _registers.begin() + (transition->acceptSlot + 1) * _tagCount,
+                _matchRegisters.begin());
+      for (auto &tag: transition->acceptTags) {
+        _matchRegisters[tag] = current;
+      }
+    }
+
+    if (transition->next == _DeadState) {
+      break;
+    }
+
+    const std::vector<uint32_t> &operations = transition->operations;
+    _nextRegisters.resize(operations.size());
+    for (size_t i = 0; i < operations.size(); ++i) {
+      _nextRegisters[i] = (operations[i] == _Position) ? current : _registers[operations[i]];
+    }
+    _registers.swap(_nextRegisters);
+
+    state = transition->next;
+  }
+
+  if (current == length) {
+    const Accept &accept = _accept(state, dfa::CharType::Edge);
+    if (accept.slot != _NoSlot) {
+      matched = true;
+      matchEnd = current;
+      std::copy(_registers.begin() + accept.slot * _tagCount,
+                _registers.begin() + (accept.slot + 1) * _tagCount,
+                _matchRegisters.begin());
+      for (auto &tag: accept.tags) {
+        _matchRegisters[tag] = current;
+      }
+    }
+  }
+
+  if (!matched) {
+    return dfa::DFA::Result::NoMatch;
+  }
+
+  output.captures[0].position = inputStartIndex;
+  output.captures[0].length = matchEnd - inputStartIndex;
+
+  for (size_t i = 1; i < output.captures.size() && 2 * i + 1 < _tagCount; ++i) {
+    size_t begin = _matchRegisters[2 * i];
+    size_t end = _matchRegisters[2 * i + 1];
+    if (begin != exec::Range::NotFound) {
+      output.captures[i].position = begin;
+      if (end != exec::Range::NotFound) {
+        assert(end >= begin);
+        output.captures[i].length = end - begin;
+      }
+    }
+  }
+
+  return dfa::DFA::Result::Match;
+}
+
+} // end namespace tdfa
+} // end namespace jscre
@@ -0,0 +1,148 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_tdfa_h__
+#define __jscre_tdfa_h__
+
+#include "dfa.h"
+#include "exec.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <map>
+
+namespace jscre {
+namespace tdfa {
+
+/*
+ * A tagged DFA (after Laurikari) that runs a forward dfa::Program anchored
+ * at a given position and recovers the capture groups in the same pass.
+ *
+ * A state is an ordered list of NFA nodes, highest priority first, and each
+ * of them carries one register per capture tag.  Registers are allocated by
+ * position in that list, so a transition only has to say where every
+ * register of the next state comes from: a register of the current state
+ * or the current position.  Among the longest matches the highest-priority
+ * path wins, which is the one the exhaustive search in exec reports.
+ *
+ * Like dfa::DFA, a TDFA is a cache built on demand and must not be shared
+ * between threads.
+ */
+class TDFA {
+public:
+  explicit TDFA(const dfa::ProgramPtr &program,
+                size_t stateLimit = DefaultStateLimit);
+
+  TDFA(const TDFA &) = delete;
+  TDFA &operator=(const TDFA &) = delete;
+
+  const dfa::ProgramPtr &getProgram() const { return _program; }
+
+  dfa::DFA::Result match(const exec::Input &input,
+                         size_t inputStartIndex,
+                         exec::Output &output,
+                         exec::Meter &meter);
+
+  size_t getStateCount() const { return _states.size(); }
+
+  static constexpr size_t DefaultStateLimit = 1024;
+
+private:
+  typedef std::vector<uint32_t> Kernel;
+
+  struct State {
+    Kernel kernel;
+    dfa::CharType type;
+  };
+
+  struct Transition {
+    uint32_t next;
+    uint32_t acceptSlot;
+    std::vector<uint32_t> acceptTags;
+    std::vector<uint32_t> operations;
+  };
+
+  struct Accept {
+    bool computed;
+    uint32_t slot;
+    std::vector<uint32_t> tags;
+  };
+
+  struct Item {
+    uint32_t node;
+    uint32_t classSet;
+    uint32_t tags;
+    uint32_t parent;
+  };
+
+  static constexpr uint32_t _Unknown = UINT32_MAX;
+  static constexpr uint32_t _DeadState = 0;
+  static constexpr uint32_t _NoSlot = UINT32_MAX;
+  static constexpr uint32_t _NoClass = UINT32_MAX;
+  static constexpr uint32_t _Position = UINT32_MAX;
+  static constexpr uint32_t _NoChain = UINT32_MAX;
+  static constexpr size_t _MinCharsPerState = 10;
+
+  void _reset();
+  uint32_t _intern(const Kernel &kernel, dfa::CharType type);
+  uint32_t _startState(dfa::CharType type);
+  void _closure(uint32_t state, dfa::CharType before, dfa::CharType after, uint32_t cls,
+                uint32_t &acceptSlot, std::vector<uint32_t> &acceptTags,
+                Kernel *kernel, std::vector<uint32_t> *operations);
+  const Transition *_step(uint32_t &state, uint32_t cls);
+  const Accept &_accept(uint32_t state, dfa::CharType boundary);
+
+  dfa::ProgramPtr _program;
+  size_t _stateLimit;
+  size_t _stride;
+  size_t _tagCount;
+
+  std::vector<State> _states;
+  std::map<std::pair<dfa::CharType, Kernel>, uint32_t> _stateMap;
+  std::vector<Transition> _table;
+  std::vector<Accept> _accepts;
+  uint32_t _startStates[dfa::CharTypeCount];
+
+  bool _failed;
+  size_t _charsSinceReset;
+
+  std::vector<Item> _stack;
+  std::vector<std::pair<uint32_t, uint32_t>> _tagChains;
+  std::vector<uint32_t> _marks;
+  std::vector<uint32_t> _targetMarks;
+  std::vector<uint32_t> _parents;
+  uint32_t _generation;
+
+  std::vector<size_t> _registers;
+  std::vector<size_t> _nextRegisters;
+  std::vector<size_t> _matchRegisters;
+};
+
+typedef std::shared_ptr<TDFA> TDFAPtr;
+
+} // end namespace tdfa
+} // end namespace jscre
+
+#endif /* __jscre_tdfa_h__ */
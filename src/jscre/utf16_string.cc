@@ -0,0 +1,279 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utf16_string.h"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+#if defined(__x86_64__) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif /* defined(__x86_64__) && defined(__SSSE3__) */
+#include <assert.h>
+
+namespace jscre {
+namespace utf16 {
+
+namespace {
+
+__attribute__((always_inline))
+uint16_t fold_case(uint16_t ch)
+{
+  if (__builtin_expect(ch <= 'Z' && ch >= 'A', false)) {
+    return ch + ('a' - 'A');
+  }
+  return ch;
+}
+
+__attribute__((always_inline))
+bool equal_slow(const uint16_t *lhs, const uint16_t *rhs, size_t length)
+{
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    if (lhs[i] != rhs[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((always_inline))
+bool equal_ignoring_case_slow(const uint16_t *lhs, const uint16_t *rhs, size_t length)
+{
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    if (fold_case(lhs[i]) != fold_case(rhs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+__attribute__((always_inline))
+size_t find_any_slow(const uint16_t *text, size_t length,
+                     const uint16_t *needles, size_t needleCount)
+{
+  size_t i, j;
+  for (i = 0; i < length; ++i) {
+    for (j = 0; j < needleCount; ++j) {
+      if (text[i] == needles[j]) {
+        return i;
+      }
+    }
+  }
+  return length;
+}
+
+__attribute__((always_inline))
+size_t find_in_table_slow(const uint16_t *text, size_t length, const NibbleTable &table)
+{
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    if (text[i] < 0x80 && (table[text[i] & 0xf] & (1 << (text[i] >> 4)))) {
+      return i;
+    }
+  }
+  return length;
+}
+
+__attribute__((always_inline))
+size_t find_slow(const uint16_t *text, size_t length,
+                 const uint16_t *needle, size_t needleLength)
+{
+  size_t i;
+  for (i = 0; i + needleLength <= length; ++i) {
+    if (text[i] == needle[0] && equal_slow(text + i, needle, needleLength)) {
+      return i;
+    }
+  }
+  return length;
+}
+
+#if defined(__x86_64__) && defined(__SSE2__)
+constexpr size_t vector_length = sizeof(__m128i) / sizeof(uint16_t);
+
+__attribute__((always_inline))
+__m128i fold_case(__m128i value)
+{
+  const __m128i AAAA = _mm_set1_epi16('A' - 1);
+  const __m128i ZZZZ = _mm_set1_epi16('Z' + 1);
+  const __m128i diff = _mm_set1_epi16('a' - 'A');
+
+  const __m128i mask = _mm_and_si128(_mm_cmpgt_epi16(value, AAAA),
+                                     _mm_cmpgt_epi16(ZZZZ, value));
+  return _mm_add_epi16(value, _mm_and_si128(diff, mask));
+}
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+} // end namespace
+
+bool equal(const uint16_t *lhs, const uint16_t *rhs, size_t length)
+{
+#if defined(__x86_64__) && defined(__SSE2__)
+  while (__builtin_expect(length >= vector_length, true)) {
+    const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs));
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(l, r)) != 0xffff) {
+      return false;
+    }
+
+    lhs += vector_length;
+    rhs += vector_length;
+    length -= vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  return equal_slow(lhs, rhs, length);
+}
+
+bool equal_ignoring_case(const uint16_t *lhs, const uint16_t *rhs, size_t length)
+{
+#if defined(__x86_64__) && defined(__SSE2__)
+  while (__builtin_expect(length >= vector_length, true)) {
+    const __m128i l = fold_case(_mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs)));
+    const __m128i r = fold_case(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(l, r)) != 0xffff) {
+      return false;
+    }
+
+    lhs += vector_length;
+    rhs += vector_length;
+    length -= vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  return equal_ignoring_case_slow(lhs, rhs, length);
+}
+
+size_t find_any(const uint16_t *text, size_t length,
+                const uint16_t *needles, size_t needleCount)
+{
+  assert(needleCount > 0 && needleCount <= MaxNeedleCount);
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  const __m128i first = _mm_set1_epi16(needles[0]);
+  const __m128i second = _mm_set1_epi16(needles[needleCount > 1 ? 1 : 0]);
+  const __m128i third = _mm_set1_epi16(needles[needleCount > 2 ? 2 : 0]);
+  const __m128i fourth = _mm_set1_epi16(needles[needleCount > 3 ? 3 : 0]);
+
+  size_t offset = 0;
+  while (__builtin_expect(length - offset >= vector_length, true)) {
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset));
+    const __m128i mask = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(value, first),
+                                                   _mm_cmpeq_epi16(value, second)),
+                                      _mm_or_si128(_mm_cmpeq_epi16(value, third),
+                                                   _mm_cmpeq_epi16(value, fourth)));
+    int bits = _mm_movemask_epi8(mask);
+    if (bits != 0) {
+      return offset + (__builtin_ctz(bits) >> 1);
+    }
+
+    offset += vector_length;
+  }
+
+  return offset + find_any_slow(text + offset, length - offset, needles, needleCount);
+#else /* defined(__x86_64__) && defined(__SSE2__) */
+  return find_any_slow(text, length, needles, needleCount);
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+}
+
+size_t find(const uint16_t *text, size_t length,
+            const uint16_t *needle, size_t needleLength)
+{
+  assert(needleLength > 0);
+  if (needleLength > length) {
+    return length;
+  }
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  // Positions are only compared in full where both the first and the last
+  // code unit of the needle line up.
+  const __m128i first = _mm_set1_epi16(needle[0]);
+  const __m128i last = _mm_set1_epi16(needle[needleLength - 1]);
+  const size_t count = length - needleLength + 1;
+
+  size_t offset = 0;
+  while (__builtin_expect(count - offset >= vector_length, true)) {
+    const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset));
+    const __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset + needleLength - 1));
+    int bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(head, first),
+                                               _mm_cmpeq_epi16(tail, last)));
+    while (bits != 0) {
+      size_t i = offset + (__builtin_ctz(bits) >> 1);
+      if (equal(text + i, needle, needleLength)) {
+        return i;
+      }
+      bits &= ~(3 << (__builtin_ctz(bits)));
+    }
+
+    offset += vector_length;
+  }
+
+  return offset + find_slow(text + offset, length - offset, needle, needleLength);
+#else /* defined(__x86_64__) && defined(__SSE2__) */
+  return find_slow(text, length, needle, needleLength);
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+}
+
+size_t find_in_table(const uint16_t *text, size_t length, const NibbleTable &table)
+{
+#if defined(__x86_64__) && defined(__SSSE3__)
+  // Code units are narrowed to bytes with saturation, which is signed on the
+  // input side: 0x0100-0x7fff become 0xff but 0x8000 and above become 0x00.
+  // Taking the maximum with the narrowed high bytes keeps ASCII intact and
+  // gives every other code unit a high nibble >= 8, which the high-nibble
+  // lookup rejects.
+  const __m128i lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+  const __m128i highTable = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibbleMask = _mm_set1_epi8(0xf);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t offset = 0;
+  while (__builtin_expect(length - offset >= 2 * vector_length, true)) {
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset + vector_length));
+    const __m128i value = _mm_max_epu8(_mm_packus_epi16(lo, hi),
+                                       _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+
+    const __m128i lowBits = _mm_shuffle_epi8(lowTable, _mm_and_si128(value, nibbleMask));
+    const __m128i highBits = _mm_shuffle_epi8(highTable,
+                                              _mm_and_si128(_mm_srli_epi16(value, 4), nibbleMask));
+    const __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(lowBits, highBits), zero);
+    int bits = _mm_movemask_epi8(mask) ^ 0xffff;
+    if (bits != 0) {
+      return offset + __builtin_ctz(bits);
+    }
+
+    offset += 2 * vector_length;
+  }
+
+  return offset + find_in_table_slow(text + offset, length - offset, table);
+#else /* defined(__x86_64__) && defined(__SSSE3__) */
+  return find_in_table_slow(text, length, table);
+#endif /* defined(__x86_64__) && defined(__SSSE3__) */
+}
+
+} // end namespace utf16
+} // end namespace jscre
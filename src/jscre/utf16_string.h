@@ -0,0 +1,63 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __jscre_utf16_string_h__
+#define __jscre_utf16_string_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace jscre {
+namespace utf16 {
+
+bool equal(const uint16_t *lhs, const uint16_t *rhs, size_t length);
+bool equal_ignoring_case(const uint16_t *lhs, const uint16_t *rhs, size_t length);
+
+/*
+ * Returns the index of the first code unit in text that equals one of the
+ * needles (at most MaxNeedleCount), or length if there is none.
+ */
+constexpr size_t MaxNeedleCount = 4;
+size_t find_any(const uint16_t *text, size_t length,
+                const uint16_t *needles, size_t needleCount);
+
+/*
+ * Returns the index of the first occurrence of needle in text, or length
+ * if there is none.
+ */
+size_t find(const uint16_t *text, size_t length,
+            const uint16_t *needle, size_t needleLength);
+
+/*
+ * Returns the index of the first code unit in text that belongs to the
+ * ASCII set described by table, or length if there is none.  A code unit
+ * ch < 0x80 is in the set iff (table[ch & 0xf] & (1 << (ch >> 4))) != 0.
+ */
+typedef uint8_t NibbleTable[16];
+size_t find_in_table(const uint16_t *text, size_t length, const NibbleTable &table);
+
+} // end namespace utf16
+} // end namespace jscre
+
+#endif /* __jscre_utf16_string_h__ */
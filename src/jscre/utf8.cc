@@ -0,0 +1,175 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "utf8.h"
+#include <assert.h>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+namespace jscre {
+namespace utf8 {
+
+namespace {
+
+/*
+ * Decodes the sequence at text[0, length), returning its length in bytes,
+ * or 0 if it is not well-formed (Unicode, table 3-7).
+ */
+size_t decode(const uint8_t *text, size_t length, uint32_t &ch)
+{
+  uint8_t lead = text[0];
+  if (lead < 0x80) {
+    ch = lead;
+    return 1;
+  }
+
+  size_t size;
+  uint8_t low = 0x80;
+  uint8_t high = 0xbf;
+  if (lead >= 0xc2 && lead <= 0xdf) {
+    size = 2;
+    ch = lead & 0x1f;
+  }
+  else if (lead >= 0xe0 && lead <= 0xef) {
+    size = 3;
+    ch = lead & 0x0f;
+    low = (lead == 0xe0) ? 0xa0 : 0x80;
+    high = (lead == 0xed) ? 0x9f : 0xbf;
+  }
+  else if (lead >= 0xf0 && lead <= 0xf4) {
+    size = 4;
+    ch = lead & 0x07;
+    low = (lead == 0xf0) ? 0x90 : 0x80;
+    high = (lead == 0xf4) ? 0x8f : 0xbf;
+  }
+  else {
+    return 0;
+  }
+
+  if (length < size || text[1] < low || text[1] > high) {
+    return 0;
+  }
+  for (size_t i = 1; i < size; ++i) {
+    if (!is_continuation(text[i])) {
+      return 0;
+    }
+    ch = (ch << 6) | (text[i] & 0x3f);
+  }
+  return size;
+}
+
+#if defined(__x86_64__) && defined(__SSE2__)
+constexpr size_t vector_length = sizeof(__m128i);
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+} // end namespace
+
+bool is_bmp(const uint8_t *text, size_t length)
+{
+  size_t i = 0;
+  while (i < length) {
+#if defined(__x86_64__) && defined(__SSE2__)
+    // Runs of ASCII are skipped a vector at a time.
+    if (__builtin_expect(length - i >= vector_length, true)) {
+      const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+      if (_mm_movemask_epi8(value) == 0) {
+        i += vector_length;
+        continue;
+      }
+    }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+    uint32_t ch;
+    size_t size = decode(text + i, length - i, ch);
+    if (size == 0 || size == 4) {
+      return false;
+    }
+    i += size;
+  }
+  return true;
+}
+
+size_t count_utf16(const uint8_t *text, size_t length)
+{
+  size_t count = 0;
+  size_t i = 0;
+
+#if defined(__x86_64__) && defined(__SSE2__)
+  // Every byte but a continuation byte (-128 to -65 as a signed byte)
+  // starts a character.
+  const __m128i continuation = _mm_set1_epi8(-65);
+  while (__builtin_expect(length - i >= vector_length, true)) {
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(value, continuation)));
+    i += vector_length;
+  }
+#endif /* defined(__x86_64__) && defined(__SSE2__) */
+
+  for (; i < length; ++i) {
+    if (!is_continuation(text[i])) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void to_utf16(const uint8_t *text,
+              size_t length,
+              std::vector<uint16_t> &units,
+              std::vector<size_t> &offsets)
+{
+  units.clear();
+  offsets.clear();
+  units.reserve(length);
+  offsets.reserve(length + 1);
+
+  size_t i = 0;
+  while (i < length) {
+    uint32_t ch;
+    size_t size = decode(text + i, length - i, ch);
+    if (size == 0) {
+      ch = 0xfffd;
+      size = 1;
+    }
+
+    if (ch >= 0x10000) {
+      units.push_back(static_cast<uint16_t>(0xd800 + ((ch - 0x10000) >> 10)));
+      units.push_back(static_cast<uint16_t>(0xdc00 + ((ch - 0x10000) & 0x3ff)));
+      offsets.push_back(i);
+      offsets.push_back(i);
+    }
+    else {
+      units.push_back(static_cast<uint16_t>(ch));
+      offsets.push_back(i);
+    }
+    i += size;
+  }
+
+  offsets.push_back(length);
+  assert(offsets.size() == units.size() + 1);
+}
+
+} // end namespace utf8
+} // end namespace jscre
@@ -0,0 +1,66 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef __jscre_utf8_h__
+#define __jscre_utf8_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace jscre {
+namespace utf8 {
+
+inline bool is_continuation(uint8_t byte)
+{
+  return (byte & 0xc0) == 0x80;
+}
+
+/*
+ * Whether text is well-formed UTF-8 whose characters all come from the
+ * Basic Multilingual Plane, i.e. whether each of them is one UTF-16 code
+ * unit.
+ */
+bool is_bmp(const uint8_t *text, size_t length);
+
+/*
+ * Returns the number of UTF-16 code units text transcodes to, for text
+ * that is_bmp() accepts.
+ */
+size_t count_utf16(const uint8_t *text, size_t length);
+
+/*
+ * Transcodes text to UTF-16, reading every byte that is not part of a
+ * well-formed sequence as U+FFFD.  offsets receives the offset of the byte
+ * each code unit was read from, followed by length; both halves of a
+ * surrogate pair get the offset of their character.
+ */
+void to_utf16(const uint8_t *text,
+              size_t length,
+              std::vector<uint16_t> &units,
+              std::vector<size_t> &offsets);
+
+} // end namespace utf8
+} // end namespace jscre
+
+#endif /* __jscre_utf8_h__ */
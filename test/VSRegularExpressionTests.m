@@ -106,6 +106,205 @@
   STAssertEqualObjects([re matchesInString:input][0][4], @"Rocks", nil);
 }
 
+- (void)testCountedRepetition
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"^(?:[a-f0-9]{2}){512}$"
+                                                                      options:0
+                                                                        error:NULL];
+
+  NSString *input = [@"" stringByPaddingToLength:1024 withString:@"0f" startingAtIndex:0];
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:input], 1UL, nil);
+  STAssertEquals([re numberOfMatchesInString:[input substringFromIndex:1]], 0UL, nil);
+  STAssertEquals([re numberOfMatchesInString:[input stringByAppendingString:@"g"]], 0UL, nil);
+}
+
+- (void)testCaseInsensitiveLiteral
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"Content-Type: APPLICATION/JSON"
+                                                                      options:VSRegularExpressionCaseInsensitive
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"content-type: application/json"], 1UL, nil);
+  STAssertEquals([re numberOfMatchesInString:@"CONTENT-TYPE: Application/Json; charset=utf-8"], 1UL, nil);
+  STAssertEquals([re numberOfMatchesInString:@"content-type: application/xml"], 0UL, nil);
+}
+
+- (void)testAnchors
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"^abc"
+                                                                      options:VSRegularExpressionMatchGlobally
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"abcabc"], 1UL, nil);
+  STAssertEquals([re numberOfMatchesInString:@"xabc"], 0UL, nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"^\\w+$"
+                                                 options:VSRegularExpressionMatchGlobally | VSRegularExpressionAnchorsMatchLines
+                                                   error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"foo\nbar baz\nqux"], 2UL, nil);
+}
+
+- (void)testWordBoundary
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"\\bfoo\\b"
+                                                                      options:VSRegularExpressionMatchGlobally
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"foo, foofoo (foo)"], 2UL, nil);
+  STAssertEquals([re numberOfMatchesInString:@"xfoo"], 0UL, nil);
+}
+
+- (void)testEmptyMatch
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"a*"
+                                                                      options:VSRegularExpressionMatchGlobally
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEqualObjects([re matchesInString:@"baab"][1][0], @"aa", nil);
+}
+
+- (void)testBackreference
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"(['\"])[^'\"]*\\1"
+                                                                      options:VSRegularExpressionMatchGlobally
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"say \"hi' and 'bye'"], 1UL, nil);
+  STAssertEqualObjects([re matchesInString:@"say \"hi' and 'bye'"][0][0], @"' and '", nil);
+
+  STAssertNil([VSRegularExpression regularExpressionWithPattern:@"(a)\\2" options:0 error:NULL], nil);
+}
+
+- (void)testLeftmostFirst
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"\".*?\""
+                                                                      options:VSRegularExpressionMatchGlobally | VSRegularExpressionLeftmostFirst
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"say \"a\" and \"b\""], 2UL, nil);
+  STAssertEqualObjects([re matchesInString:@"say \"a\" and \"b\""][0][0], @"\"a\"", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"a|ab"
+                                                 options:VSRegularExpressionLeftmostFirst
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"abc"][0][0], @"a", nil);
+}
+
+- (void)testEmptyLoop
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"(a|)+(?=c)"
+                                                                      options:0
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEqualObjects([re matchesInString:@"aaac"][0][0], @"aaa", nil);
+  STAssertEqualObjects([re matchesInString:@"aaac"][0][1], @"a", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"(?:a*)*b"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEquals([re numberOfMatchesInString:@"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaac"], 0UL, nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"(a|){0,3}"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"a"][0][0], @"a", nil);
+  STAssertEqualObjects([re matchesInString:@"a"][0][1], @"a", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"(a|){2,4}(?=c)"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"ac"][0][0], @"a", nil);
+  STAssertEqualObjects([re matchesInString:@"ac"][0][1], @"", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"(a?\?){0,3}"
+                                                 options:VSRegularExpressionLeftmostFirst
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"a"][0][0], @"a", nil);
+}
+
+- (void)testAlternationPrefix
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"abc|abd"
+                                                                      options:VSRegularExpressionMatchGlobally
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfMatchesInString:@"abc abd abe"], 2UL, nil);
+  STAssertEqualObjects([re matchesInString:@"abc abd abe"][1][0], @"abd", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"foo|foobar"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"foobar"][0][0], @"foobar", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"foo|foobar"
+                                                 options:VSRegularExpressionLeftmostFirst
+                                                   error:NULL];
+
+  STAssertEqualObjects([re matchesInString:@"foobar"][0][0], @"foo", nil);
+}
+
+- (void)testSingleCharacterAlternation
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"(a|b|c)+"
+                                                                      options:0
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEquals([re numberOfCaptureGroups], 1UL, nil);
+  STAssertEqualObjects([re matchesInString:@"xabcx"][0][0], @"abc", nil);
+  STAssertEqualObjects([re matchesInString:@"xabcx"][0][1], @"c", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"x(?:a|b|c)y"
+                                                 options:VSRegularExpressionMatchGlobally
+                                                   error:NULL];
+
+  STAssertEquals([re numberOfMatchesInString:@"xay xcy xdy"], 2UL, nil);
+}
+
+- (void)testRedundantGroups
+{
+  VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"(?:(?:ab)(?:cd))e"
+                                                                      options:0
+                                                                        error:NULL];
+
+  STAssertNotNil(re, nil);
+  STAssertEqualObjects([re matchesInString:@"xabcde"][0][0], @"abcde", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"(?:x)(a)(?:(?:y))(b)"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEquals([re numberOfCaptureGroups], 2UL, nil);
+  STAssertEqualObjects([re matchesInString:@"xayb"][0][1], @"a", nil);
+  STAssertEqualObjects([re matchesInString:@"xayb"][0][2], @"b", nil);
+
+  re = [VSRegularExpression regularExpressionWithPattern:@"((?:a))((b))"
+                                                 options:0
+                                                   error:NULL];
+
+  STAssertEquals([re numberOfCaptureGroups], 3UL, nil);
+  STAssertEqualObjects([re matchesInString:@"ab"][0][1], @"a", nil);
+  STAssertEqualObjects([re matchesInString:@"ab"][0][2], @"b", nil);
+  STAssertEqualObjects([re matchesInString:@"ab"][0][3], @"b", nil);
+}
+
 - (void)testReplacement
 {
   VSRegularExpression *re = [VSRegularExpression regularExpressionWithPattern:@"\"([a-zA-Z_][a-zA-Z0-9_]*)\""
@@ -0,0 +1,1011 @@
+/* vim: set ft=cpp fenc=utf-8 sw=2 ts=2 et: */
+/*
+ * Copyright (c) 2013 Chongyu Zhu <lembacon@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Tests of the C++ interfaces that VSRegularExpression does not wrap.
+ * Each test_* function checks one feature; main runs them all and exits
+ * with a non-zero status if any check fails.
+ */
+
+#include "jscre/regexp.h"
+#include "jscre/regexp_batch.h"
+#include "jscre/regexp_set.h"
+#include "jscre/stream.h"
+#include "jscre/utf16_string.h"
+#include "jscre/scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace jscre;
+
+namespace {
+
+size_t failures = 0;
+
+void check(bool passed, const char *expression, const char *file, int line)
+{
+  if (!passed) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    ++failures;
+  }
+}
+
+#define CHECK(expression) check((expression), #expression, __FILE__, __LINE__)
+
+std::vector<uint16_t> to_utf16(const std::string &text)
+{
+  return std::vector<uint16_t>(text.begin(), text.end());
+}
+
+regexp::RegExpPtr compile(const std::string &pattern, bool global = false, bool multiline = false)
+{
+  std::vector<uint16_t> units = to_utf16(pattern);
+  return std::make_shared<regexp::RegExp>(units.data(), units.size(), global, multiline);
+}
+
+long long milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Words, numbers, spaces and line feeds in a pseudo-random order, with a
+// long tag every so often, up to length code units.
+std::vector<uint16_t> random_text(size_t length, uint32_t seed)
+{
+  static const char *const pieces[] = {
+    "ab", "foo12bar", " ", "\n", "x", "quux", "aa", "cc", "<tag>"
+  };
+  std::string text;
+  while (text.size() < length) {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 500 == 0) {
+      text += "<" + std::string(1000, 'z') + ">";
+    }
+    else {
+      text += pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+  }
+  return to_utf16(text);
+}
+
+bool same_match(const regexp::MatchPtr &lhs, const regexp::MatchPtr &rhs)
+{
+  if (lhs == nullptr || rhs == nullptr) {
+    return lhs == rhs;
+  }
+  if (lhs->getCapturedCount() != rhs->getCapturedCount()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs->getCapturedCount(); ++i) {
+    if (lhs->getCapturedTextIndex(i) != rhs->getCapturedTextIndex(i) ||
+        lhs->getCapturedTextLength(i) != rhs->getCapturedTextLength(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool same_matches(const regexp::MatchVector &lhs, const regexp::MatchVector &rhs)
+{
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (!same_match(lhs[i], rhs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_find_in_table()
+{
+  // NUL and 'a', among code units that narrow to either of them unless
+  // the search tells them apart from ASCII: 0x8000 and above saturate to
+  // 0x00, and the low byte of 0x8061 is 'a'.
+  utf16::NibbleTable table = {};
+  static const uint16_t members[] = { 0x00, 'a' };
+  for (uint16_t ch: members) {
+    table[ch & 0xf] |= 1 << (ch >> 4);
+  }
+  static const uint16_t others[] = { 0x8000, 0x8061, 0xff00, 0xffff, 0x0100, 0x7f61, 'b' };
+
+  for (size_t length = 1; length <= 80; ++length) {
+    for (size_t position = 0; position <= length; ++position) {
+      std::vector<uint16_t> text(length);
+      for (size_t i = 0; i < length; ++i) {
+        text[i] = others[(i * 7 + length) % (sizeof(others) / sizeof(others[0]))];
+      }
+      if (position < length) {
+        text[position] = members[position % 2];
+      }
+      CHECK(utf16::find_in_table(text.data(), length, table) == position);
+    }
+  }
+
+  // The other searches compare whole code units.
+  std::vector<uint16_t> text(40, 0x8000);
+  text[33] = 0x8061;
+  text[34] = 0xff61;
+  static const uint16_t needles[] = { 0x0061, 0xff61 };
+  CHECK(utf16::find_any(text.data(), text.size(), needles, 2) == 34);
+  static const uint16_t needle[] = { 0x8061, 0xff61 };
+  CHECK(utf16::find(text.data(), text.size(), needle, 2) == 33);
+  CHECK(utf16::find(text.data(), text.size(), needles, 2) == text.size());
+}
+
+void test_deadline()
+{
+  // Every way of splitting the run of a's is tried in the look-ahead.
+  regexp::RegExpPtr re = compile("(?=(a+)+b)a");
+  std::vector<uint16_t> text = to_utf16(std::string(40, 'a'));
+
+  exec::Budget budget;
+  auto start = std::chrono::steady_clock::now();
+  budget.deadline = start + std::chrono::milliseconds(200);
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+  CHECK(milliseconds_since(start) < 2000);
+
+  text = to_utf16("aab");
+  budget.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Match);
+}
+
+void test_step_limit()
+{
+  regexp::RegExpPtr re = compile("(?=(a+)+b)a");
+  std::vector<uint16_t> text = to_utf16(std::string(40, 'a'));
+
+  exec::Budget budget;
+  budget.stepLimit = 100000;
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+
+  regexp::MatchPtr match;
+  text = to_utf16("xaab");
+  CHECK(re->exec(text.data(), text.size(), budget, match) == regexp::Status::Match);
+  CHECK(match != nullptr && match->getMatchedIndex() == 1);
+}
+
+void test_memory_limit()
+{
+  // The backreference keeps the backtracker from marking positions as
+  // visited in a bitset, and each state it remembers takes memory.
+  regexp::RegExpPtr re = compile("(a*)*\\1b");
+  std::vector<uint16_t> text = to_utf16(std::string(3000, 'a'));
+
+  exec::Budget budget;
+  budget.memoryLimit = 1 << 12;
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+
+  budget = exec::Budget();
+  budget.stateLimit = 1000;
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+
+  // The states are charged as the table that holds them grows, and are
+  // released after each start position.
+  re = compile("(\\w+)\\s\\1");
+  text = to_utf16(std::string(300, 'x') + " abc abc");
+  budget = exec::Budget();
+  budget.memoryLimit = 1 << 20;
+  regexp::MatchPtr match;
+  CHECK(re->exec(text.data(), text.size(), budget, match) == regexp::Status::Match);
+  CHECK(match != nullptr && match->getMatchedIndex() == 301 && match->getMatchedLength() == 7);
+}
+
+void test_cancelled()
+{
+  regexp::RegExpPtr re = compile("(?=(a+)+b)a");
+  std::vector<uint16_t> text = to_utf16(std::string(40, 'a'));
+
+  std::atomic<bool> cancelled(true);
+  exec::Budget budget;
+  budget.cancelled = &cancelled;
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+
+  // Cancelled from another thread while the scan runs.
+  cancelled = false;
+  auto start = std::chrono::steady_clock::now();
+  std::thread canceller([&cancelled]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cancelled = true;
+  });
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+  canceller.join();
+  CHECK(milliseconds_since(start) < 2000);
+}
+
+// A look-ahead keeps the DFA-based engines away, and the pattern has too
+// many nodes for the backtracker's visited bitset on long inputs.
+const char large_pattern[] = "(?=a)\\w+:\\d+:\\w+:\\d+:\\w+:\\d+:\\w+:\\d+:\\w+:\\d+:\\w+:\\d+:\\w+:\\d+:\\w+:\\d+";
+
+std::string engine_of(const std::string &pattern, size_t textLength, bool captures = true)
+{
+  regexp::RegExpPtr re = compile(pattern);
+  return regexp::to_string(re->getStrategy(textLength, captures));
+}
+
+void test_strategy()
+{
+  CHECK(engine_of("foo", 10) == "Search: Literal, Engine: Literal");
+  CHECK(engine_of("(\\d+)-(\\d+)", 10, false) == "Search: DFA, Engine: DFA");
+  CHECK(engine_of("(\\d+)-(\\d+)", 10) == "Search: DFA, Engine: OnePass");
+  CHECK(engine_of("(a|ab)(c|bcd)(d*)", 10) == "Search: DFA, Engine: TaggedDFA");
+  CHECK(engine_of("(\\w+)\\s\\1", 1 << 20) == "Search: Prefilter, Engine: Backtrack");
+
+  // The visited bitset grows with the input for small patterns, but not
+  // for large ones.
+  CHECK(engine_of("(?=a)\\w+", 1 << 20) == "Search: Prefilter, Engine: Backtrack");
+  CHECK(engine_of(large_pattern, 10) == "Search: Prefilter, Engine: Backtrack");
+  CHECK(engine_of(large_pattern, 1 << 20) == "Search: Prefilter, Engine: Exhaustive");
+
+  // The exhaustive search only keeps the longest match it has found, so
+  // its memory does not grow with the number of matches.
+  regexp::RegExpPtr re = compile(large_pattern, true);
+  std::string piece = "a:1:";
+  std::string text;
+  while (text.size() < 8000) {
+    text += piece;
+  }
+  std::vector<uint16_t> units = to_utf16(text);
+  CHECK(re->getStrategy(units.size()).engine == regexp::Strategy::Engine::Exhaustive);
+  regexp::MatchVector matches = re->execAll(units.data(), units.size());
+  CHECK(matches.size() == text.size() / (8 * piece.size()));
+  CHECK(!matches.empty() && matches[0]->getMatchedIndex() == 0 &&
+        matches[0]->getMatchedLength() == 8 * piece.size() - 1);
+
+  std::vector<uint16_t> word = to_utf16(std::string(1 << 17, 'a'));
+  regexp::MatchPtr match = compile("(?=a)\\w+")->exec(word.data(), word.size());
+  CHECK(match != nullptr && match->getMatchedLength() == word.size());
+}
+
+regexp::Complexity::Class worst_case(const std::string &pattern, bool leftmostFirst = false)
+{
+  std::vector<uint16_t> units = to_utf16(pattern);
+  regexp::RegExp re(units.data(), units.size(), false, false, false, leftmostFirst);
+  return re.analyzeComplexity().worstCase;
+}
+
+void test_complexity()
+{
+  typedef regexp::Complexity::Class Class;
+
+  CHECK(worst_case("[a-z]{17}x") == Class::Linear);
+  CHECK(worst_case("(\\w+)\\s\\1") == Class::Polynomial);
+  CHECK(worst_case("(a+)+") == Class::Exponential);
+
+  // Nested and overlapping quantifiers under a bounded repetition.
+  CHECK(worst_case("(a+){2,5}") == Class::Exponential);
+  CHECK(worst_case("(a|ab){8}") == Class::Exponential);
+  CHECK(worst_case("^(?:((b)*|.{2,}){17,18})") == Class::Exponential);
+
+  // Counter loops are backtracked on any input, and so are small patterns,
+  // but long inputs leave a large one to the exhaustive search unless
+  // leftmost-first semantics let the backtracker run it.
+  CHECK(worst_case("a{5000}") == Class::Quadratic);
+  CHECK(worst_case("a{5000}", true) == Class::Quadratic);
+  CHECK(worst_case("(?=a)\\w+") == Class::Quadratic);
+  CHECK(worst_case(large_pattern) == Class::Exponential);
+  CHECK(worst_case(large_pattern, true) == Class::Quadratic);
+}
+
+void test_counted_repetition()
+{
+  // Too large to unroll or to build a DFA for, so the counter loop is left
+  // to the backtracker, which keys its states on the counter value.
+  regexp::RegExpPtr re = compile("(\\d{1,10000})x");
+  std::vector<uint16_t> text = to_utf16(std::string(10000, '1') + "x");
+  CHECK(re->getStrategy(text.size()).engine == regexp::Strategy::Engine::Backtrack);
+
+  regexp::MatchPtr match = re->exec(text.data(), text.size());
+  CHECK(match != nullptr && match->getMatchedIndex() == 0 && match->getMatchedLength() == 10001);
+
+  re = compile("\\d{1,10000}");
+  text = to_utf16(std::string(10000, '1'));
+  match = re->exec(text.data(), text.size());
+  CHECK(match != nullptr && match->getMatchedIndex() == 0 && match->getMatchedLength() == 10000);
+}
+
+// The leftmost match of pattern in text, found by trying it anchored at
+// every start position in turn, so that none is ruled out by how long a
+// match can be.
+exec::Range leftmost_by_trial(const std::string &pattern, const std::vector<uint16_t> &text)
+{
+  regexp::RegExpPtr anchored = compile("^(?:" + pattern + ")");
+  exec::Range range;
+  for (size_t start = 0; start < text.size(); ++start) {
+    regexp::MatchPtr match = anchored->exec(text.data() + start, text.size() - start);
+    if (match != nullptr) {
+      range.position = start;
+      range.length = match->getMatchedLength();
+      break;
+    }
+  }
+  return range;
+}
+
+void test_length_pruning()
+{
+  // Bounded and fixed lengths, the latter without a reverse scan, some of
+  // them too long for the shortest texts.
+  static const char *const patterns[] = {
+    "[a-c]{2,4}x", "foo\\d\\dbar", "\\w{3,5} ", "(a|b)c{2}", "x\\n?a{1,3}", "<[a-z]{3}>", "u{2}x?"
+  };
+  std::vector<std::vector<uint16_t>> texts;
+  for (uint32_t seed = 1; seed <= 40; ++seed) {
+    texts.push_back(random_text(seed * 7 % 120 + 1, seed));
+  }
+  texts.push_back(to_utf16("aaaaaaaaaax"));
+
+  for (auto pattern: patterns) {
+    regexp::RegExpPtr re = compile(pattern);
+    for (auto &text: texts) {
+      exec::Range expected = leftmost_by_trial(pattern, text);
+      regexp::MatchPtr match = re->exec(text.data(), text.size());
+      CHECK(match == nullptr ? expected.position == exec::Range::NotFound :
+            match->getMatchedIndex() == expected.position && match->getMatchedLength() == expected.length);
+    }
+  }
+
+  // The match ends at the x, and starts no more than four code units
+  // before it.
+  std::vector<uint16_t> text = texts.back();
+  regexp::MatchPtr match = compile("[a-c]{2,4}x")->exec(text.data(), text.size());
+  CHECK(match != nullptr && match->getMatchedIndex() == 6 && match->getMatchedLength() == 5);
+}
+
+std::vector<std::vector<uint16_t>> engine_texts(const std::string &extra)
+{
+  std::vector<std::vector<uint16_t>> texts;
+  for (uint32_t seed = 1; seed <= 30; ++seed) {
+    texts.push_back(random_text(seed * 11 % 60 + 1, seed));
+  }
+  texts.push_back(to_utf16(extra));
+  return texts;
+}
+
+// Checks that pattern runs on engine, and that every match it finds,
+// captures included, is the one the backtracker finds for the pattern
+// behind an empty look-ahead, which no DFA-based engine takes.
+void check_engine(const std::string &pattern, regexp::Strategy::Engine engine,
+                  const std::vector<std::vector<uint16_t>> &texts)
+{
+  regexp::RegExpPtr re = compile(pattern, true);
+  regexp::RegExpPtr reference = compile("(?=)" + pattern, true);
+  CHECK(re->getStrategy(100).engine == engine);
+  CHECK(reference->getStrategy(100).engine == regexp::Strategy::Engine::Backtrack);
+  for (auto &text: texts) {
+    CHECK(same_matches(re->execAll(text.data(), text.size()),
+                       reference->execAll(text.data(), text.size())));
+  }
+}
+
+void test_tagged_dfa()
+{
+  static const char *const patterns[] = {
+    "(a|ab)(c|bcd)(d*)", "(a*)(a*)", "(x|xa)(a*)(b?)", "(a+)(a+)(a+)", "(\\w+?)(\\d*)x"
+  };
+  std::vector<std::vector<uint16_t>> texts = engine_texts("abcd abcdd xaab aaaa foo12x xab");
+  for (auto pattern: patterns) {
+    check_engine(pattern, regexp::Strategy::Engine::TaggedDFA, texts);
+  }
+}
+
+void test_one_pass()
+{
+  static const char *const patterns[] = {
+    "(\\d+)-(\\d+)", "(\\w+)=(\\d+);", "(a)(b)?c", "x(\\d*)y", "((a)|b)+", "(?:(a)|(b))+",
+    "(\\w+)@(\\w+)\\.com"
+  };
+  std::vector<std::vector<uint16_t>> texts =
+    engine_texts("12-34 key=56; abc ac x12y xy abba ab@cd.com aab=7;");
+  for (auto pattern: patterns) {
+    check_engine(pattern, regexp::Strategy::Engine::OnePass, texts);
+  }
+}
+
+void test_backtrack()
+{
+  // Behind an empty look-ahead, so that the backtracker runs them, except
+  // without a bitset to spare, which leaves them to the exhaustive search.
+  static const char *const patterns[] = {
+    "(?=)(a|ab)(c|bcd)(d*)", "(?=)(x|xa)(a*)(b?)", "(?=)(\\w+)\\s(\\w+)", "(?=)((a)|b)+",
+    "(?=)(a*)*b", "(?=)(a|)+c", "(?=)(?:(a)|b|)*x"
+  };
+  std::vector<std::vector<uint16_t>> texts = engine_texts("abcd abcdd xaab aaaa ccc aab bax");
+  for (auto pattern: patterns) {
+    regexp::RegExpPtr re = compile(pattern, true);
+    regexp::RegExpPtr exhaustive = compile(pattern, true);
+    exhaustive->setBacktrackLimit(0);
+    CHECK(re->getStrategy(100).engine == regexp::Strategy::Engine::Backtrack);
+    CHECK(exhaustive->getStrategy(100).engine == regexp::Strategy::Engine::Exhaustive);
+    for (auto &text: texts) {
+      CHECK(same_matches(re->execAll(text.data(), text.size()),
+                         exhaustive->execAll(text.data(), text.size())));
+    }
+  }
+
+  // No (node, position) is visited twice, so the nested loop takes steps
+  // in proportion to the text, where the exhaustive search tries every
+  // way to split it.
+  regexp::RegExpPtr re = compile("^(?=)(a*)*b");
+  regexp::RegExpPtr exhaustive = compile("^(?=)(a*)*b");
+  exhaustive->setBacktrackLimit(0);
+  std::vector<uint16_t> text = to_utf16(std::string(1000, 'a'));
+  exec::Budget budget;
+  budget.stepLimit = 1000000;
+  CHECK(re->test(text.data(), text.size(), budget) == regexp::Status::NoMatch);
+  CHECK(exhaustive->test(text.data(), text.size(), budget) == regexp::Status::Aborted);
+}
+
+bool same_captures(const regexp::ByteMatchVector &lhs, const regexp::ByteMatchVector &rhs)
+{
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (lhs[i].captures.size() != rhs[i].captures.size()) {
+      return false;
+    }
+    for (size_t j = 0; j < lhs[i].captures.size(); ++j) {
+      if (lhs[i].captures[j].position != rhs[i].captures[j].position ||
+          lhs[i].captures[j].length != rhs[i].captures[j].length) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Text in UTF-8 and in UTF-16, with the UTF-16 offset of each byte offset
+// that starts a character, or of the end of the text.
+struct EncodedText {
+  std::string bytes;
+  std::vector<uint16_t> units;
+  std::vector<size_t> unitOffsets;
+};
+
+// ASCII words, and characters of two, three and four bytes, the last of
+// them beyond the Basic Multilingual Plane unless bmp is set.
+EncodedText encoded_text(size_t length, uint32_t seed, bool bmp)
+{
+  static const struct {
+    const char *bytes;
+    const char16_t *units;
+  } pieces[] = {
+    { "ab", u"ab" }, { "foo12bar", u"foo12bar" }, { " ", u" " }, { "\n", u"\n" },
+    { "\xc3\xa9", u"\u00e9" }, { "\xe2\x82\xac", u"\u20ac" }, { "\xe4\xb8\xad", u"\u4e2d" },
+    { "\xf0\x9f\x98\x80", u"\U0001f600" }
+  };
+  size_t count = sizeof(pieces) / sizeof(pieces[0]) - (bmp ? 1 : 0);
+
+  EncodedText text;
+  text.unitOffsets.push_back(0);
+  while (text.bytes.size() < length) {
+    seed = seed * 1103515245 + 12345;
+    std::string bytes = pieces[(seed >> 16) % count].bytes;
+    std::u16string units = pieces[(seed >> 16) % count].units;
+    // An ASCII piece is as many characters as bytes, anything else one.
+    text.unitOffsets.resize(text.bytes.size() + bytes.size() + 1, SIZE_MAX);
+    for (size_t i = 0; i < units.size() && units.size() == bytes.size(); ++i) {
+      text.unitOffsets[text.bytes.size() + i] = text.units.size() + i;
+    }
+    text.unitOffsets[text.bytes.size()] = text.units.size();
+    text.bytes += bytes;
+    text.units.insert(text.units.end(), units.begin(), units.end());
+    text.unitOffsets.back() = text.units.size();
+  }
+  return text;
+}
+
+// Whether a match found in UTF-8 text, with its UTF-16 offsets, is the one
+// found in the same text in UTF-16.
+bool same_byte_match(const regexp::ByteMatch &byteMatch, const regexp::MatchPtr &match,
+                     const EncodedText &text, bool utf16Offsets)
+{
+  if (match == nullptr || byteMatch.captures.size() != match->getCapturedCount() ||
+      byteMatch.utf16Captures.size() != (utf16Offsets ? match->getCapturedCount() : 0)) {
+    return false;
+  }
+  for (size_t i = 0; i < match->getCapturedCount(); ++i) {
+    const exec::Range &capture = byteMatch.captures[i];
+    size_t index = match->getCapturedTextIndex(i);
+    if (index == exec::Range::NotFound) {
+      if (capture.position != exec::Range::NotFound) {
+        return false;
+      }
+    }
+    else if (capture.position + capture.length >= text.unitOffsets.size() ||
+             text.unitOffsets[capture.position] != index ||
+             text.unitOffsets[capture.position + capture.length] != index + match->getCapturedTextLength(i)) {
+      return false;
+    }
+    if (utf16Offsets &&
+        (byteMatch.utf16Captures[i].position != index ||
+         (index != exec::Range::NotFound &&
+          byteMatch.utf16Captures[i].length != match->getCapturedTextLength(i)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_utf8()
+{
+  static const char16_t *const patterns[] = {
+    u"\\w+", u"[^ -~\\n]+", u"(\\S+) (\\S+)", u"\u00e9|\u20ac(a)?", u"\u4e2d(\\w*)", u"b\\b",
+    u"[\u00e0-\u00ff\u20ac]+"
+  };
+  for (auto pattern: patterns) {
+    std::u16string units(pattern);
+    regexp::RegExp re(reinterpret_cast<const uint16_t *>(units.data()), units.size(), true);
+
+    for (uint32_t seed = 1; seed <= 20; ++seed) {
+      EncodedText text = encoded_text(seed * 13 % 200 + 1, seed, seed % 2 == 0);
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(text.bytes.data());
+
+      regexp::MatchVector expected = re.execAll(text.units.data(), text.units.size());
+      for (int utf16Offsets = 0; utf16Offsets < 2; ++utf16Offsets) {
+        regexp::ByteMatchVector matches = re.execAllUTF8(bytes, text.bytes.size(), utf16Offsets);
+        bool same = matches.size() == expected.size();
+        for (size_t i = 0; same && i < matches.size(); ++i) {
+          same = same_byte_match(matches[i], expected[i], text, utf16Offsets);
+        }
+        CHECK(same);
+      }
+      CHECK(re.testUTF8(bytes, text.bytes.size()) == !expected.empty());
+
+      // From every character, as exec would search from lastIndex.
+      for (size_t startIndex = 0; startIndex < text.bytes.size(); ++startIndex) {
+        if (text.unitOffsets[startIndex] == SIZE_MAX) {
+          continue;
+        }
+        re.setLastIndex(text.unitOffsets[startIndex]);
+        regexp::MatchPtr match = re.exec(text.units.data(), text.units.size());
+        regexp::ByteMatch byteMatch;
+        bool found = re.execUTF8(bytes, text.bytes.size(), startIndex, byteMatch, true);
+        CHECK(found == (match != nullptr));
+        CHECK(!found || same_byte_match(byteMatch, match, text, true));
+      }
+    }
+  }
+}
+
+void test_latin1()
+{
+  // Letters above ASCII, É and é among them, a no-break space, which \\s
+  // matches, and the micro sign, whose uppercase is outside Latin-1.
+  static const char *const pieces[] = {
+    "ab", "foo12bar", " ", "\n", "\xe9", "\xc9t\xe9", "\xa0", "\xb5", "\xff", "\xd7"
+  };
+  static const char16_t *const patterns[] = {
+    u"\\w+", u"[^ -~\\n]+", u"\\s+", u"(\\S+) (\\S+)", u"\u00e9(t)?", u"[\u00c0-\u00ff]+", u"\u00b5|\u039c",
+    u"\\b\\W"
+  };
+  for (auto pattern: patterns) {
+    std::u16string patternUnits(pattern);
+    for (int ignoreCase = 0; ignoreCase < 2; ++ignoreCase) {
+      regexp::RegExp re(reinterpret_cast<const uint16_t *>(patternUnits.data()), patternUnits.size(), true,
+                        false, ignoreCase);
+
+      for (uint32_t seed = 1; seed <= 20; ++seed) {
+        std::string text;
+        uint32_t state = seed;
+        while (text.size() < seed * 13 % 200 + 1) {
+          state = state * 1103515245 + 12345;
+          text += pieces[(state >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+        }
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(text.data());
+        std::vector<uint16_t> units(bytes, bytes + text.size());
+
+        // Byte offsets are UTF-16 offsets.
+        regexp::MatchVector expected = re.execAll(units.data(), units.size());
+        regexp::ByteMatchVector matches = re.execAllLatin1(bytes, text.size());
+        bool same = matches.size() == expected.size();
+        for (size_t i = 0; same && i < matches.size(); ++i) {
+          same = matches[i].captures.size() == expected[i]->getCapturedCount();
+          for (size_t j = 0; same && j < matches[i].captures.size(); ++j) {
+            same = matches[i].captures[j].position == expected[i]->getCapturedTextIndex(j) &&
+                   matches[i].captures[j].length == expected[i]->getCapturedTextLength(j);
+          }
+        }
+        CHECK(same);
+        CHECK(re.testLatin1(bytes, text.size()) == !expected.empty());
+
+        for (size_t startIndex = 0; startIndex < text.size(); ++startIndex) {
+          re.setLastIndex(startIndex);
+          regexp::MatchPtr match = re.exec(units.data(), units.size());
+          regexp::ByteMatch byteMatch;
+          bool found = re.execLatin1(bytes, text.size(), startIndex, byteMatch);
+          CHECK(found == (match != nullptr));
+          CHECK(!found || (byteMatch.captures[0].position == match->getMatchedIndex() &&
+                           byteMatch.captures[0].length == match->getMatchedLength()));
+        }
+      }
+    }
+  }
+}
+
+// Scans text from a file, one page at a time, and checks that it finds
+// what execAllUTF8 or execAllLatin1 finds in the whole text.
+bool scans_like_exec_all(const std::string &text, const regexp::RegExp &re,
+                         dfa::Encoding encoding = dfa::Encoding::UTF8)
+{
+  char path[] = "/tmp/jscre_tests.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+    return false;
+  }
+  close(fd);
+
+  regexp::ByteMatchVector scanned;
+  bool opened = scan::scan_file(path, re, [&scanned](const regexp::ByteMatch &match) {
+    scanned.push_back(match);
+  }, encoding, 1);
+  unlink(path);
+
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(text.data());
+  regexp::ByteMatchVector expected = (encoding == dfa::Encoding::UTF8)
+                                     ? re.execAllUTF8(bytes, text.size())
+                                     : re.execAllLatin1(bytes, text.size());
+  return opened && !expected.empty() && same_captures(scanned, expected);
+}
+
+void test_scan_file()
+{
+  // Words, numbers and two- and three-byte characters, so that matches and
+  // characters straddle the page-sized windows, and the character before a
+  // window, kept as context, is of every length.
+  static const char *const pieces[] = {
+    "ab", "foo12bar", " ", "\n", "x", "\xc3\xa9", "\xe2\x82\xac", "\xe4\xb8\xad" "ab",
+    "\xe2\x80\xa8"
+  };
+  size_t page = sysconf(_SC_PAGESIZE);
+  std::string text;
+  uint32_t seed = 1;
+  while (text.size() < 5 * page) {
+    seed = seed * 1103515245 + 12345;
+    text += pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+  }
+
+  CHECK(scans_like_exec_all(text, *compile("foo\\d+bar", true)));
+  CHECK(scans_like_exec_all(text, *compile("\\bab\\w*", true)));
+  CHECK(scans_like_exec_all(text, *compile("[^ -~\\n]+a?", true)));
+  CHECK(scans_like_exec_all(text, *compile("^ab|x$", true, true)));
+  CHECK(scans_like_exec_all(text, *compile("^", true, true)));
+  CHECK(scans_like_exec_all(text, *compile("(\\w+) (\\w+)", true)));
+  CHECK(scans_like_exec_all(text, *compile("[^ -~\\n]+a?", true), dfa::Encoding::Latin1));
+
+  // Matches no longer than 0 code units are settled up to the end of a
+  // window, so that the next one starts on a page boundary, here in the
+  // middle of a word, and relies on the context for \b.
+  std::string words = "xyz";
+  while (words.size() < 3 * page) {
+    words += "abcdefg ";
+  }
+  CHECK(scans_like_exec_all(words, *compile("\\b", true)));
+
+  // The first window settles the a's before the x, the second one "x\u20ac",
+  // whose euro sign crosses a page, and the third starts after it, with
+  // the whole character as context for ^.
+  std::string straddling = std::string(100, 'b') + std::string(page - 102, 'a') +
+                           "x\xe2\x82\xac" + std::string(page + 200, 'a') + "\n";
+  CHECK(scans_like_exec_all(straddling, *compile("x[^ -~\\n]|^a+\\n|a+", true)));
+
+  // A match longer than a window, which has to grow to settle it.
+  std::string tagged = text.substr(0, 3000) + "<" + std::string(10000, 'z') + ">" + text;
+  CHECK(scans_like_exec_all(tagged, *compile("<[^>]*>|foo\\d+bar", true)));
+
+  // A character beyond the Basic Multilingual Plane, which the DFAs do not
+  // read: the window grows over the whole file.
+  std::string astral = text + "\xf0\x9f\x98\x80" + text;
+  CHECK(scans_like_exec_all(astral, *compile("foo\\d+bar|[^ -~\\n]", true)));
+}
+
+// Checks test and exec of the set, and of a Matcher, against each of the
+// patterns on its own.
+void check_set(regexp::RegExpSet &set, regexp::RegExpSet::Matcher &matcher,
+               const std::vector<std::vector<uint16_t>> &texts)
+{
+  for (auto &text: texts) {
+    std::vector<size_t> indices;
+    regexp::MatchVector matches(set.getIndexCount());
+    for (size_t i = 0; i < set.getIndexCount(); ++i) {
+      regexp::RegExpPtr re = set.getRegExp(i);
+      if (re != nullptr && !re->hasError() && re->test(text.data(), text.size())) {
+        indices.push_back(i);
+        matches[i] = re->exec(text.data(), text.size());
+      }
+    }
+
+    CHECK(set.test(text.data(), text.size()) == indices);
+    CHECK(matcher.test(text.data(), text.size()) == indices);
+    CHECK(same_matches(set.exec(text.data(), text.size()), matches));
+    CHECK(same_matches(matcher.exec(text.data(), text.size()), matches));
+  }
+}
+
+void test_regexp_set()
+{
+  // Shards of two patterns, with DFAs, the backtracker and an error.
+  regexp::RegExpSet set(false, false, false, nfa::Limits(), 2);
+  regexp::RegExpSet::Matcher matcher(set);
+  static const char *const patterns[] = {
+    "foo(\\d+)bar", "\\bqu\\w+", "(a|b)c", "x(?=a)", "(\\w)\\1", "[", "z{3}", "^ab"
+  };
+  for (auto pattern: patterns) {
+    std::vector<uint16_t> units = to_utf16(pattern);
+    set.add(units.data(), units.size());
+  }
+  CHECK(set.getCount() == 8 && set.getIndexCount() == 8);
+  CHECK(set.getRegExp(5) != nullptr && set.getRegExp(5)->hasError());
+
+  std::vector<std::vector<uint16_t>> texts;
+  for (uint32_t seed = 1; seed <= 20; ++seed) {
+    texts.push_back(random_text(seed * 3, seed));
+  }
+  texts.push_back(to_utf16("foo1bar quux bc xa dd zzz"));
+  check_set(set, matcher, texts);
+
+  // Between calls: a whole shard goes, and a new one comes with the
+  // pattern added after it.
+  CHECK(set.remove(2));
+  CHECK(set.remove(3));
+  CHECK(!set.remove(3));
+  CHECK(set.getRegExp(3) == nullptr);
+  std::vector<uint16_t> units = to_utf16("c+");
+  CHECK(set.add(units.data(), units.size()) == 8);
+  CHECK(set.getCount() == 7 && set.getIndexCount() == 9);
+  check_set(set, matcher, texts);
+
+  CHECK(set.remove(0));
+  CHECK(set.remove(8));
+  check_set(set, matcher, texts);
+
+  // From several threads at once, each call on a Matcher leased from the
+  // set.
+  std::vector<std::vector<size_t>> indices;
+  std::vector<regexp::MatchVector> matches;
+  for (auto &text: texts) {
+    indices.push_back(matcher.test(text.data(), text.size()));
+    matches.push_back(matcher.exec(text.data(), text.size()));
+  }
+  std::atomic<size_t> mismatches(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([&]() {
+      for (int round = 0; round < 10; ++round) {
+        for (size_t j = 0; j < texts.size(); ++j) {
+          if (set.test(texts[j].data(), texts[j].size()) != indices[j] ||
+              !same_matches(set.exec(texts[j].data(), texts[j].size()), matches[j])) {
+            ++mismatches;
+          }
+        }
+      }
+    }));
+  }
+  for (auto &thread: threads) {
+    thread.join();
+  }
+  CHECK(mismatches == 0);
+}
+
+const char *const global_patterns[] = {
+  "foo\\d+bar", "\\w+", "a|", "<[^>]*>", "^|c$", "(\\w+) (\\w+)", "(\\w)\\1"
+};
+
+void test_exec_all_parallel()
+{
+  // Several slices long, with long tags that can run across their ends.
+  std::vector<uint16_t> text = random_text(5 * (1 << 16) + 123, 7);
+  for (auto pattern: global_patterns) {
+    for (int multiline = 0; multiline < 2; ++multiline) {
+      regexp::RegExpPtr re = compile(pattern, true, multiline);
+      regexp::MatchVector expected = re->execAll(text.data(), text.size());
+      re->setLastIndex(5);
+      CHECK(same_matches(re->execAllParallel(text.data(), text.size(), 4), expected));
+      CHECK(same_matches(re->execAllParallel(text.data(), text.size(), 2), expected));
+      CHECK(re->getLastIndex() == 5);
+    }
+  }
+}
+
+void test_create_stream()
+{
+  std::vector<uint16_t> text = random_text(3 * 4096, 3);
+  static const size_t chunkLengths[] = { 1, 7, 4096, 100000 };
+  std::vector<exec::Range> found;
+  auto record = [&found](size_t position, size_t length) {
+    exec::Range range;
+    range.position = position;
+    range.length = length;
+    found.push_back(range);
+  };
+
+  for (auto pattern: global_patterns) {
+    regexp::RegExpPtr re = compile(pattern, true, true);
+    regexp::MatchVector expected = re->execAll(text.data(), text.size());
+
+    for (size_t chunkLength: chunkLengths) {
+      stream::StreamPtr stream = re->createStream(record);
+      if (stream == nullptr) {
+        // Only the backreference needs the backtracker.
+        CHECK(std::string(pattern) == "(\\w)\\1");
+        break;
+      }
+
+      found.clear();
+      for (size_t i = 0; i < text.size(); i += chunkLength) {
+        stream->feed(text.data() + i, std::min(chunkLength, text.size() - i));
+      }
+      stream->finish();
+
+      bool same = (found.size() == expected.size());
+      for (size_t i = 0; same && i < found.size(); ++i) {
+        same = (found[i].position == expected[i]->getMatchedIndex() &&
+                found[i].length == expected[i]->getMatchedLength());
+      }
+      CHECK(same);
+    }
+  }
+}
+
+// Enough texts for several 64-text words of the bitmap.
+regexp::TextVector batch_texts(std::vector<std::vector<uint16_t>> &units)
+{
+  for (uint32_t seed = 1; seed <= 200; ++seed) {
+    units.push_back(random_text(1 + seed % 37, seed));
+  }
+  regexp::TextVector texts;
+  for (auto &text: units) {
+    regexp::Text entry;
+    entry.text = text.data();
+    entry.length = text.size();
+    texts.push_back(entry);
+  }
+  return std::move(texts);
+}
+
+const char *const batch_patterns[] = {
+  "foo\\d+bar", "^ab", "qu+x$", "x(?=a)", "(\\w)\\1", "cc|zz", "["
+};
+
+// Checks testBatch and execBatch against exec on each text.
+void check_batch(const regexp::RegExp &re, const regexp::TextVector &texts,
+                 size_t threadCount, size_t laneCount)
+{
+  std::vector<uint64_t> bitmap((texts.size() + 63) / 64, ~uint64_t(0));
+  std::vector<exec::Range> ranges(texts.size());
+  re.testBatch(texts.data(), texts.size(), bitmap.data(), threadCount, laneCount);
+  re.execBatch(texts.data(), texts.size(), ranges.data(), threadCount, laneCount);
+
+  for (size_t i = 0; i < texts.size(); ++i) {
+    // A pattern with an error matches nothing.
+    regexp::MatchPtr match = re.hasError() ? nullptr : re.exec(texts[i].text, texts[i].length);
+    bool tested = (bitmap[i / 64] >> (i % 64)) & 1;
+    CHECK(tested == (match != nullptr));
+    CHECK(match == nullptr ? ranges[i].position == exec::Range::NotFound
+                           : ranges[i].position == match->getMatchedIndex() &&
+                             ranges[i].length == match->getMatchedLength());
+  }
+}
+
+void test_batch()
+{
+  std::vector<std::vector<uint16_t>> units;
+  regexp::TextVector texts = batch_texts(units);
+  for (auto pattern: batch_patterns) {
+    regexp::RegExpPtr re = compile(pattern);
+    check_batch(*re, texts, 1, 1);
+    check_batch(*re, texts, 4, 1);
+  }
+}
+
+void test_interleaved_batch()
+{
+  std::vector<std::vector<uint16_t>> units;
+  regexp::TextVector texts = batch_texts(units);
+  for (auto pattern: batch_patterns) {
+    regexp::RegExpPtr re = compile(pattern);
+    for (size_t laneCount = 2; laneCount <= dfa::DFA::DefaultLaneCount; laneCount *= 2) {
+      check_batch(*re, texts, 1, laneCount);
+      check_batch(*re, texts, 4, laneCount);
+    }
+  }
+}
+
+void test_compile_batch()
+{
+  std::vector<std::vector<uint16_t>> units;
+  static const char *const patterns[] = { "a+", "b", "a+", "(", "a+" };
+  for (auto pattern: patterns) {
+    units.push_back(to_utf16(pattern));
+  }
+  regexp::TextVector texts;
+  for (auto &pattern: units) {
+    regexp::Text entry;
+    entry.text = pattern.data();
+    entry.length = pattern.size();
+    texts.push_back(entry);
+  }
+
+  regexp::CompiledPatternVector shared = regexp::compile_batch(texts, 4);
+  CHECK(shared.size() == 5);
+  CHECK(shared[0].regExp != nullptr && shared[0].regExp == shared[2].regExp);
+  CHECK(shared[3].regExp == nullptr && shared[3].error != nullptr);
+
+  // Global patterns keep lastIndex, which no two of them share.
+  regexp::CompiledPatternVector global = regexp::compile_batch(texts, 4, true);
+  CHECK(global.size() == 5);
+  CHECK(global[3].regExp == nullptr && global[3].error != nullptr);
+  CHECK(global[0].regExp != nullptr && global[2].regExp != nullptr && global[4].regExp != nullptr);
+  CHECK(global[0].regExp != global[2].regExp && global[2].regExp != global[4].regExp);
+
+  std::vector<uint16_t> text = to_utf16("xaa aaa");
+  if (global[0].regExp != nullptr && global[2].regExp != nullptr) {
+    regexp::MatchPtr match = global[0].regExp->exec(text.data(), text.size());
+    CHECK(match != nullptr && match->getMatchedIndex() == 1);
+    match = global[2].regExp->exec(text.data(), text.size());
+    CHECK(match != nullptr && match->getMatchedIndex() == 1);
+    CHECK(global[0].regExp->getLastIndex() == 3 && global[2].regExp->getLastIndex() == 3);
+  }
+}
+
+} // end namespace
+
+int main()
+{
+  test_find_in_table();
+  test_deadline();
+  test_step_limit();
+  test_memory_limit();
+  test_cancelled();
+  test_strategy();
+  test_complexity();
+  test_counted_repetition();
+  test_length_pruning();
+  test_tagged_dfa();
+  test_one_pass();
+  test_backtrack();
+  test_utf8();
+  test_latin1();
+  test_scan_file();
+  test_regexp_set();
+  test_exec_all_parallel();
+  test_create_stream();
+  test_batch();
+  test_interleaved_batch();
+  test_compile_batch();
+
+  if (failures > 0) {
+    fprintf(stderr, "%zu checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}